@@ -0,0 +1,102 @@
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "bench.h"
+
+const char* BENCH_DEFAULT_REPORT = "moebius_bench.json";
+
+struct Scenario{
+    const char* name;
+    void (*run)(const BenchOptions *options, BenchReport *report);
+};
+
+const Scenario SCENARIOS[] = {
+    {"upload", runUploadScenario},
+    {"draws", runDrawsScenario},
+    {"recreate", runRecreateScenario},
+    {"pipeline", runPipelineScenario}
+};
+const uint32_t SCENARIO_COUNT = sizeof(SCENARIOS)/sizeof(SCENARIOS[0]);
+
+static uint32_t parseCount(const char* flag, const char* value){
+    int count = atoi(value);
+    if(count < 1){
+        printf("%s must be positive!\n", flag);
+        exit(EXIT_FAILURE);
+    }
+    return count;
+}
+
+int main(int argc, char** argv) {
+    //--scenario NAME runs upload, draws, recreate or pipeline, repeat it to run several, all of them run without it
+    //--meshes N, --draws N, --frames N, --cycles N and --pipelines N size the scenarios
+    //--gpu-driven renders the draws scenario with indirect draws
+    //--json FILE is where the report goes, moebius_bench.json by default
+    BenchOptions options{};
+    options.meshes = BENCH_DEFAULT_MESHES;
+    options.draws = BENCH_DEFAULT_DRAWS;
+    options.frames = BENCH_DEFAULT_FRAMES;
+    options.cycles = BENCH_DEFAULT_CYCLES;
+    options.pipelines = BENCH_DEFAULT_PIPELINES;
+    options.gpuDriven = false;
+    const char* reportPath = BENCH_DEFAULT_REPORT;
+    std::vector<const Scenario*> selected;
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--scenario") == 0 && i + 1 < argc){
+            const char* name = argv[++i];
+            const Scenario* scenario = nullptr;
+            for(uint32_t j = 0; j < SCENARIO_COUNT; j++){
+                if(strcmp(SCENARIOS[j].name, name) == 0){
+                    scenario = &SCENARIOS[j];
+                }
+            }
+            if(scenario == nullptr){
+                printf("Unknown scenario %s, expected upload, draws, recreate or pipeline!\n", name);
+                exit(EXIT_FAILURE);
+            }
+            selected.push_back(scenario);
+        }
+        else if(strcmp(argv[i], "--meshes") == 0 && i + 1 < argc){
+            options.meshes = parseCount("--meshes", argv[++i]);
+        }
+        else if(strcmp(argv[i], "--draws") == 0 && i + 1 < argc){
+            options.draws = parseCount("--draws", argv[++i]);
+        }
+        else if(strcmp(argv[i], "--frames") == 0 && i + 1 < argc){
+            options.frames = parseCount("--frames", argv[++i]);
+        }
+        else if(strcmp(argv[i], "--cycles") == 0 && i + 1 < argc){
+            options.cycles = parseCount("--cycles", argv[++i]);
+        }
+        else if(strcmp(argv[i], "--pipelines") == 0 && i + 1 < argc){
+            options.pipelines = parseCount("--pipelines", argv[++i]);
+        }
+        else if(strcmp(argv[i], "--json") == 0 && i + 1 < argc){
+            reportPath = argv[++i];
+        }
+        else if(strcmp(argv[i], "--gpu-driven") == 0){
+            options.gpuDriven = true;
+        }
+        else{
+            printf("Unknown argument %s!\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if(selected.empty()){
+        for(uint32_t i = 0; i < SCENARIO_COUNT; i++){
+            selected.push_back(&SCENARIOS[i]);
+        }
+    }
+
+    //Mesa keeps compiled shaders on disk, which would make every cold pipeline warm after the first run. Set it to false to keep the cache.
+    setenv("MESA_SHADER_CACHE_DISABLE", "true", 0);
+
+    BenchReport report{};
+    for(const Scenario* scenario : selected){
+        printf("Running the %s scenario.\n", scenario->name);
+        scenario->run(&options, &report);
+    }
+    writeBenchReport(&report, &options, reportPath);
+    return 0;
+}
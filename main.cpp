@@ -3,7 +3,10 @@
 #include <vulkan/vulkan.h>
 #include <cstdlib>
 #include <cstdio>
+#include <cinttypes>
 #include <cstring>
+#include <algorithm>
+#include <chrono>
 #include "window.h"
 #include "vk.h"
 #include "io.h"
@@ -11,135 +14,250 @@
 #include "draw.h"
 #include "vertex.h"
 #include "descriptor.h"
+#include "geometry.h"
+#include "instance.h"
+#include "cull.h"
+#include "bench.h"
+#include "pacing.h"
+#include "app.h"
 
-const uint32_t WIDTH = 800;
-const uint32_t HEIGHT = 600;
+const uint32_t HEADLESS_DEFAULT_FRAMES = 1000;
 
-#ifdef NDEBUG
-    const bool ENABLE_VALIDATION_LAYERS = false;
-#else
-    const bool ENABLE_VALIDATION_LAYERS = true;
-#endif
+const uint32_t MEMORY_REPORT_INTERVAL = 1000;//Frames between memory pressure checks
 
-const char* DEVICE_EXTENSIONS[] = {
-    VK_KHR_SWAPCHAIN_EXTENSION_NAME
-};
-const uint32_t verticesCount = 4;
-Vertex vertices[verticesCount] = {
-    {{-0.5f, -0.5f}, {1.0f, 0.0f, 0.0f}},
-    {{0.5f, -0.5f}, {0.0f, 1.0f, 0.0f}},
-    {{0.5f, 0.5f}, {0.0f, 0.0f, 1.0f}},
-    {{-0.5f, 0.5f}, {1.0f, 1.0f, 1.0f}}
-};
-
-const uint32_t indicesCount = 6;
-uint32_t indices[indicesCount] = {0, 1, 2, 2, 3, 0};
-
-int main(int, char**) {
+int main(int argc, char** argv) {
     printf("Hello World!\n");
 
-    WindowObjects wo{};
-    initGLFWWindow(&wo, WIDTH, HEIGHT);
-
-    VulkanObjects vko{};
-    vko.instance = createVkInstance(ENABLE_VALIDATION_LAYERS);
-    if(glfwCreateWindowSurface(vko.instance, wo.window, nullptr, &vko.surface) != VK_SUCCESS){
-        printf("Failed to create a Window Surface!");
-        exit(EXIT_FAILURE);
+    //--frames N sets how many frames the CPU may run ahead of the GPU
+    //--bench-record [draws] times command buffer recording across worker counts and exits
+    //--bench-frames [frames] compares throughput and latency across frames in flight settings and exits
+    //--gpu-driven culls on the GPU and draws every mesh with a single indirect draw
+    //--print-graph prints the GPU-driven frame's render graph whenever a command buffer is recorded
+    //--cpu-cull frustum culls meshes on the CPU before recording
+    //--bench-cull [objects] times the CPU culling kernels and exits without touching Vulkan
+    //--bench-resize [resizes] measures the hitch of swapchain recreation while the window is resized every frame
+    //--blocking-recreation drains the device on every swapchain recreation, the baseline --bench-resize compares against
+    //--present-mode fifo|fifo_relaxed|mailbox|immediate picks the preferred mode, unsupported ones fall back; P cycles at runtime
+    //--fps N paces the render loop to N frames per second by sleeping
+    //--stats-interval S prints frame time percentiles every S seconds, 0 only prints them at exit
+    //--stats-csv FILE and --stats-json FILE dump per-frame times and the summary at exit
+    //--gpu-profile FILE writes per-region GPU times to FILE at exit
+    //--headless [frames] renders that many frames into offscreen images as fast as possible, no window or VK_KHR_swapchain needed
+    //--stress-instances [count] adds one instanced draw of count quads, combine with --bench-frames to measure it
+    //--pipeline-cache FILE keeps compiled pipelines in FILE across runs, pipeline_cache.bin by default; --no-pipeline-cache compiles from scratch every run
+    //--capture FILE streams every frame to FILE as YUV, Y4M when it ends in .y4m and raw I420 otherwise, frames the writer can't keep up with are dropped
+    uint32_t framesInFlight = DEFAULT_FRAMES_IN_FLIGHT;
+    uint32_t benchmarkDraws = 0;
+    uint32_t benchmarkFrames = 0;
+    uint32_t benchmarkResizes = 0;
+    uint32_t stressInstances = 0;
+    bool gpuDriven = false;
+    bool cpuCulling = false;
+    bool printGraph = false;
+    bool blockingRecreation = false;
+    uint32_t cullBenchmarkObjects = 0;
+    VkPresentModeKHR requestedPresentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+    double targetFps = 0.0;
+    double statsInterval = FRAME_STATS_DEFAULT_INTERVAL;
+    const char* statsCsvPath = nullptr;
+    const char* statsJsonPath = nullptr;
+    const char* gpuProfilePath = nullptr;
+    uint32_t headlessFrames = 0;
+    const char* capturePath = nullptr;
+    const char* pipelineCachePath = DEFAULT_PIPELINE_CACHE_PATH;
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--frames") == 0){
+            framesInFlight = i + 1 < argc ? atoi(argv[++i]) : 0;//A missing count is reported like an out of range one
+            if(framesInFlight < 1 || framesInFlight > MAX_FRAMES_IN_FLIGHT){
+                printf("--frames must be between 1 and %d!\n", MAX_FRAMES_IN_FLIGHT);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if(strcmp(argv[i], "--bench-record") == 0){
+            benchmarkDraws = RECORD_BENCHMARK_DEFAULT_DRAWS;
+            if(i + 1 < argc && atoi(argv[i + 1]) > 0){
+                benchmarkDraws = atoi(argv[++i]);
+            }
+        }
+        else if(strcmp(argv[i], "--bench-frames") == 0){
+            benchmarkFrames = FRAMES_BENCHMARK_DEFAULT_FRAMES;
+            if(i + 1 < argc && atoi(argv[i + 1]) > 0){
+                benchmarkFrames = atoi(argv[++i]);
+            }
+        }
+        else if(strcmp(argv[i], "--bench-resize") == 0){
+            benchmarkResizes = RESIZE_BENCHMARK_DEFAULT_RESIZES;
+            if(i + 1 < argc && atoi(argv[i + 1]) > 0){
+                benchmarkResizes = atoi(argv[++i]);
+            }
+        }
+        else if(strcmp(argv[i], "--present-mode") == 0 && i + 1 < argc){
+            if(!parsePresentMode(argv[++i], &requestedPresentMode)){
+                printf("--present-mode must be fifo, fifo_relaxed, mailbox or immediate!\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if(strcmp(argv[i], "--fps") == 0 && i + 1 < argc){
+            targetFps = atof(argv[++i]);
+            if(targetFps <= 0.0){
+                printf("--fps must be positive!\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if(strcmp(argv[i], "--stats-interval") == 0 && i + 1 < argc){
+            statsInterval = atof(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--stats-csv") == 0 && i + 1 < argc){
+            statsCsvPath = argv[++i];
+        }
+        else if(strcmp(argv[i], "--stats-json") == 0 && i + 1 < argc){
+            statsJsonPath = argv[++i];
+        }
+        else if(strcmp(argv[i], "--gpu-profile") == 0 && i + 1 < argc){
+            gpuProfilePath = argv[++i];
+        }
+        else if(strcmp(argv[i], "--pipeline-cache") == 0 && i + 1 < argc){
+            pipelineCachePath = argv[++i];
+        }
+        else if(strcmp(argv[i], "--no-pipeline-cache") == 0){
+            pipelineCachePath = nullptr;
+        }
+        else if(strcmp(argv[i], "--capture") == 0 && i + 1 < argc){
+            capturePath = argv[++i];
+        }
+        else if(strcmp(argv[i], "--headless") == 0){
+            headlessFrames = HEADLESS_DEFAULT_FRAMES;
+            if(i + 1 < argc && atoi(argv[i + 1]) > 0){
+                headlessFrames = atoi(argv[++i]);
+            }
+        }
+        else if(strcmp(argv[i], "--gpu-driven") == 0){
+            gpuDriven = true;
+        }
+        else if(strcmp(argv[i], "--print-graph") == 0){
+            printGraph = true;
+        }
+        else if(strcmp(argv[i], "--blocking-recreation") == 0){
+            blockingRecreation = true;
+        }
+        else if(strcmp(argv[i], "--cpu-cull") == 0){
+            cpuCulling = true;
+        }
+        else if(strcmp(argv[i], "--bench-cull") == 0){
+            cullBenchmarkObjects = CULL_BENCHMARK_DEFAULT_OBJECTS;
+            if(i + 1 < argc && atoi(argv[i + 1]) > 0){
+                cullBenchmarkObjects = atoi(argv[++i]);
+            }
+        }
+        else if(strcmp(argv[i], "--stress-instances") == 0){
+            stressInstances = STRESS_SCENE_DEFAULT_INSTANCES;
+            if(i + 1 < argc && atoi(argv[i + 1]) > 0){
+                stressInstances = atoi(argv[++i]);
+            }
+        }
     }
-    vko.physicalDevice = pickVkPhysicalDevice(vko.instance);
-    vkGetPhysicalDeviceProperties(vko.physicalDevice, &vko.physicalDeviceProperties);
-    vkGetPhysicalDeviceFeatures(vko.physicalDevice, &vko.physicalDeviceFeatures);
-    vko.queueFamilyIndices = findQueueFamilies(vko.physicalDevice, vko.surface);
-    vko.device = createLogicalDevice(vko.physicalDevice, &vko.queueFamilyIndices, DEVICE_EXTENSIONS);
-    vkGetDeviceQueue(vko.device, vko.queueFamilyIndices.graphics, 0, &vko.graphicsQueue);
-    vkGetDeviceQueue(vko.device, vko.queueFamilyIndices.present, 0, &vko.presentQueue);
-    SwapChainSupport swapChainSupport = querySwapChainSupport(vko.physicalDevice, vko.surface);
-    vko.capabilities = swapChainSupport.capabilities;
-    vko.surfaceFormat = selectSurfaceFormat(&swapChainSupport);
-    vko.presentMode = selectPresentMode(&swapChainSupport);
-    vko.swapchainExtent = selectSwapchainExtent(&swapChainSupport.capabilities, wo.window);
-    vko.swapchain = createSwapChain(vko.device, vko.physicalDevice, vko.surface, wo.window, vko.swapchainExtent, &swapChainSupport.capabilities, vko.surfaceFormat, vko.presentMode);
-
-    vkGetSwapchainImagesKHR(vko.device, vko.swapchain, &vko.swapchainImageCount, nullptr);
-    vko.swapchainImages = (VkImage*)malloc(sizeof(VkImage)*vko.swapchainImageCount);
-    vkGetSwapchainImagesKHR(vko.device, vko.swapchain, &vko.swapchainImageCount, vko.swapchainImages);
-    vko.swapchainImageViews = createImageViews(vko.device, vko.swapchainImages, vko.swapchainImageCount, vko.surfaceFormat);
 
-    vko.renderPass = createRenderPass(vko.device, vko.surfaceFormat.format);
-
-    vko.descriptorSetLayout = createDescriptorSetLayout(vko.device);
-    vko.descriptorPool = createDescriptorPool(vko.device, MAX_FRAMES_IN_FLIGHT);
-    
-    vko.graphicsPipelineLayout = createGraphicsPipelineLayout(vko.device, vko.descriptorSetLayout);
-    vko.graphicsPipeline = createGraphicsPipeline(vko.device, vko.graphicsPipelineLayout, vko.renderPass);
-
-    vko.swapchainFramebuffers = createFramebuffers(vko.device, vko.swapchainImageViews, vko.swapchainImageCount, vko.renderPass, vko.swapchainExtent);
-
-    vko.commandPool = createCommandPool(vko.device, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT, &vko.queueFamilyIndices);
-    vko.transientCommandPool = createCommandPool(vko.device, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT, &vko.queueFamilyIndices);
-
-    createCommandBuffers(vko.device, vko.commandPool, MAX_FRAMES_IN_FLIGHT, vko.commandBuffers);
-
-    for(int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++){
-        vko.syncObjects[i] = createSyncObjects(vko.device);
+    if(cullBenchmarkObjects > 0){
+        runCullBenchmark(cullBenchmarkObjects, CULL_BENCHMARK_ITERATIONS);
+        return 0;
     }
 
-    vkGetPhysicalDeviceMemoryProperties(vko.physicalDevice, &vko.memProperties);
-
-    printf("Successfully initialised Vulkan.\n");
+    bool headless = headlessFrames > 0;
+    if(headless && (benchmarkFrames > 0 || benchmarkResizes > 0)){
+        printf("--bench-frames and --bench-resize need a window, ignoring them.\n");
+        benchmarkFrames = 0;
+        benchmarkResizes = 0;
+    }
 
-    createVertexBuffer(
-        vko.device,
-        vko.physicalDevice,
-        vko.transientCommandPool,
-        vko.graphicsQueue,
-        vertices,
-        verticesCount,
-        &vko.vertexBuffer,
-        &vko.vertexBufferMemory
-    );
+    AppOptions options;
+    defaultAppOptions(&options);
+    options.framesInFlight = framesInFlight;
+    options.headless = headless;
+    options.gpuDriven = gpuDriven;
+    options.cpuCulling = cpuCulling;
+    options.printRenderGraph = printGraph;
+    options.blockingSwapchainRecreation = blockingRecreation;
+    options.requestedPresentMode = requestedPresentMode;
+    options.meshCount = std::max<uint32_t>(1, benchmarkDraws);
+    options.stressInstances = stressInstances;
+    options.statsInterval = statsInterval;
+    options.statsCsvPath = statsCsvPath;
+    options.statsJsonPath = statsJsonPath;
+    options.pipelineCachePath = pipelineCachePath;
 
-    createIndexBuffer(
-        vko.device,
-        vko.physicalDevice,
-        vko.transientCommandPool,
-        vko.graphicsQueue,
-        indices,
-        indicesCount,
-        &vko.indexBuffer,
-        &vko.indexBufferMemory
-    );
+    WindowObjects wo{};
+    VulkanObjects vko{};
+    createApp(&options, &wo, &vko);
+    if(capturePath != nullptr){
+        if(!headless && !(vko.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT)){
+            printf("Swapchain images can't be copied from, frames won't be captured.\n");
+        }
+        else{
+            uint32_t captureFps = targetFps > 0.0 ? (uint32_t)targetFps : CAPTURE_DEFAULT_FPS;
+            createFrameCapture(vko.device, &vko.allocator, &vko.queueFamilyIndices, vko.surfaceFormat.format, vko.swapchainExtent, capturePath, captureFps, &vko.frameCapture);
+        }
+    }
+    if(headless){
+        printf("Rendering %u headless frames.\n", headlessFrames);
+    }
+    MemoryBudget memoryBudget;
 
-    createUniformBuffers(
-        vko.device,
-        vko.physicalDevice,
-        MAX_FRAMES_IN_FLIGHT,
-        vko.uniformBuffers,
-        vko.uniformBuffersMemory,
-        vko.mappedUniformBuffers
-    );
-    VkDescriptorSetLayout* descriptorSetLayouts = (VkDescriptorSetLayout*)malloc(sizeof(VkDescriptorSetLayout)*MAX_FRAMES_IN_FLIGHT);
-    for(int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++){
-        descriptorSetLayouts[i] = vko.descriptorSetLayout;
+    bool benchmarked = false;//Benchmarks replace the render loop
+    if(benchmarkDraws > 0){
+        runRecordBenchmark(&vko, std::thread::hardware_concurrency(), RECORD_BENCHMARK_ITERATIONS);
+        benchmarked = true;
+    }
+    if(benchmarkFrames > 0){
+        runFramesInFlightBenchmark(&vko, &wo, benchmarkFrames);
+        benchmarked = true;
+    }
+    if(benchmarkResizes > 0){
+        runResizeBenchmark(&vko, &wo, benchmarkResizes);
+        benchmarked = true;
     }
-    createDescriptorSets(vko.device, vko.descriptorPool, MAX_FRAMES_IN_FLIGHT, descriptorSetLayouts, vko.uniformBuffers, vko.descriptorSets);
-    free(descriptorSetLayouts);
 
     uint32_t currentFrame = 0;
+    uint64_t frameCount = 0;
+    FramePacer framePacer;
+    createFramePacer(targetFps, &framePacer);
+    auto loopStart = std::chrono::steady_clock::now();
+
+    while(!benchmarked && (headless ? frameCount < headlessFrames : !glfwWindowShouldClose(wo.window))) {
+        framePacerWait(&framePacer);
+        if(!headless){
+            glfwPollEvents();
+            frameStatsMarkInput(&vko.frameStats);
+        }
+        if(wo.presentModeCycleRequested){
+            wo.presentModeCycleRequested = false;
+            //fifo, fifo_relaxed, mailbox, immediate and around again
+            const VkPresentModeKHR cycle[PRESENT_MODE_COUNT] = {VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR, VK_PRESENT_MODE_MAILBOX_KHR};//Indexed by the current mode
+            setPresentMode(&vko, &wo, cycle[vko.requestedPresentMode]);
+        }
+        drawFrame(&vko, currentFrame, &wo);
+        currentFrame = (currentFrame + 1) % vko.framesInFlight;
 
-    while(!glfwWindowShouldClose(wo.window)) {
-        glfwPollEvents();
-        drawFrame(&vko, currentFrame, &wo, indicesCount);
-        currentFrame = 1 - currentFrame;
+        if(++frameCount % MEMORY_REPORT_INTERVAL == 0){
+            memoryBudget = getMemoryBudget(&vko.allocator);
+            if(isMemoryPressured(&memoryBudget)){
+                printf("GPU Memory is under pressure!\n");
+                printMemoryBudget(&memoryBudget);
+            }
+        }
     }
 
     vkDeviceWaitIdle(vko.device);
+    if(headless && !benchmarked){
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - loopStart).count();
+        printf("Rendered %" PRIu64 " frames in %.3f s, %.1f frames per second.\n", frameCount, seconds, frameCount/seconds);
+    }
+    printFramePacerStats(&framePacer);
+    printGpuProfiler(&vko.gpuProfiler);
+    if(gpuProfilePath != nullptr){
+        writeGpuProfilerReport(&vko.gpuProfiler, gpuProfilePath);
+    }
 
-    vko.cleanUp();
-
-    glfwDestroyWindow(wo.window);
-    glfwTerminate();
+    destroyApp(&vko, &wo);
 
     printf("Successfully cleaned up.\n");
     return 0;
@@ -1,4 +1,6 @@
 #! /bin/sh
 
 glslc shader.vert -o spirv/vert.spv
-glslc shader.frag -o spirv/frag.spv
\ No newline at end of file
+glslc shader.frag -o spirv/frag.spv
+glslc indirect.vert -o spirv/indirect.spv
+glslc cull.comp -o spirv/cull.spv
\ No newline at end of file
@@ -0,0 +1,19 @@
+#version 450
+
+layout(set = 0, binding = 0) uniform FrameUniforms{
+    mat4 view;
+    mat4 proj;
+} frame;
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+layout(location = 2) in mat4 instanceTransform;
+layout(location = 6) in vec4 instanceColor;
+
+layout(location = 0) out vec3 fragColor;
+
+//The cull pass writes each visible object's model matrix and tint as its instance data
+void main() {
+    gl_Position = frame.proj * frame.view * instanceTransform * vec4(inPosition, 0.0, 1.0);
+    fragColor = inColor * instanceColor.rgb;
+}
@@ -1,17 +1,26 @@
 #version 450
 
-layout(binding = 0) uniform UniformBufferObject{
-    mat4 model;
+layout(set = 0, binding = 0) uniform FrameUniforms{
     mat4 view;
     mat4 proj;
-} ubo;
+} frame;
+
+layout(set = 0, binding = 1) uniform ObjectUniforms{
+    mat4 model;
+} object;
+
+layout(push_constant) uniform DrawPushConstants{
+    vec4 tint;
+} draw;
 
 layout(location = 0) in vec2 inPosition;
 layout(location = 1) in vec3 inColor;
+layout(location = 2) in mat4 instanceTransform;
+layout(location = 6) in vec4 instanceColor;
 
 layout(location = 0) out vec3 fragColor;
 
 void main() {
-    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 0.0, 1.0);
-    fragColor = inColor;
-}
\ No newline at end of file
+    gl_Position = frame.proj * frame.view * object.model * instanceTransform * vec4(inPosition, 0.0, 1.0);
+    fragColor = inColor * draw.tint.rgb * instanceColor.rgb;
+}
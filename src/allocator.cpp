@@ -0,0 +1,398 @@
+#include "allocator.h"
+#include <cstdio>
+#include <cstdlib>
+#include "vk.h"
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment){
+    return (value + alignment - 1) & ~(alignment - 1);//Vulkan alignments are always powers of two
+}
+
+void initAllocator(
+    DeviceAllocator *allocator,
+    VkDevice device,
+    const VkPhysicalDeviceMemoryProperties *memProperties,
+    VkDeviceSize blockSize
+){
+    allocator->device = device;
+    allocator->memProperties = *memProperties;
+    allocator->blockSize = blockSize;
+    allocator->allocationCount = 0;
+    allocator->freeCount = 0;
+    allocator->physicalDevice = VK_NULL_HANDLE;
+    allocator->memoryBudgetSupported = false;
+    for(uint32_t i = 0; i < VK_MAX_MEMORY_HEAPS; i++){
+        allocator->heapReserved[i] = 0;
+    }
+    for(uint32_t i = 0; i < MEMORY_CATEGORY_COUNT; i++){
+        allocator->categoryBytes[i] = 0;
+    }
+
+    //Only take the direct path when the host visible device local heap is the big one, not a 256 MiB BAR window
+    VkDeviceSize largestDeviceLocalHeap = 0;
+    for(uint32_t i = 0; i < memProperties->memoryHeapCount; i++){
+        if((memProperties->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) && memProperties->memoryHeaps[i].size > largestDeviceLocalHeap){
+            largestDeviceLocalHeap = memProperties->memoryHeaps[i].size;
+        }
+    }
+    VkMemoryPropertyFlags directFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    allocator->directWrite = false;
+    for(uint32_t i = 0; i < memProperties->memoryTypeCount; i++){
+        const VkMemoryType *type = &memProperties->memoryTypes[i];
+        if((type->propertyFlags & directFlags) == directFlags && memProperties->memoryHeaps[type->heapIndex].size == largestDeviceLocalHeap){
+            allocator->directWrite = true;
+        }
+    }
+}
+
+VkMemoryPropertyFlags deviceLocalPreferredFlags(const DeviceAllocator *allocator){
+    if(allocator->directWrite){
+        return VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    }
+    return 0;
+}
+
+bool isDirectlyWritable(const Allocation *allocation){
+    return allocation->mapped != nullptr && (allocation->propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+}
+
+static bool allocateFromBlock(
+    MemoryBlock *block,
+    VkDeviceSize size,
+    VkDeviceSize alignment,
+    VkDeviceSize offsetLimit,
+    VkDeviceSize *offset
+){
+    //First fit over the ranges, which are sorted by offset so low addresses get reused first
+    for(size_t i = 0; i < block->freeRanges.size(); i++){
+        FreeRange range = block->freeRanges[i];
+        VkDeviceSize alignedOffset = alignUp(range.offset, alignment);
+        VkDeviceSize rangeEnd = range.offset + range.size;
+        if(alignedOffset >= offsetLimit){
+            return false;
+        }
+        if(alignedOffset + size > rangeEnd){
+            continue;
+        }
+
+        block->freeRanges.erase(block->freeRanges.begin() + i);
+        if(alignedOffset + size < rangeEnd){
+            block->freeRanges.insert(block->freeRanges.begin() + i, {alignedOffset + size, rangeEnd - alignedOffset - size});
+        }
+        if(alignedOffset > range.offset){//Alignment padding stays free
+            block->freeRanges.insert(block->freeRanges.begin() + i, {range.offset, alignedOffset - range.offset});
+        }
+
+        block->used += size;
+        block->allocationCount++;
+        *offset = alignedOffset;
+        return true;
+    }
+    return false;
+}
+
+static bool isOptimalTiling(MemoryCategory category){
+    return category == MEMORY_CATEGORY_IMAGE;
+}
+
+static uint32_t createBlock(DeviceAllocator *allocator, uint32_t memoryTypeIndex, VkDeviceSize size, bool optimalTiling){
+    MemoryBlock block{};
+    block.size = size;
+    block.optimalTiling = optimalTiling;
+
+    uint32_t heapIndex = allocator->memProperties.memoryTypes[memoryTypeIndex].heapIndex;
+    MemoryBudget budget = getMemoryBudget(allocator);
+    if(budget.heaps[heapIndex].usage + size > budget.heaps[heapIndex].budget){
+        //The driver may still succeed by paging, but from here on we are competing with other processes
+        printf("Warning: a %lu byte Memory Block exceeds the budget of heap %u!\n", size, heapIndex);
+        printMemoryBudget(&budget);
+    }
+
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryTypeIndex;
+
+    if(vkAllocateMemory(allocator->device, &allocInfo, nullptr, &block.memory) != VK_SUCCESS){
+        printf("Failed to allocate Memory Block of size %lu bytes!\n", size);
+        printAllocatorStats(allocator);
+        exit(EXIT_FAILURE);
+    }
+
+    if(allocator->memProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT){
+        //Host visible blocks stay mapped for their whole lifetime
+        if(vkMapMemory(allocator->device, block.memory, 0, VK_WHOLE_SIZE, 0, &block.mapped) != VK_SUCCESS){
+            printf("Failed to map Memory Block!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    block.freeRanges.push_back({0, size});
+    allocator->heapReserved[heapIndex] += size;
+
+    std::vector<MemoryBlock> &blocks = allocator->blocks[memoryTypeIndex];
+    for(uint32_t i = 0; i < blocks.size(); i++){
+        if(blocks[i].memory == VK_NULL_HANDLE){
+            blocks[i] = block;
+            return i;
+        }
+    }
+    blocks.push_back(block);
+    return blocks.size() - 1;
+}
+
+Allocation allocateMemory(
+    DeviceAllocator *allocator,
+    const VkMemoryRequirements *memRequirements,
+    VkMemoryPropertyFlags requiredProperties,
+    VkMemoryPropertyFlags preferredProperties,
+    MemoryCategory category
+){
+    Allocation allocation{};
+    allocation.size = memRequirements->size;
+    allocation.category = category;
+    allocation.memoryTypeIndex = findMemoryType(
+        &allocator->memProperties,
+        memRequirements->memoryTypeBits,
+        requiredProperties,
+        preferredProperties
+    );
+    allocation.propertyFlags = allocator->memProperties.memoryTypes[allocation.memoryTypeIndex].propertyFlags;
+
+    bool optimalTiling = isOptimalTiling(category);
+    std::vector<MemoryBlock> &blocks = allocator->blocks[allocation.memoryTypeIndex];
+    for(uint32_t i = 0; i < blocks.size() && allocation.blockIndex == UINT32_MAX; i++){
+        if(blocks[i].memory != VK_NULL_HANDLE && blocks[i].optimalTiling == optimalTiling && allocateFromBlock(&blocks[i], memRequirements->size, memRequirements->alignment, UINT64_MAX, &allocation.offset)){
+            allocation.blockIndex = i;
+        }
+    }
+
+    if(allocation.blockIndex == UINT32_MAX){
+        //Anything bigger than a block gets a block of its own
+        VkDeviceSize blockSize = memRequirements->size > allocator->blockSize ? memRequirements->size : allocator->blockSize;
+        allocation.blockIndex = createBlock(allocator, allocation.memoryTypeIndex, blockSize, optimalTiling);
+        allocateFromBlock(&blocks[allocation.blockIndex], memRequirements->size, memRequirements->alignment, UINT64_MAX, &allocation.offset);
+    }
+
+    MemoryBlock *block = &blocks[allocation.blockIndex];
+    allocation.memory = block->memory;
+    if(block->mapped != nullptr){
+        allocation.mapped = (char*)block->mapped + allocation.offset;
+    }
+
+    allocator->allocationCount++;
+    allocator->categoryBytes[category] += allocation.size;
+    return allocation;
+}
+
+bool allocateMemoryBefore(
+    DeviceAllocator *allocator,
+    const VkMemoryRequirements *memRequirements,
+    const Allocation *current,
+    Allocation *allocation
+){
+    //Compaction only ever moves allocations towards the first block and offset 0, so repeated passes converge
+    *allocation = Allocation{};
+    std::vector<MemoryBlock> &blocks = allocator->blocks[current->memoryTypeIndex];
+    for(uint32_t i = 0; i <= current->blockIndex; i++){
+        if(blocks[i].memory == VK_NULL_HANDLE || blocks[i].optimalTiling != isOptimalTiling(current->category)){
+            continue;
+        }
+        VkDeviceSize offsetLimit = i == current->blockIndex ? current->offset : UINT64_MAX;
+        if(allocateFromBlock(&blocks[i], memRequirements->size, memRequirements->alignment, offsetLimit, &allocation->offset)){
+            allocation->memory = blocks[i].memory;
+            allocation->size = memRequirements->size;
+            allocation->memoryTypeIndex = current->memoryTypeIndex;
+            allocation->blockIndex = i;
+            allocation->propertyFlags = current->propertyFlags;
+            allocation->category = current->category;
+            if(blocks[i].mapped != nullptr){
+                allocation->mapped = (char*)blocks[i].mapped + allocation->offset;
+            }
+            allocator->allocationCount++;
+            allocator->categoryBytes[allocation->category] += allocation->size;
+            return true;
+        }
+    }
+    return false;
+}
+
+void freeMemory(DeviceAllocator *allocator, Allocation *allocation){
+    if(allocation->memory == VK_NULL_HANDLE){
+        return;
+    }
+
+    std::vector<MemoryBlock> &blocks = allocator->blocks[allocation->memoryTypeIndex];
+    MemoryBlock *block = &blocks[allocation->blockIndex];
+
+    size_t i = 0;
+    while(i < block->freeRanges.size() && block->freeRanges[i].offset < allocation->offset){
+        i++;
+    }
+    block->freeRanges.insert(block->freeRanges.begin() + i, {allocation->offset, allocation->size});
+
+    //Merge with the following range, then with the preceding one
+    if(i + 1 < block->freeRanges.size() && block->freeRanges[i].offset + block->freeRanges[i].size == block->freeRanges[i + 1].offset){
+        block->freeRanges[i].size += block->freeRanges[i + 1].size;
+        block->freeRanges.erase(block->freeRanges.begin() + i + 1);
+    }
+    if(i > 0 && block->freeRanges[i - 1].offset + block->freeRanges[i - 1].size == block->freeRanges[i].offset){
+        block->freeRanges[i - 1].size += block->freeRanges[i].size;
+        block->freeRanges.erase(block->freeRanges.begin() + i);
+    }
+
+    block->used -= allocation->size;
+    block->allocationCount--;
+    allocator->allocationCount--;
+    allocator->categoryBytes[allocation->category] -= allocation->size;
+    allocator->freeCount++;
+
+    if(block->allocationCount == 0){
+        //Keep one empty block around per memory type so load/unload cycles don't thrash vkAllocateMemory
+        uint32_t liveBlocks = 0;
+        for(const MemoryBlock &other : blocks){
+            if(other.memory != VK_NULL_HANDLE){
+                liveBlocks++;
+            }
+        }
+        if(liveBlocks > 1 || block->size > allocator->blockSize){
+            if(block->mapped != nullptr){
+                vkUnmapMemory(allocator->device, block->memory);
+            }
+            vkFreeMemory(allocator->device, block->memory, nullptr);
+            allocator->heapReserved[allocator->memProperties.memoryTypes[allocation->memoryTypeIndex].heapIndex] -= block->size;
+            *block = MemoryBlock{};
+        }
+    }
+
+    *allocation = Allocation{};
+}
+
+AllocatorStats getAllocatorStats(const DeviceAllocator *allocator){
+    AllocatorStats stats{};
+    stats.allocationCount = allocator->allocationCount;
+
+    VkDeviceSize totalFree = 0;
+    for(uint32_t type = 0; type < allocator->memProperties.memoryTypeCount; type++){
+        for(const MemoryBlock &block : allocator->blocks[type]){
+            if(block.memory == VK_NULL_HANDLE){
+                continue;
+            }
+            stats.blockCount++;
+            stats.bytesReserved += block.size;
+            stats.bytesUsed += block.used;
+            stats.freeRangeCount += block.freeRanges.size();
+            for(const FreeRange &range : block.freeRanges){
+                totalFree += range.size;
+                if(range.size > stats.largestFreeRange){
+                    stats.largestFreeRange = range.size;
+                }
+            }
+        }
+    }
+
+    if(totalFree > 0){
+        stats.fragmentation = 1.0f - (float)stats.largestFreeRange/(float)totalFree;
+    }
+    return stats;
+}
+
+void printAllocatorStats(const DeviceAllocator *allocator){
+    AllocatorStats stats = getAllocatorStats(allocator);
+    printf(
+        "GPU Memory: %u allocations in %u blocks, %lu/%lu bytes used, %u free ranges (largest %lu bytes), fragmentation %.2f\n",
+        stats.allocationCount,
+        stats.blockCount,
+        stats.bytesUsed,
+        stats.bytesReserved,
+        stats.freeRangeCount,
+        stats.largestFreeRange,
+        stats.fragmentation
+    );
+}
+
+void enableMemoryBudget(DeviceAllocator *allocator, VkPhysicalDevice physicalDevice){
+    allocator->physicalDevice = physicalDevice;
+    allocator->memoryBudgetSupported = true;
+}
+
+MemoryBudget getMemoryBudget(const DeviceAllocator *allocator){
+    MemoryBudget budget{};
+    budget.heapCount = allocator->memProperties.memoryHeapCount;
+    for(uint32_t i = 0; i < budget.heapCount; i++){
+        budget.heaps[i].size = allocator->memProperties.memoryHeaps[i].size;
+        budget.heaps[i].budget = budget.heaps[i].size;
+        budget.heaps[i].usage = allocator->heapReserved[i];
+        budget.heaps[i].allocatorReserved = allocator->heapReserved[i];
+        budget.heaps[i].deviceLocal = allocator->memProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+    }
+    for(uint32_t i = 0; i < MEMORY_CATEGORY_COUNT; i++){
+        budget.categoryBytes[i] = allocator->categoryBytes[i];
+    }
+
+    if(allocator->memoryBudgetSupported){
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties{};
+        budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+        VkPhysicalDeviceMemoryProperties2 memProperties2{};
+        memProperties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+        memProperties2.pNext = &budgetProperties;
+        vkGetPhysicalDeviceMemoryProperties2(allocator->physicalDevice, &memProperties2);
+
+        budget.fromExtension = true;
+        for(uint32_t i = 0; i < budget.heapCount; i++){
+            budget.heaps[i].budget = budgetProperties.heapBudget[i];
+            budget.heaps[i].usage = budgetProperties.heapUsage[i];
+        }
+    }
+    return budget;
+}
+
+bool isMemoryPressured(const MemoryBudget *budget){
+    for(uint32_t i = 0; i < budget->heapCount; i++){
+        if(budget->heaps[i].usage > budget->heaps[i].budget*MEMORY_PRESSURE_THRESHOLD){
+            return true;
+        }
+    }
+    return false;
+}
+
+void printMemoryBudget(const MemoryBudget *budget){
+    static const char* categoryNames[MEMORY_CATEGORY_COUNT] = {"vertex", "index", "uniform", "staging", "image", "other"};
+
+    printf("GPU Memory Budget (%s):\n", budget->fromExtension ? "VK_EXT_memory_budget" : "internal accounting");
+    for(uint32_t i = 0; i < budget->heapCount; i++){
+        const HeapBudget *heap = &budget->heaps[i];
+        printf(
+            "  Heap %u%s: %lu/%lu bytes used (%.1f%%), %lu bytes reserved by Moebius, heap size %lu\n",
+            i,
+            heap->deviceLocal ? " (device local)" : "",
+            heap->usage,
+            heap->budget,
+            heap->budget > 0 ? 100.0*heap->usage/heap->budget : 0.0,
+            heap->allocatorReserved,
+            heap->size
+        );
+    }
+    printf("  By category:");
+    for(uint32_t i = 0; i < MEMORY_CATEGORY_COUNT; i++){
+        printf(" %s %lu", categoryNames[i], budget->categoryBytes[i]);
+    }
+    printf("\n");
+}
+
+void destroyAllocator(DeviceAllocator *allocator){
+    if(allocator->allocationCount != 0){
+        printf("%u GPU Memory allocations leaked!\n", allocator->allocationCount);
+    }
+    for(uint32_t type = 0; type < VK_MAX_MEMORY_TYPES; type++){
+        for(MemoryBlock &block : allocator->blocks[type]){
+            if(block.memory == VK_NULL_HANDLE){
+                continue;
+            }
+            if(block.mapped != nullptr){
+                vkUnmapMemory(allocator->device, block.memory);
+            }
+            vkFreeMemory(allocator->device, block.memory, nullptr);
+        }
+        allocator->blocks[type].clear();
+    }
+}
@@ -0,0 +1,119 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+
+#define DEFAULT_MEMORY_BLOCK_SIZE (64ull*1024*1024)
+#define MEMORY_PRESSURE_THRESHOLD 0.9f//Fraction of a heap's budget above which it counts as under pressure
+
+enum MemoryCategory{
+    MEMORY_CATEGORY_VERTEX,
+    MEMORY_CATEGORY_INDEX,
+    MEMORY_CATEGORY_UNIFORM,
+    MEMORY_CATEGORY_STAGING,
+    MEMORY_CATEGORY_IMAGE,
+    MEMORY_CATEGORY_OTHER,
+    MEMORY_CATEGORY_COUNT
+};
+
+struct Allocation{
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    void* mapped = nullptr;//Null unless the memory type is host visible
+    uint32_t memoryTypeIndex = UINT32_MAX;
+    uint32_t blockIndex = UINT32_MAX;
+    VkMemoryPropertyFlags propertyFlags = 0;
+    MemoryCategory category = MEMORY_CATEGORY_OTHER;
+};
+
+struct FreeRange{
+    VkDeviceSize offset;
+    VkDeviceSize size;
+};
+
+struct MemoryBlock{
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    VkDeviceSize used;
+    void* mapped;
+    uint32_t allocationCount;
+    bool optimalTiling;//Images and linear resources never share a block, so bufferImageGranularity can't bite
+    std::vector<FreeRange> freeRanges;//Sorted by offset, neighbouring ranges are always merged
+};
+
+struct AllocatorStats{
+    uint32_t blockCount;//Live vkAllocateMemory allocations
+    uint32_t allocationCount;//Live sub-allocations handed out
+    VkDeviceSize bytesReserved;
+    VkDeviceSize bytesUsed;
+    uint32_t freeRangeCount;
+    VkDeviceSize largestFreeRange;
+    float fragmentation;//0 when all free space is one range, approaches 1 as it splinters
+};
+
+struct HeapBudget{
+    VkDeviceSize size;
+    VkDeviceSize budget;//What the OS lets this process use, the heap size without VK_EXT_memory_budget
+    VkDeviceSize usage;//Whole process usage with VK_EXT_memory_budget, only our own blocks without it
+    VkDeviceSize allocatorReserved;
+    bool deviceLocal;
+};
+
+struct MemoryBudget{
+    bool fromExtension;
+    uint32_t heapCount;
+    HeapBudget heaps[VK_MAX_MEMORY_HEAPS];
+    VkDeviceSize categoryBytes[MEMORY_CATEGORY_COUNT];//Sub-allocated bytes, not block reservations
+};
+
+struct DeviceAllocator{
+    VkDevice device;
+    VkPhysicalDeviceMemoryProperties memProperties;
+    VkDeviceSize blockSize;
+    bool directWrite;//All of device local memory is host visible (resizable BAR, integrated GPUs, lavapipe)
+    VkPhysicalDevice physicalDevice;//Only set once memory budget queries are enabled
+    bool memoryBudgetSupported;
+    VkDeviceSize heapReserved[VK_MAX_MEMORY_HEAPS];
+    VkDeviceSize categoryBytes[MEMORY_CATEGORY_COUNT];
+    std::vector<MemoryBlock> blocks[VK_MAX_MEMORY_TYPES];//Freed blocks keep their slot with a null memory handle
+    uint32_t allocationCount;
+    uint64_t freeCount;//Only free can fragment memory, so the defragmenter sleeps while this stays the same
+};
+
+void initAllocator(
+    DeviceAllocator *allocator,
+    VkDevice device,
+    const VkPhysicalDeviceMemoryProperties *memProperties,
+    VkDeviceSize blockSize
+);
+
+Allocation allocateMemory(
+    DeviceAllocator *allocator,
+    const VkMemoryRequirements *memRequirements,
+    VkMemoryPropertyFlags requiredProperties,
+    VkMemoryPropertyFlags preferredProperties,
+    MemoryCategory category
+);
+
+VkMemoryPropertyFlags deviceLocalPreferredFlags(const DeviceAllocator *allocator);
+bool isDirectlyWritable(const Allocation *allocation);
+
+//Finds room for a copy of current at a lower block or offset of the same memory type, never creates a block
+bool allocateMemoryBefore(
+    DeviceAllocator *allocator,
+    const VkMemoryRequirements *memRequirements,
+    const Allocation *current,
+    Allocation *allocation
+);
+
+void freeMemory(DeviceAllocator *allocator, Allocation *allocation);
+
+AllocatorStats getAllocatorStats(const DeviceAllocator *allocator);
+void printAllocatorStats(const DeviceAllocator *allocator);
+
+void enableMemoryBudget(DeviceAllocator *allocator, VkPhysicalDevice physicalDevice);
+MemoryBudget getMemoryBudget(const DeviceAllocator *allocator);
+bool isMemoryPressured(const MemoryBudget *budget);
+void printMemoryBudget(const MemoryBudget *budget);
+
+void destroyAllocator(DeviceAllocator *allocator);
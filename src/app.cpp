@@ -0,0 +1,258 @@
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include "app.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include "initvk.h"
+#include "descriptor.h"
+#include "vertex.h"
+#include "geometry.h"
+#include "instance.h"
+#include "cull.h"
+
+#ifdef NDEBUG
+    const bool ENABLE_VALIDATION_LAYERS = false;
+#else
+    const bool ENABLE_VALIDATION_LAYERS = true;
+#endif
+
+const char* DEVICE_EXTENSIONS[] = {
+    VK_KHR_SWAPCHAIN_EXTENSION_NAME
+};
+const uint32_t DEVICE_EXTENSION_COUNT = sizeof(DEVICE_EXTENSIONS)/sizeof(DEVICE_EXTENSIONS[0]);
+
+const uint32_t verticesCount = 4;
+Vertex vertices[verticesCount] = {
+    {{-0.5f, -0.5f}, {1.0f, 0.0f, 0.0f}},
+    {{0.5f, -0.5f}, {0.0f, 1.0f, 0.0f}},
+    {{0.5f, 0.5f}, {0.0f, 0.0f, 1.0f}},
+    {{-0.5f, 0.5f}, {1.0f, 1.0f, 1.0f}}
+};
+
+const uint32_t indicesCount = 6;
+uint32_t indices[indicesCount] = {0, 1, 2, 2, 3, 0};
+
+void defaultAppOptions(AppOptions *options){
+    options->width = DEFAULT_WINDOW_WIDTH;
+    options->height = DEFAULT_WINDOW_HEIGHT;
+    options->framesInFlight = DEFAULT_FRAMES_IN_FLIGHT;
+    options->headless = false;
+    options->gpuDriven = false;
+    options->cpuCulling = false;
+    options->printRenderGraph = false;
+    options->blockingSwapchainRecreation = false;
+    options->requestedPresentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+    options->meshCount = 1;
+    options->stressInstances = 0;
+    options->statsInterval = FRAME_STATS_DEFAULT_INTERVAL;
+    options->statsCsvPath = nullptr;
+    options->statsJsonPath = nullptr;
+    options->pipelineCachePath = DEFAULT_PIPELINE_CACHE_PATH;
+}
+
+void createApp(const AppOptions *options, WindowObjects *wo, VulkanObjects *vko){
+    if(!options->headless){
+        initGLFWWindow(wo, options->width, options->height);
+    }
+
+    vko->headless = options->headless;
+    bool gpuDriven = options->gpuDriven;
+    vko->instance = createVkInstance(ENABLE_VALIDATION_LAYERS, options->headless);
+    vko->surface = VK_NULL_HANDLE;
+    if(!options->headless && glfwCreateWindowSurface(vko->instance, wo->window, nullptr, &vko->surface) != VK_SUCCESS){
+        printf("Failed to create a Window Surface!");
+        exit(EXIT_FAILURE);
+    }
+    vko->physicalDevice = pickVkPhysicalDevice(vko->instance);
+    vkGetPhysicalDeviceProperties(vko->physicalDevice, &vko->physicalDeviceProperties);
+    vkGetPhysicalDeviceFeatures(vko->physicalDevice, &vko->physicalDeviceFeatures);
+    vko->queueFamilyIndices = findQueueFamilies(vko->physicalDevice, vko->surface);
+    //Optional extensions are appended after the required ones
+    const char* deviceExtensions[DEVICE_EXTENSION_COUNT + 3];
+    uint32_t deviceExtensionCount = options->headless ? 0 : DEVICE_EXTENSION_COUNT;//Nothing is presented headless, so no swapchain
+    memcpy(deviceExtensions, DEVICE_EXTENSIONS, sizeof(DEVICE_EXTENSIONS));
+    bool memoryBudgetSupported = isDeviceExtensionSupported(vko->physicalDevice, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    if(memoryBudgetSupported){
+        deviceExtensions[deviceExtensionCount++] = VK_EXT_MEMORY_BUDGET_EXTENSION_NAME;
+    }
+    //Present wait tells when a frame actually reached the display, without it only CPU times are measured
+    bool presentWaitSupported = !options->headless && isDeviceExtensionSupported(vko->physicalDevice, VK_KHR_PRESENT_ID_EXTENSION_NAME) &&
+        isDeviceExtensionSupported(vko->physicalDevice, VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+    if(presentWaitSupported){
+        deviceExtensions[deviceExtensionCount++] = VK_KHR_PRESENT_ID_EXTENSION_NAME;
+        deviceExtensions[deviceExtensionCount++] = VK_KHR_PRESENT_WAIT_EXTENSION_NAME;
+    }
+    //Indirect draws of more than one object with their own firstInstance need these, a draw count buffer is optional
+    //The Vulkan 1.2 feature struct may only be chained when the device reports 1.2, older ones go without host query reset and draw counts
+    bool vulkan12Supported = vko->physicalDeviceProperties.apiVersion >= VK_API_VERSION_1_2;
+    VkPhysicalDeviceVulkan12Features supportedFeatures12{};
+    supportedFeatures12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    VkPhysicalDevicePresentIdFeaturesKHR supportedPresentId{};
+    supportedPresentId.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+    VkPhysicalDevicePresentWaitFeaturesKHR supportedPresentWait{};
+    supportedPresentWait.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+    VkPhysicalDeviceFeatures2 supportedFeatures{};
+    supportedFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    void** supportedNext = &supportedFeatures.pNext;
+    if(vulkan12Supported){
+        *supportedNext = &supportedFeatures12;
+        supportedNext = &supportedFeatures12.pNext;
+    }
+    if(presentWaitSupported){
+        *supportedNext = &supportedPresentId;
+        supportedPresentId.pNext = &supportedPresentWait;
+    }
+    vkGetPhysicalDeviceFeatures2(vko->physicalDevice, &supportedFeatures);
+    VkPhysicalDeviceVulkan12Features enabledFeatures12{};
+    enabledFeatures12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    VkPhysicalDevicePresentIdFeaturesKHR enabledPresentId{};
+    enabledPresentId.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+    VkPhysicalDevicePresentWaitFeaturesKHR enabledPresentWait{};
+    enabledPresentWait.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+    presentWaitSupported = presentWaitSupported && supportedPresentId.presentId && supportedPresentWait.presentWait;
+    VkPhysicalDeviceFeatures2 enabledFeatures{};
+    enabledFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    void** enabledNext = &enabledFeatures.pNext;
+    if(vulkan12Supported){
+        *enabledNext = &enabledFeatures12;
+        enabledNext = &enabledFeatures12.pNext;
+        enabledFeatures12.hostQueryReset = supportedFeatures12.hostQueryReset;//GPU timestamps are reset from the host
+    }
+    if(presentWaitSupported){
+        enabledPresentId.presentId = VK_TRUE;
+        enabledPresentWait.presentWait = VK_TRUE;
+        *enabledNext = &enabledPresentId;
+        enabledPresentId.pNext = &enabledPresentWait;
+    }
+    if(gpuDriven && !(supportedFeatures.features.multiDrawIndirect && supportedFeatures.features.drawIndirectFirstInstance)){
+        printf("Device lacks multi draw indirect, falling back to CPU driven rendering.\n");
+        gpuDriven = false;
+    }
+    if(gpuDriven){
+        enabledFeatures.features.multiDrawIndirect = VK_TRUE;
+        enabledFeatures.features.drawIndirectFirstInstance = VK_TRUE;
+        enabledFeatures12.drawIndirectCount = vulkan12Supported && supportedFeatures12.drawIndirectCount;
+    }
+    vko->device = createLogicalDevice(vko->physicalDevice, &vko->queueFamilyIndices, deviceExtensions, deviceExtensionCount, &enabledFeatures);
+    vkGetDeviceQueue(vko->device, vko->queueFamilyIndices.graphics, 0, &vko->graphicsQueue);
+    if(!options->headless){
+        vkGetDeviceQueue(vko->device, vko->queueFamilyIndices.present, 0, &vko->presentQueue);
+    }
+    vkGetDeviceQueue(vko->device, vko->queueFamilyIndices.transfer, 0, &vko->transferQueue);
+    createGpuProfiler(vko->physicalDevice, vko->device, enabledFeatures12.hostQueryReset, &vko->gpuProfiler);
+    vkGetPhysicalDeviceMemoryProperties(vko->physicalDevice, &vko->memProperties);
+    initAllocator(&vko->allocator, vko->device, &vko->memProperties, DEFAULT_MEMORY_BLOCK_SIZE);
+    if(memoryBudgetSupported){
+        enableMemoryBudget(&vko->allocator, vko->physicalDevice);
+    }
+    if(vko->allocator.directWrite){
+        printf("Device local memory is host visible, uploads are written in place.\n");
+    }
+
+    if(options->headless){
+        vko->surfaceFormat = {selectOffscreenFormat(vko->physicalDevice), VK_COLOR_SPACE_SRGB_NONLINEAR_KHR};
+        vko->swapchainExtent = {options->width, options->height};
+        vko->swapchain = VK_NULL_HANDLE;
+        vko->targetFinalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        createOffscreenTargets(vko, options->framesInFlight);
+        printf("Headless, rendering into %ux%u offscreen images.\n", options->width, options->height);
+    }
+    else{
+        SwapChainSupport swapChainSupport = querySwapChainSupport(vko->physicalDevice, vko->surface);
+        vko->capabilities = swapChainSupport.capabilities;
+        vko->surfaceFormat = selectSurfaceFormat(&swapChainSupport);
+        vko->requestedPresentMode = options->requestedPresentMode;
+        vko->presentMode = selectPresentMode(&swapChainSupport, options->requestedPresentMode);
+        printf("Present mode %s.\n", presentModeName(vko->presentMode));
+        vko->swapchainExtent = selectSwapchainExtent(&swapChainSupport.capabilities, wo->window);
+        vko->swapchain = createSwapChain(vko->device, vko->physicalDevice, vko->surface, wo->window, vko->swapchainExtent, &swapChainSupport.capabilities, vko->surfaceFormat, vko->presentMode, VK_NULL_HANDLE);
+        vko->targetFinalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+        vkGetSwapchainImagesKHR(vko->device, vko->swapchain, &vko->swapchainImageCount, nullptr);
+        vko->swapchainImages = (VkImage*)malloc(sizeof(VkImage)*vko->swapchainImageCount);
+        vkGetSwapchainImagesKHR(vko->device, vko->swapchain, &vko->swapchainImageCount, vko->swapchainImages);
+        vko->swapchainImageViews = createImageViews(vko->device, vko->swapchainImages, vko->swapchainImageCount, vko->surfaceFormat);
+    }
+    createFrameStats(vko->device, presentWaitSupported, options->statsInterval, options->statsCsvPath, options->statsJsonPath, &vko->frameStats);
+    frameStatsSetSwapchain(&vko->frameStats, vko->swapchain);
+
+    vko->renderPass = createRenderPass(vko->device, vko->surfaceFormat.format, VK_IMAGE_LAYOUT_UNDEFINED, vko->targetFinalLayout);
+
+    vko->descriptorSetLayout = createDescriptorSetLayout(vko->device);
+    
+    vko->graphicsPipelineLayout = createGraphicsPipelineLayout(vko->device, vko->descriptorSetLayout);
+    vko->pipelineCachePath = options->pipelineCachePath;
+    if(options->pipelineCachePath != nullptr){
+        vko->pipelineCache = loadPipelineCache(vko->device, &vko->physicalDeviceProperties, options->pipelineCachePath);
+    }
+    else{
+        vko->pipelineCache = createPipelineCache(vko->device);
+    }
+    vko->graphicsPipeline = createGraphicsPipeline(vko->device, vko->pipelineCache, vko->graphicsPipelineLayout, vko->renderPass, "shaders/spirv/vert.spv");
+
+    vko->swapchainFramebuffers = createFramebuffers(vko->device, vko->swapchainImageViews, vko->swapchainImageCount, vko->renderPass, vko->swapchainExtent);
+
+    vko->commandPool = createCommandPool(vko->device, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT, &vko->queueFamilyIndices);
+
+    vko->sceneVersion = 1;
+
+    createUploadQueue(vko->device, &vko->allocator, &vko->queueFamilyIndices, vko->transferQueue, vko->graphicsQueue, DEFAULT_STAGING_RING_SIZE, &vko->gpuProfiler, &vko->uploadQueue);
+
+    printf("Successfully initialised Vulkan.\n");
+
+    createGeometryStore(vko->device, &vko->allocator, DEFAULT_GEOMETRY_VERTEX_CAPACITY, DEFAULT_GEOMETRY_INDEX_CAPACITY, &vko->geometryStore);
+    registerMesh(&vko->geometryStore, &vko->uploadQueue, vertices, verticesCount, indices, indicesCount);
+    for(uint32_t i = 1; i < options->meshCount; i++){
+        registerMesh(&vko->geometryStore, &vko->uploadQueue, vertices, verticesCount, indices, indicesCount);
+    }
+    if(options->stressInstances > 0){
+        addStressInstanceBatch(&vko->instanceScene, 0, options->stressInstances);
+        printf("Stress scene: %u instances in a single draw.\n", options->stressInstances);
+    }
+    vko->objectCapacity = std::max<uint32_t>(DEFAULT_OBJECT_UNIFORM_CAPACITY, vko->geometryStore.meshes.size());
+    vko->gpuDriven = gpuDriven;
+    if(gpuDriven){
+        createIndirectRenderer(vko->device, &vko->allocator, vko->pipelineCache, vko->renderPass, vko->graphicsPipelineLayout, vko->objectCapacity, enabledFeatures12.drawIndirectCount, &vko->indirectRenderer);
+        vko->graphRenderPass = createRenderPass(vko->device, vko->surfaceFormat.format, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+        updateIndirectDrawRecords(&vko->indirectRenderer, &vko->uploadQueue, &vko->geometryStore);
+        printf("GPU driven rendering, %s.\n", enabledFeatures12.drawIndirectCount ? "culled draws are compacted behind a draw count" : "culled draws are skipped in place");
+    }
+    createObjectScene(defaultRecordWorkerCount(), &vko->objectScene);
+    vko->cpuCulling = options->cpuCulling;
+    vko->printRenderGraph = options->printRenderGraph;
+    vko->blockingSwapchainRecreation = options->blockingSwapchainRecreation;
+    if(options->cpuCulling){
+        createCpuCuller(vko->objectCapacity, &vko->cpuCuller);
+        printf("CPU culling with the %s kernel.\n", cullKernelName(vko->cpuCuller.kernel));
+    }
+    uploadQueueFlush(&vko->uploadQueue);//Acquired on the graphics queue ahead of the first frame, so no wait is needed
+
+    createDefragmenter(vko->device, &vko->allocator, &vko->queueFamilyIndices, vko->graphicsQueue, DEFAULT_DEFRAG_BYTES_PER_FRAME, &vko->defragmenter);
+    vko->uploadQueue.defragmenter = &vko->defragmenter;
+    defragmenterRegister(&vko->defragmenter, &vko->geometryStore.vertexBuffer, &vko->geometryStore.vertexBufferAllocation, GEOMETRY_VERTEX_BUFFER_USAGE, sizeof(Vertex)*(VkDeviceSize)vko->geometryStore.vertexCapacity, usedVertexBytes, &vko->geometryStore);
+    defragmenterRegister(&vko->defragmenter, &vko->geometryStore.indexBuffer, &vko->geometryStore.indexBufferAllocation, GEOMETRY_INDEX_BUFFER_USAGE, sizeof(uint32_t)*(VkDeviceSize)vko->geometryStore.indexCapacity, usedIndexBytes, &vko->geometryStore);
+
+    createFrameResources(vko, options->framesInFlight);
+
+    printAllocatorStats(&vko->allocator);
+    MemoryBudget memoryBudget = getMemoryBudget(&vko->allocator);
+    printMemoryBudget(&memoryBudget);
+}
+
+void registerQuadMesh(VulkanObjects *vko){
+    registerMesh(&vko->geometryStore, &vko->uploadQueue, vertices, verticesCount, indices, indicesCount);
+}
+
+void destroyApp(VulkanObjects *vko, WindowObjects *wo){
+    vkDeviceWaitIdle(vko->device);
+    if(vko->pipelineCachePath != nullptr){
+        savePipelineCache(vko->device, vko->pipelineCache, vko->pipelineCachePath);
+    }
+    vko->cleanUp();
+    if(!vko->headless){
+        glfwDestroyWindow(wo->window);
+        glfwTerminate();
+    }
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include "vk.h"
+#include "window.h"
+
+#define DEFAULT_WINDOW_WIDTH 800
+#define DEFAULT_WINDOW_HEIGHT 600
+#define DEFAULT_PIPELINE_CACHE_PATH "pipeline_cache.bin"
+
+//Everything startup depends on, filled from the command line by moebius and per scenario by moebius_bench
+struct AppOptions{
+    uint32_t width;
+    uint32_t height;
+    uint32_t framesInFlight;
+    bool headless;//No window, surface or swapchain, frames go to offscreen images
+    bool gpuDriven;//Falls back to CPU driven rendering when the device lacks multi draw indirect
+    bool cpuCulling;
+    bool printRenderGraph;//Dumps the GPU-driven frame's graph each time it is compiled
+    bool blockingSwapchainRecreation;//Drains the device on every swapchain recreation, only kept as the resize benchmark baseline
+    VkPresentModeKHR requestedPresentMode;
+    uint32_t meshCount;//Copies of the quad, each drawn as its own object
+    uint32_t stressInstances;//0 leaves out the instanced stress batch
+    double statsInterval;
+    const char* statsCsvPath;
+    const char* statsJsonPath;
+    const char* pipelineCachePath;//Loaded at startup and saved by destroyApp, null to always compile from scratch
+};
+
+void defaultAppOptions(AppOptions *options);
+
+//Creates the window unless headless, then the device and everything needed to call drawFrame
+void createApp(const AppOptions *options, WindowObjects *wo, VulkanObjects *vko);
+void registerQuadMesh(VulkanObjects *vko);
+//Saves the pipeline cache before tearing everything down
+void destroyApp(VulkanObjects *vko, WindowObjects *wo);
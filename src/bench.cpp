@@ -0,0 +1,356 @@
+#include "bench.h"
+#include <cstdio>
+#include <cinttypes>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include "draw.h"
+#include "recorder.h"
+#include "initvk.h"
+#include "app.h"
+
+static double millisecondsSince(std::chrono::steady_clock::time_point start){
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void runRecordBenchmark(VulkanObjects *vko, uint32_t maxWorkers, uint32_t iterations){
+    //Nothing has been submitted yet, so the first frame slot's buffers are free to re-record
+    VkCommandBuffer commandBuffer = vko->commandBuffers[0];
+
+    RecordJob job{};
+    job.frame = 0;
+    job.image = 0;
+    job.renderPass = vko->renderPass;
+    job.framebuffer = vko->swapchainFramebuffers[0];
+    job.extent = vko->swapchainExtent;
+    job.pipelineLayout = vko->graphicsPipelineLayout;
+    job.pipeline = vko->graphicsPipeline;
+    job.descriptorSet = vko->descriptorSets[0];
+    job.geometryStore = &vko->geometryStore;
+    job.instanceBuffer = vko->instanceStreams[0].buffer;
+    job.instanceScene = &vko->instanceScene;
+    job.objectStride = vko->uniformRings[0].objectStride;
+    job.drawList = nullptr;
+    job.drawCount = vko->geometryStore.meshes.size();
+
+    printf("Recording %zu draws, %u iterations\n", vko->geometryStore.meshes.size(), iterations);
+
+    auto start = std::chrono::steady_clock::now();
+    for(uint32_t i = 0; i < iterations; i++){
+        vkResetCommandBuffer(commandBuffer, 0);
+        recordCommandBuffer(commandBuffer, job.renderPass, job.framebuffer, job.extent, job.pipelineLayout, job.pipeline, job.descriptorSet, job.geometryStore, job.instanceBuffer, job.instanceScene, job.objectStride, job.drawList, job.drawCount, job.profiler, job.profilerScope);
+    }
+    double inlineTime = millisecondsSince(start)/iterations;
+    printf("  inline     %8.3f ms\n", inlineTime);
+
+    for(uint32_t workers = 1; workers <= maxWorkers; workers = std::min(workers*2, maxWorkers)){
+        ParallelRecorder recorder;
+        createParallelRecorder(vko->device, &vko->queueFamilyIndices, 1, 1, workers, &recorder);
+
+        start = std::chrono::steady_clock::now();
+        for(uint32_t i = 0; i < iterations; i++){
+            vkResetCommandBuffer(commandBuffer, 0);
+            recordCommandBufferParallel(&recorder, commandBuffer, &job);
+        }
+        double parallelTime = millisecondsSince(start)/iterations;
+        printf("  %2u workers %8.3f ms  (%.2fx inline)\n", workers, parallelTime, inlineTime/parallelTime);
+
+        destroyParallelRecorder(&recorder);
+        if(workers == maxWorkers){
+            break;//Powers of two, then always finish on the full worker count
+        }
+    }
+}
+
+void runFramesInFlightBenchmark(VulkanObjects *vko, WindowObjects *wo, uint32_t framesPerSetting){
+    uint32_t originalFramesInFlight = vko->framesInFlight;
+    printf("Frames in flight benchmark, %u frames per setting\n", framesPerSetting);
+    printf("  frames  fps       latency avg / p50 / p99 (ms)\n");
+
+    for(uint32_t setting = 1; setting <= FRAMES_BENCHMARK_MAX_SETTING; setting++){
+        destroyFrameResources(vko);
+        createFrameResources(vko, setting);
+
+        //Latency runs from the CPU starting a frame to the CPU noticing its fence signalled, so it is an upper bound
+        std::vector<std::chrono::steady_clock::time_point> startTimes(setting);
+        std::vector<bool> pending(setting, false);
+        std::vector<double> latencies;
+        latencies.reserve(framesPerSetting);
+
+        uint32_t currentFrame = 0;
+        auto start = std::chrono::steady_clock::now();
+        for(uint32_t i = 0; i < framesPerSetting; i++){
+            glfwPollEvents();
+            if(pending[currentFrame]){
+                vkWaitForFences(vko->device, 1, &vko->syncObjects[currentFrame].inFlightFence, VK_TRUE, UINT64_MAX);
+                latencies.push_back(millisecondsSince(startTimes[currentFrame]));
+                pending[currentFrame] = false;
+            }
+
+            startTimes[currentFrame] = std::chrono::steady_clock::now();
+            drawFrame(vko, currentFrame, wo);
+            pending[currentFrame] = true;
+
+            for(uint32_t frame = 0; frame < setting; frame++){
+                if(frame != currentFrame && pending[frame] && vkGetFenceStatus(vko->device, vko->syncObjects[frame].inFlightFence) == VK_SUCCESS){
+                    latencies.push_back(millisecondsSince(startTimes[frame]));
+                    pending[frame] = false;
+                }
+            }
+            currentFrame = (currentFrame + 1) % setting;
+        }
+        vkDeviceWaitIdle(vko->device);
+        double totalTime = millisecondsSince(start);
+
+        std::sort(latencies.begin(), latencies.end());
+        double latencySum = 0;
+        for(double latency : latencies){
+            latencySum += latency;
+        }
+        size_t count = latencies.size();
+        printf(
+            "  %6u  %8.1f  %8.3f / %8.3f / %8.3f\n",
+            setting,
+            framesPerSetting*1000.0/totalTime,
+            count > 0 ? latencySum/count : 0.0,
+            count > 0 ? latencies[count/2] : 0.0,
+            count > 0 ? latencies[std::min(count - 1, count*99/100)] : 0.0
+        );
+    }
+
+    destroyFrameResources(vko);
+    createFrameResources(vko, originalFramesInFlight);
+}
+
+static void printFrameTimes(const char* label, std::vector<double> times){
+    std::sort(times.begin(), times.end());
+    double sum = 0;
+    for(double time : times){
+        sum += time;
+    }
+    size_t count = times.size();
+    printf(
+        "  %-10s %8.3f / %8.3f / %8.3f / %8.3f\n",
+        label,
+        count > 0 ? sum/count : 0.0,
+        count > 0 ? times[count/2] : 0.0,
+        count > 0 ? times[std::min(count - 1, count*99/100)] : 0.0,
+        count > 0 ? times[count - 1] : 0.0
+    );
+}
+
+void runResizeBenchmark(VulkanObjects *vko, WindowObjects *wo, uint32_t resizes){
+    int width, height;
+    glfwGetWindowSize(wo->window, &width, &height);
+    printf("Resize benchmark, %u resizes after %u steady frames\n", resizes, RESIZE_BENCHMARK_STEADY_FRAMES);
+    printf("  frame time avg / p50 / p99 / max (ms)\n");
+    printf(" %s\n", vko->blockingSwapchainRecreation ? "vkDeviceWaitIdle on recreation" : "oldSwapchain with deferred retirement");
+
+    uint32_t currentFrame = 0;
+    std::vector<double> steadyTimes;
+    for(uint32_t i = 0; i < RESIZE_BENCHMARK_STEADY_FRAMES; i++){
+        glfwPollEvents();
+        auto start = std::chrono::steady_clock::now();
+        drawFrame(vko, currentFrame, wo);
+        steadyTimes.push_back(millisecondsSince(start));
+        currentFrame = (currentFrame + 1) % vko->framesInFlight;
+    }
+
+    //Window managers may coalesce or ignore size requests, so every frame is also flagged as resized
+    std::vector<double> stormTimes;
+    uint32_t recreations = vko->swapchainRecreations;
+    for(uint32_t i = 0; i < resizes; i++){
+        int shrink = (i % 8 + 1)*16;
+        glfwSetWindowSize(wo->window, width - shrink, height - shrink);
+        glfwPollEvents();
+        wo->framebufferResized = true;
+        auto start = std::chrono::steady_clock::now();
+        drawFrame(vko, currentFrame, wo);
+        stormTimes.push_back(millisecondsSince(start));
+        currentFrame = (currentFrame + 1) % vko->framesInFlight;
+    }
+
+    printFrameTimes("steady", steadyTimes);
+    printFrameTimes("resizing", stormTimes);
+    printf("  %u swapchain recreations, %zu retired swapchains pending\n", vko->swapchainRecreations - recreations, vko->retiredSwapchains.size());
+
+    glfwSetWindowSize(wo->window, width, height);
+    glfwPollEvents();
+    wo->framebufferResized = true;
+    vkDeviceWaitIdle(vko->device);
+}
+
+//Headless, with frame stats only summarised at exit so nothing prints mid scenario. No on-disk pipeline cache, so one run can't warm the next.
+static void createBenchApp(uint32_t meshCount, bool gpuDriven, BenchReport *report, WindowObjects *wo, VulkanObjects *vko){
+    AppOptions appOptions;
+    defaultAppOptions(&appOptions);
+    appOptions.headless = true;
+    appOptions.gpuDriven = gpuDriven;
+    appOptions.meshCount = meshCount;
+    appOptions.statsInterval = 0.0;
+    appOptions.pipelineCachePath = nullptr;
+    createApp(&appOptions, wo, vko);
+
+    memcpy(report->deviceName, vko->physicalDeviceProperties.deviceName, sizeof(report->deviceName));
+    report->apiVersion = vko->physicalDeviceProperties.apiVersion;
+    report->driverVersion = vko->physicalDeviceProperties.driverVersion;
+}
+
+static BenchResult summariseTimes(const char* scenario, const char* unit, std::vector<double> times, double seconds, const VulkanObjects *vko){
+    std::sort(times.begin(), times.end());
+    double sum = 0;
+    for(double time : times){
+        sum += time;
+    }
+    size_t count = times.size();
+
+    BenchResult result{};
+    result.scenario = scenario;
+    result.unit = unit;
+    result.count = count;
+    result.seconds = seconds;
+    result.throughput = seconds > 0.0 ? count/seconds : 0.0;
+    result.meanMs = count > 0 ? sum/count : 0.0;
+    result.p50Ms = count > 0 ? times[count/2] : 0.0;
+    result.p95Ms = count > 0 ? times[std::min(count - 1, count*95/100)] : 0.0;
+    result.p99Ms = count > 0 ? times[std::min(count - 1, count*99/100)] : 0.0;
+    result.maxMs = count > 0 ? times[count - 1] : 0.0;
+    result.memory = getAllocatorStats(&vko->allocator);
+    printf("%s: %zu %s in %.3f s, %.1f per second, %.3f / %.3f / %.3f ms (mean / p50 / p99)\n", scenario, count, unit, seconds, result.throughput, result.meanMs, result.p50Ms, result.p99Ms);
+    return result;
+}
+
+void runUploadScenario(const BenchOptions *options, BenchReport *report){
+    WindowObjects wo{};
+    VulkanObjects vko{};
+    createBenchApp(1, options->gpuDriven, report, &wo, &vko);
+
+    //Each sample is one registerMesh, which includes waiting for staging space. The total also covers the final transfer.
+    std::vector<double> times;
+    times.reserve(options->meshes);
+    auto start = std::chrono::steady_clock::now();
+    for(uint32_t i = 0; i < options->meshes; i++){
+        auto meshStart = std::chrono::steady_clock::now();
+        registerQuadMesh(&vko);
+        times.push_back(millisecondsSince(meshStart));
+    }
+    uploadQueueWait(&vko.uploadQueue, uploadQueueFlush(&vko.uploadQueue));
+    double seconds = millisecondsSince(start)/1000.0;
+
+    report->results.push_back(summariseTimes("upload", "meshes", times, seconds, &vko));
+    destroyApp(&vko, &wo);
+}
+
+void runDrawsScenario(const BenchOptions *options, BenchReport *report){
+    WindowObjects wo{};
+    VulkanObjects vko{};
+    createBenchApp(options->draws, options->gpuDriven, report, &wo, &vko);
+
+    std::vector<double> times;
+    times.reserve(options->frames);
+    uint32_t currentFrame = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(uint32_t i = 0; i < options->frames; i++){
+        auto frameStart = std::chrono::steady_clock::now();
+        drawFrame(&vko, currentFrame, &wo);
+        times.push_back(millisecondsSince(frameStart));
+        currentFrame = (currentFrame + 1) % vko.framesInFlight;
+    }
+    vkDeviceWaitIdle(vko.device);
+    double seconds = millisecondsSince(start)/1000.0;
+
+    report->results.push_back(summariseTimes("draws", "frames", times, seconds, &vko));
+    destroyApp(&vko, &wo);
+}
+
+void runRecreateScenario(const BenchOptions *options, BenchReport *report){
+    WindowObjects wo{};
+    VulkanObjects vko{};
+    createBenchApp(1, options->gpuDriven, report, &wo, &vko);
+    VkExtent2D extent = vko.swapchainExtent;
+
+    //Same size steps as the windowed resize benchmark, each sample is the resize plus the frame that follows it
+    std::vector<double> times;
+    times.reserve(options->cycles);
+    uint32_t currentFrame = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(uint32_t i = 0; i < options->cycles; i++){
+        uint32_t shrink = (i % 8 + 1)*16;
+        auto cycleStart = std::chrono::steady_clock::now();
+        resizeOffscreenTargets(&vko, {extent.width - shrink, extent.height - shrink});
+        drawFrame(&vko, currentFrame, &wo);
+        times.push_back(millisecondsSince(cycleStart));
+        currentFrame = (currentFrame + 1) % vko.framesInFlight;
+    }
+    vkDeviceWaitIdle(vko.device);
+    double seconds = millisecondsSince(start)/1000.0;
+
+    report->results.push_back(summariseTimes("recreate", "cycles", times, seconds, &vko));
+    destroyApp(&vko, &wo);
+}
+
+static double timePipelineCreation(VulkanObjects *vko, VkPipelineCache cache){
+    auto start = std::chrono::steady_clock::now();
+    VkPipeline pipeline = createGraphicsPipeline(vko->device, cache, vko->graphicsPipelineLayout, vko->renderPass, "shaders/spirv/vert.spv");
+    double time = millisecondsSince(start);
+    vkDestroyPipeline(vko->device, pipeline, nullptr);
+    return time;
+}
+
+void runPipelineScenario(const BenchOptions *options, BenchReport *report){
+    WindowObjects wo{};
+    VulkanObjects vko{};
+    createBenchApp(1, options->gpuDriven, report, &wo, &vko);
+
+    //Shader loading is inside the timing for both, so the difference is what the cache saves
+    std::vector<double> coldTimes;
+    auto start = std::chrono::steady_clock::now();
+    for(uint32_t i = 0; i < options->pipelines; i++){
+        VkPipelineCache cache = createPipelineCache(vko.device);
+        coldTimes.push_back(timePipelineCreation(&vko, cache));
+        vkDestroyPipelineCache(vko.device, cache, nullptr);
+    }
+    double coldSeconds = millisecondsSince(start)/1000.0;
+    report->results.push_back(summariseTimes("pipeline_cold", "pipelines", coldTimes, coldSeconds, &vko));
+
+    VkPipelineCache cache = createPipelineCache(vko.device);
+    timePipelineCreation(&vko, cache);
+    std::vector<double> warmTimes;
+    start = std::chrono::steady_clock::now();
+    for(uint32_t i = 0; i < options->pipelines; i++){
+        warmTimes.push_back(timePipelineCreation(&vko, cache));
+    }
+    double warmSeconds = millisecondsSince(start)/1000.0;
+    vkDestroyPipelineCache(vko.device, cache, nullptr);
+    report->results.push_back(summariseTimes("pipeline_warm", "pipelines", warmTimes, warmSeconds, &vko));
+
+    destroyApp(&vko, &wo);
+}
+
+void writeBenchReport(const BenchReport *report, const BenchOptions *options, const char* path){
+    FILE* file = fopen(path, "w");
+    if(file == nullptr){
+        printf("Failed to open %s for writing!\n", path);
+        exit(EXIT_FAILURE);
+    }
+    fprintf(file, "{\n");
+    fprintf(file, "  \"device\": \"%s\",\n", report->deviceName);
+    fprintf(file, "  \"api_version\": \"%u.%u.%u\",\n", VK_API_VERSION_MAJOR(report->apiVersion), VK_API_VERSION_MINOR(report->apiVersion), VK_API_VERSION_PATCH(report->apiVersion));
+    fprintf(file, "  \"driver_version\": %u,\n", report->driverVersion);
+    fprintf(file, "  \"options\": {\"meshes\": %u, \"draws\": %u, \"frames\": %u, \"cycles\": %u, \"pipelines\": %u, \"gpu_driven\": %s},\n",
+        options->meshes, options->draws, options->frames, options->cycles, options->pipelines, options->gpuDriven ? "true" : "false");
+    fprintf(file, "  \"scenarios\": [\n");
+    for(size_t i = 0; i < report->results.size(); i++){
+        const BenchResult *result = &report->results[i];
+        fprintf(file, "    {\"name\": \"%s\", \"unit\": \"%s\", \"count\": %u, \"seconds\": %.6f, \"throughput\": %.3f,\n", result->scenario, result->unit, result->count, result->seconds, result->throughput);
+        fprintf(file, "     \"ms\": {\"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f},\n", result->meanMs, result->p50Ms, result->p95Ms, result->p99Ms, result->maxMs);
+        fprintf(file, "     \"memory\": {\"bytes_used\": %" PRIu64 ", \"bytes_reserved\": %" PRIu64 ", \"blocks\": %u, \"allocations\": %u}}%s\n",
+            result->memory.bytesUsed, result->memory.bytesReserved, result->memory.blockCount, result->memory.allocationCount,
+            i + 1 < report->results.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+    printf("Wrote benchmark report to %s\n", path);
+}
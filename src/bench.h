@@ -0,0 +1,68 @@
+#pragma once
+#include "vk.h"
+#include "window.h"
+#include <vector>
+
+#define RECORD_BENCHMARK_DEFAULT_DRAWS 20000
+#define RECORD_BENCHMARK_ITERATIONS 50
+#define FRAMES_BENCHMARK_DEFAULT_FRAMES 1000
+#define FRAMES_BENCHMARK_MAX_SETTING 4
+#define RESIZE_BENCHMARK_DEFAULT_RESIZES 100
+#define RESIZE_BENCHMARK_STEADY_FRAMES 120
+
+//Times recording the current scene inline and with 1, 2, 4... worker threads up to maxWorkers
+void runRecordBenchmark(VulkanObjects *vko, uint32_t maxWorkers, uint32_t iterations);
+
+//Rebuilds the per-frame resources for 1 to FRAMES_BENCHMARK_MAX_SETTING frames in flight and reports throughput and latency of each
+void runFramesInFlightBenchmark(VulkanObjects *vko, WindowObjects *wo, uint32_t framesPerSetting);
+
+//Resizes the window every frame and reports the frame times against steady rendering, run once per --blocking-recreation setting to compare the two
+void runResizeBenchmark(VulkanObjects *vko, WindowObjects *wo, uint32_t resizes);
+
+#define BENCH_DEFAULT_MESHES 10000
+#define BENCH_DEFAULT_DRAWS 10000
+#define BENCH_DEFAULT_FRAMES 500
+#define BENCH_DEFAULT_CYCLES 50
+#define BENCH_DEFAULT_PIPELINES 20
+
+//Sizes of the scripted moebius_bench scenarios, every scenario starts its own headless app
+struct BenchOptions{
+    uint32_t meshes;
+    uint32_t draws;
+    uint32_t frames;
+    uint32_t cycles;
+    uint32_t pipelines;
+    bool gpuDriven;
+};
+
+struct BenchResult{
+    const char* scenario;
+    const char* unit;//What count and the times are per
+    uint32_t count;
+    double seconds;
+    double throughput;//Units per second
+    double meanMs;
+    double p50Ms;
+    double p95Ms;
+    double p99Ms;
+    double maxMs;
+    AllocatorStats memory;//Taken before the app is torn down
+};
+
+struct BenchReport{
+    char deviceName[VK_MAX_PHYSICAL_DEVICE_NAME_SIZE];
+    uint32_t apiVersion;
+    uint32_t driverVersion;
+    std::vector<BenchResult> results;
+};
+
+//Registers options->meshes quads and waits for the upload queue to drain
+void runUploadScenario(const BenchOptions *options, BenchReport *report);
+//Renders options->frames headless frames of options->draws meshes
+void runDrawsScenario(const BenchOptions *options, BenchReport *report);
+//Resizes the offscreen targets options->cycles times, rendering one frame after each
+void runRecreateScenario(const BenchOptions *options, BenchReport *report);
+//Creates the graphics pipeline options->pipelines times from an empty cache and then from a primed one
+void runPipelineScenario(const BenchOptions *options, BenchReport *report);
+
+void writeBenchReport(const BenchReport *report, const BenchOptions *options, const char* path);
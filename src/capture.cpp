@@ -0,0 +1,400 @@
+#include "capture.h"
+#include <cstdlib>
+#include <cinttypes>
+#include <cstring>
+#include <algorithm>
+#include "vk.h"
+#include "initvk.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CAPTURE_X86 1
+#include <immintrin.h>
+#endif
+
+//BT.601 limited range weights in 8 bit fixed point, by red, green and blue
+const int LUMA_WEIGHTS[3] = {66, 129, 25};
+const int U_WEIGHTS[3] = {-38, -74, 112};
+const int V_WEIGHTS[3] = {112, -94, -18};
+
+YuvKernel bestYuvKernel(){
+#ifdef CAPTURE_X86
+    if(__builtin_cpu_supports("sse2")){
+        return YUV_KERNEL_SSE2;
+    }
+#endif
+    return YUV_KERNEL_SCALAR;
+}
+
+const char* yuvKernelName(YuvKernel kernel){
+    switch(kernel){
+        case YUV_KERNEL_SCALAR: return "scalar";
+        case YUV_KERNEL_SSE2: return "sse2";
+        default: return "unknown";
+    }
+}
+
+//Columns from x on of a pair of rows, row1 repeats row0 on the last row of an odd height. x must be even.
+static void convertRowPairScalar(
+    const uint8_t* row0, const uint8_t* row1, uint32_t width, uint32_t x, bool redFirst,
+    uint8_t* y0, uint8_t* y1, uint8_t* u, uint8_t* v
+){
+    int r = redFirst ? 0 : 2;
+    int b = redFirst ? 2 : 0;
+    for(; x < width; x += 2){
+        uint32_t x1 = std::min(x + 1, width - 1);//Odd widths repeat the last column
+        const uint8_t* block[4] = {row0 + 4*x, row0 + 4*x1, row1 + 4*x, row1 + 4*x1};
+        int sum[3] = {0, 0, 0};
+        for(int i = 0; i < 4; i++){
+            sum[0] += block[i][r];
+            sum[1] += block[i][1];
+            sum[2] += block[i][b];
+        }
+        for(uint32_t column = x; column <= x1; column++){
+            const uint8_t* p0 = row0 + 4*column;
+            const uint8_t* p1 = row1 + 4*column;
+            y0[column] = ((LUMA_WEIGHTS[0]*p0[r] + LUMA_WEIGHTS[1]*p0[1] + LUMA_WEIGHTS[2]*p0[b] + 128) >> 8) + 16;
+            if(y1 != nullptr){
+                y1[column] = ((LUMA_WEIGHTS[0]*p1[r] + LUMA_WEIGHTS[1]*p1[1] + LUMA_WEIGHTS[2]*p1[b] + 128) >> 8) + 16;
+            }
+        }
+        //Four pixels were summed, so two more bits come off than for luma
+        u[x/2] = ((U_WEIGHTS[0]*sum[0] + U_WEIGHTS[1]*sum[1] + U_WEIGHTS[2]*sum[2] + 512) >> 10) + 128;
+        v[x/2] = ((V_WEIGHTS[0]*sum[0] + V_WEIGHTS[1]*sum[1] + V_WEIGHTS[2]*sum[2] + 512) >> 10) + 128;
+    }
+}
+
+#ifdef CAPTURE_X86
+//Channel weights in memory order for two pixels of 16 bit channels, alpha gets 0
+static __m128i channelWeights(const int weights[3], bool redFirst){
+    short r = weights[0], g = weights[1], b = weights[2];
+    return redFirst ? _mm_setr_epi16(r, g, b, 0, r, g, b, 0) : _mm_setr_epi16(b, g, r, 0, b, g, r, 0);
+}
+
+//Weighted sums of four pixels held two per register, as [p0, p1, p2, p3]
+static inline __m128i fourSums(__m128i first, __m128i second, __m128i weights){
+    __m128i a = _mm_madd_epi16(first, weights);
+    __m128i b = _mm_madd_epi16(second, weights);
+    a = _mm_add_epi32(a, _mm_shuffle_epi32(a, _MM_SHUFFLE(2, 3, 0, 1)));
+    b = _mm_add_epi32(b, _mm_shuffle_epi32(b, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_unpacklo_epi64(_mm_shuffle_epi32(a, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_epi32(b, _MM_SHUFFLE(2, 0, 2, 0)));
+}
+
+static inline __m128i lumaOf8(const __m128i pixels[4], __m128i weights){
+    __m128i round = _mm_set1_epi32(128);
+    __m128i offset = _mm_set1_epi32(16);
+    __m128i low = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(fourSums(pixels[0], pixels[1], weights), round), 8), offset);
+    __m128i high = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(fourSums(pixels[2], pixels[3], weights), round), 8), offset);
+    __m128i words = _mm_packs_epi32(low, high);
+    return _mm_packus_epi16(words, words);
+}
+
+//Eight columns of a row pair per step, giving 16 luma and 4 of each chroma samples
+static void convertToI420Sse2(const uint8_t* pixels, uint32_t width, uint32_t height, bool redFirst, uint8_t* yPlane, uint8_t* uPlane, uint8_t* vPlane){
+    __m128i lumaWeights = channelWeights(LUMA_WEIGHTS, redFirst);
+    __m128i uWeights = channelWeights(U_WEIGHTS, redFirst);
+    __m128i vWeights = channelWeights(V_WEIGHTS, redFirst);
+    __m128i zero = _mm_setzero_si128();
+    __m128i chromaRound = _mm_set1_epi32(512);
+    __m128i chromaOffset = _mm_set1_epi32(128);
+    uint32_t chromaWidth = (width + 1)/2;
+    uint32_t blockEnd = width & ~7u;
+
+    for(uint32_t y = 0; y < height; y += 2){
+        const uint8_t* row0 = pixels + 4*(size_t)width*y;
+        const uint8_t* row1 = y + 1 < height ? row0 + 4*(size_t)width : row0;
+        uint8_t* y0 = yPlane + (size_t)width*y;
+        uint8_t* y1 = y + 1 < height ? y0 + width : nullptr;
+        uint8_t* u = uPlane + (size_t)chromaWidth*(y/2);
+        uint8_t* v = vPlane + (size_t)chromaWidth*(y/2);
+
+        for(uint32_t x = 0; x < blockEnd; x += 8){
+            //Two pixels per register once widened to 16 bits
+            __m128i top[4], bottom[4];
+            for(int half = 0; half < 2; half++){
+                __m128i topBytes = _mm_loadu_si128((const __m128i*)(row0 + 4*x + 16*half));
+                __m128i bottomBytes = _mm_loadu_si128((const __m128i*)(row1 + 4*x + 16*half));
+                top[2*half] = _mm_unpacklo_epi8(topBytes, zero);
+                top[2*half + 1] = _mm_unpackhi_epi8(topBytes, zero);
+                bottom[2*half] = _mm_unpacklo_epi8(bottomBytes, zero);
+                bottom[2*half + 1] = _mm_unpackhi_epi8(bottomBytes, zero);
+            }
+            _mm_storel_epi64((__m128i*)(y0 + x), lumaOf8(top, lumaWeights));
+            if(y1 != nullptr){
+                _mm_storel_epi64((__m128i*)(y1 + x), lumaOf8(bottom, lumaWeights));
+            }
+
+            //Each register's two pixels plus the two below are one 2x2 block, summed into its low half
+            __m128i blocks[4];
+            for(int i = 0; i < 4; i++){
+                __m128i columns = _mm_add_epi16(top[i], bottom[i]);
+                blocks[i] = _mm_add_epi16(columns, _mm_srli_si128(columns, 8));
+            }
+            __m128i first = _mm_unpacklo_epi64(blocks[0], blocks[1]);
+            __m128i second = _mm_unpacklo_epi64(blocks[2], blocks[3]);
+            __m128i uValues = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(fourSums(first, second, uWeights), chromaRound), 10), chromaOffset);
+            __m128i vValues = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(fourSums(first, second, vWeights), chromaRound), 10), chromaOffset);
+            __m128i words = _mm_packs_epi32(uValues, vValues);
+            __m128i bytes = _mm_packus_epi16(words, words);
+            uint32_t uBytes = _mm_cvtsi128_si32(bytes);
+            uint32_t vBytes = _mm_cvtsi128_si32(_mm_srli_si128(bytes, 4));
+            memcpy(u + x/2, &uBytes, 4);
+            memcpy(v + x/2, &vBytes, 4);
+        }
+        convertRowPairScalar(row0, row1, width, blockEnd, redFirst, y0, y1, u, v);
+    }
+}
+#endif
+
+void convertToI420(const uint8_t* pixels, uint32_t width, uint32_t height, bool redFirst, YuvKernel kernel, uint8_t* yPlane, uint8_t* uPlane, uint8_t* vPlane){
+#ifdef CAPTURE_X86
+    if(kernel == YUV_KERNEL_SSE2){
+        convertToI420Sse2(pixels, width, height, redFirst, yPlane, uPlane, vPlane);
+        return;
+    }
+#endif
+    uint32_t chromaWidth = (width + 1)/2;
+    for(uint32_t y = 0; y < height; y += 2){
+        const uint8_t* row0 = pixels + 4*(size_t)width*y;
+        const uint8_t* row1 = y + 1 < height ? row0 + 4*(size_t)width : row0;
+        uint8_t* y0 = yPlane + (size_t)width*y;
+        convertRowPairScalar(row0, row1, width, 0, redFirst, y0, y + 1 < height ? y0 + width : nullptr, uPlane + (size_t)chromaWidth*(y/2), vPlane + (size_t)chromaWidth*(y/2));
+    }
+}
+
+//Converts and writes frames as they arrive, so disk speed only decides how many frames get dropped
+static void runCaptureWriter(FrameCapture *capture){
+    size_t lumaSize = (size_t)capture->extent.width*capture->extent.height;
+    size_t chromaSize = (size_t)((capture->extent.width + 1)/2)*((capture->extent.height + 1)/2);
+    uint8_t* planes = (uint8_t*)malloc(lumaSize + 2*chromaSize);
+    bool writeFailed = false;
+
+    std::unique_lock<std::mutex> lock(capture->mutex);
+    while(true){
+        capture->wake.wait(lock, [capture]{ return capture->stop || !capture->queue.empty(); });
+        if(capture->queue.empty()){
+            break;//Only stops once everything queued is written
+        }
+        uint8_t* pixels = capture->queue.front();
+        capture->queue.pop_front();
+        lock.unlock();
+
+        convertToI420(pixels, capture->extent.width, capture->extent.height, capture->redFirst, capture->kernel, planes, planes + lumaSize, planes + lumaSize + chromaSize);
+        if(!writeFailed){
+            if(capture->format == CAPTURE_FORMAT_Y4M){
+                fputs("FRAME\n", capture->file);
+            }
+            if(fwrite(planes, 1, lumaSize + 2*chromaSize, capture->file) != lumaSize + 2*chromaSize){
+                printf("Failed to write to %s, capture stopped!\n", capture->path);
+                writeFailed = true;
+            }
+        }
+
+        lock.lock();
+        capture->freePixels.push_back(pixels);
+        capture->writtenFrames += writeFailed ? 0 : 1;
+    }
+    lock.unlock();
+    free(planes);
+}
+
+bool createFrameCapture(
+    VkDevice device,
+    DeviceAllocator *allocator,
+    QueueFamilyIndices *queueFamilyIndices,
+    VkFormat format,
+    VkExtent2D extent,
+    const char* path,
+    uint32_t fps,
+    FrameCapture *capture
+){
+    capture->enabled = false;
+    if(format == VK_FORMAT_B8G8R8A8_SRGB || format == VK_FORMAT_B8G8R8A8_UNORM){
+        capture->redFirst = false;
+    }
+    else if(format == VK_FORMAT_R8G8B8A8_SRGB || format == VK_FORMAT_R8G8B8A8_UNORM){
+        capture->redFirst = true;
+    }
+    else{
+        printf("Frames can't be captured from format %d, only 8 bit BGRA and RGBA.\n", format);
+        return false;
+    }
+    capture->file = fopen(path, "wb");
+    if(capture->file == nullptr){
+        printf("Failed to open %s for writing!\n", path);
+        return false;
+    }
+
+    capture->device = device;
+    capture->allocator = allocator;
+    capture->extent = extent;
+    capture->path = path;
+    capture->fps = fps;
+    size_t length = strlen(path);
+    capture->format = length >= 4 && strcmp(path + length - 4, ".y4m") == 0 ? CAPTURE_FORMAT_Y4M : CAPTURE_FORMAT_RAW;
+    capture->kernel = bestYuvKernel();
+    capture->frameCount = 0;
+    capture->skippedFrames = 0;
+    capture->droppedFrames = 0;
+    capture->writtenFrames = 0;
+    capture->stop = false;
+    if(capture->format == CAPTURE_FORMAT_Y4M){
+        fprintf(capture->file, "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n", extent.width, extent.height, fps);
+    }
+
+    capture->commandPool = createCommandPool(device, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT, queueFamilyIndices);
+    VkDeviceSize frameSize = 4*(VkDeviceSize)extent.width*extent.height;
+    for(uint32_t i = 0; i < CAPTURE_MAX_SLOTS; i++){
+        CaptureSlot *slot = &capture->slots[i];
+        //Cached memory keeps the CPU's copy out of the slot fast, coherent saves invalidating it
+        createBuffer(device, allocator, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, VK_MEMORY_PROPERTY_HOST_CACHED_BIT, frameSize, &slot->buffer, &slot->allocation);
+        slot->commandBuffer = createCommandBuffer(device, capture->commandPool);
+        slot->pending = false;
+        slot->frameNumber = 0;
+    }
+    for(uint32_t i = 0; i < CAPTURE_QUEUE_DEPTH; i++){
+        capture->freePixels.push_back((uint8_t*)malloc(frameSize));
+    }
+
+    capture->writer = std::thread(runCaptureWriter, capture);
+    capture->enabled = true;
+    printf("Capturing %ux%u frames to %s as %s, %s conversion.\n", extent.width, extent.height, path, capture->format == CAPTURE_FORMAT_Y4M ? "Y4M" : "raw I420", yuvKernelName(capture->kernel));
+    return true;
+}
+
+void destroyFrameCapture(FrameCapture *capture){
+    if(!capture->enabled){
+        return;
+    }
+    frameCaptureCollectAll(capture);
+
+    {
+        std::lock_guard<std::mutex> lock(capture->mutex);
+        capture->stop = true;
+    }
+    capture->wake.notify_one();
+    capture->writer.join();
+    fclose(capture->file);
+
+    for(uint32_t i = 0; i < CAPTURE_MAX_SLOTS; i++){
+        destroyBuffer(capture->device, capture->allocator, capture->slots[i].buffer, &capture->slots[i].allocation);
+    }
+    vkDestroyCommandPool(capture->device, capture->commandPool, nullptr);
+    for(uint8_t* pixels : capture->freePixels){
+        free(pixels);
+    }
+    capture->freePixels.clear();
+    capture->enabled = false;
+
+    printf("Captured %" PRIu64 " frames to %s", capture->writtenFrames, capture->path);
+    if(capture->droppedFrames > 0 || capture->skippedFrames > 0){
+        printf(", %" PRIu64 " dropped while the writer was behind and %" PRIu64 " skipped for not matching %ux%u", capture->droppedFrames, capture->skippedFrames, capture->extent.width, capture->extent.height);
+    }
+    printf(".\n");
+}
+
+void frameCaptureCollect(FrameCapture *capture, uint32_t slot){
+    if(!capture->enabled || !capture->slots[slot].pending){
+        return;
+    }
+    CaptureSlot *captureSlot = &capture->slots[slot];
+    captureSlot->pending = false;
+
+    uint8_t* pixels = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(capture->mutex);
+        if(capture->freePixels.empty()){
+            capture->droppedFrames++;
+            return;
+        }
+        pixels = capture->freePixels.back();
+        capture->freePixels.pop_back();
+    }
+    //The slot is reused by the next submission of this frame, so the pixels can't be left in it for the writer
+    memcpy(pixels, captureSlot->allocation.mapped, 4*(size_t)capture->extent.width*capture->extent.height);
+    {
+        std::lock_guard<std::mutex> lock(capture->mutex);
+        capture->queue.push_back(pixels);
+    }
+    capture->wake.notify_one();
+}
+
+void frameCaptureCollectAll(FrameCapture *capture){
+    //Oldest first, so the frames keep their order in the stream
+    while(capture->enabled){
+        uint32_t oldest = UINT32_MAX;
+        for(uint32_t i = 0; i < CAPTURE_MAX_SLOTS; i++){
+            if(capture->slots[i].pending && (oldest == UINT32_MAX || capture->slots[i].frameNumber < capture->slots[oldest].frameNumber)){
+                oldest = i;
+            }
+        }
+        if(oldest == UINT32_MAX){
+            break;
+        }
+        frameCaptureCollect(capture, oldest);
+    }
+}
+
+VkCommandBuffer frameCaptureRecord(FrameCapture *capture, uint32_t slot, VkImage image, VkImageLayout layout, VkExtent2D extent){
+    if(!capture->enabled){
+        return VK_NULL_HANDLE;
+    }
+    if(extent.width != capture->extent.width || extent.height != capture->extent.height){
+        capture->skippedFrames++;//A stream can't change size
+        return VK_NULL_HANDLE;
+    }
+    CaptureSlot *captureSlot = &capture->slots[slot];
+    VkCommandBuffer commandBuffer = captureSlot->commandBuffer;
+    vkResetCommandBuffer(commandBuffer, 0);
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    if(vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS){
+        printf("Failed to begin recording Command Buffer!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    //The render pass finished writing the image earlier in the same submission
+    VkImageMemoryBarrier toTransfer{};
+    toTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    toTransfer.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    toTransfer.oldLayout = layout;
+    toTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    toTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toTransfer.image = image;
+    toTransfer.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &toTransfer);
+
+    VkBufferImageCopy region{};
+    region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    region.imageExtent = {extent.width, extent.height, 1};
+    vkCmdCopyImageToBuffer(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, captureSlot->buffer, 1, &region);
+
+    VkBufferMemoryBarrier toHost{};
+    toHost.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    toHost.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    toHost.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    toHost.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toHost.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toHost.buffer = captureSlot->buffer;
+    toHost.offset = 0;
+    toHost.size = VK_WHOLE_SIZE;
+    //Swapchain images go back to the layout presenting expects
+    VkImageMemoryBarrier toPresent = toTransfer;
+    toPresent.srcAccessMask = 0;
+    toPresent.dstAccessMask = 0;
+    toPresent.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    toPresent.newLayout = layout;
+    uint32_t imageBarrierCount = layout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL ? 0 : 1;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &toHost, imageBarrierCount, &toPresent);
+
+    if(vkEndCommandBuffer(commandBuffer) != VK_SUCCESS){
+        printf("Failed to end Command Buffer!\n");
+        exit(EXIT_FAILURE);
+    }
+    captureSlot->pending = true;
+    captureSlot->frameNumber = capture->frameCount++;
+    return commandBuffer;
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <cstdio>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "allocator.h"
+
+struct QueueFamilyIndices;
+
+#define CAPTURE_MAX_SLOTS 8//One per frame in flight, at least MAX_FRAMES_IN_FLIGHT
+#define CAPTURE_QUEUE_DEPTH 8//Frames waiting for the writer, past this new frames are dropped instead of waiting
+#define CAPTURE_DEFAULT_FPS 60
+
+enum YuvKernel{
+    YUV_KERNEL_SCALAR,
+    YUV_KERNEL_SSE2,
+    YUV_KERNEL_COUNT
+};
+
+enum CaptureFormat{
+    CAPTURE_FORMAT_Y4M,
+    CAPTURE_FORMAT_RAW//Bare I420 planes, one frame after another
+};
+
+//A host visible copy target, filled at the end of a frame slot's submission and read once its fence has signalled
+struct CaptureSlot{
+    VkBuffer buffer;
+    Allocation allocation;
+    VkCommandBuffer commandBuffer;
+    bool pending;
+    uint64_t frameNumber;//Order of the frames still in slots at shutdown
+};
+
+struct FrameCapture{
+    bool enabled;
+    VkDevice device;
+    DeviceAllocator *allocator;
+    VkCommandPool commandPool;
+    CaptureSlot slots[CAPTURE_MAX_SLOTS];
+    VkExtent2D extent;//Fixed for the whole stream, frames of any other size are skipped
+    bool redFirst;//RGBA targets, BGRA otherwise
+    YuvKernel kernel;
+    CaptureFormat format;
+    FILE* file;
+    const char* path;
+    uint32_t fps;
+    uint64_t frameCount;
+    uint64_t skippedFrames;
+
+    //Shared with the writer thread
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<uint8_t*> queue;//Pixels copied out of slots, in capture order
+    std::vector<uint8_t*> freePixels;//Handed back by the writer once written
+    bool stop;
+    uint64_t droppedFrames;
+    uint64_t writtenFrames;
+};
+
+//Returns false and leaves capture disabled when the target format isn't 8 bit BGRA or RGBA. Y4M when path ends in .y4m, raw I420 otherwise.
+bool createFrameCapture(
+    VkDevice device,
+    DeviceAllocator *allocator,
+    QueueFamilyIndices *queueFamilyIndices,
+    VkFormat format,
+    VkExtent2D extent,
+    const char* path,
+    uint32_t fps,
+    FrameCapture *capture
+);
+//The device must be idle, frames still in slots are handed to the writer before it is joined
+void destroyFrameCapture(FrameCapture *capture);
+
+//Call once the slot's fence has signalled, copies the slot's pixels out for the writer without waiting on it
+void frameCaptureCollect(FrameCapture *capture, uint32_t slot);
+//The device must be idle. Needed whenever the frames in flight change, slots past the new count would never be collected otherwise.
+void frameCaptureCollectAll(FrameCapture *capture);
+//Records the copy of image into the slot, submit the result after the frame's command buffer. VK_NULL_HANDLE when nothing is captured.
+VkCommandBuffer frameCaptureRecord(FrameCapture *capture, uint32_t slot, VkImage image, VkImageLayout layout, VkExtent2D extent);
+
+YuvKernel bestYuvKernel();
+const char* yuvKernelName(YuvKernel kernel);
+//BT.601 limited range I420 with 2x2 averaged chroma. pixels is width*height*4 bytes, planes are sized like the Y4M C420jpeg layout.
+void convertToI420(const uint8_t* pixels, uint32_t width, uint32_t height, bool redFirst, YuvKernel kernel, uint8_t* yPlane, uint8_t* uPlane, uint8_t* vPlane);
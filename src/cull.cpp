@@ -0,0 +1,229 @@
+#include "cull.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <glm/gtc/matrix_transform.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CULL_X86 1
+#include <immintrin.h>
+#endif
+
+#define BOUNDS_TABLE_ALIGNMENT 32
+
+static float* allocateBoundsArray(uint32_t capacity){
+    float* array = (float*)aligned_alloc(BOUNDS_TABLE_ALIGNMENT, sizeof(float)*capacity);
+    if(array == nullptr){
+        printf("Failed to allocate a Bounds Table of %u objects!\n", capacity);
+        exit(EXIT_FAILURE);
+    }
+    return array;
+}
+
+void createBoundsTable(uint32_t capacity, BoundsTable *table){
+    capacity = (capacity + 7) & ~7u;//Also keeps every array size a multiple of the alignment, which aligned_alloc wants
+    table->centerX = allocateBoundsArray(capacity);
+    table->centerY = allocateBoundsArray(capacity);
+    table->centerZ = allocateBoundsArray(capacity);
+    table->radius = allocateBoundsArray(capacity);
+    table->count = 0;
+    table->capacity = capacity;
+}
+
+void destroyBoundsTable(BoundsTable *table){
+    free(table->centerX);
+    free(table->centerY);
+    free(table->centerZ);
+    free(table->radius);
+    table->count = 0;
+    table->capacity = 0;
+}
+
+FrustumPlanes extractFrustumPlanes(const mat4 &viewProj){
+    //Rows of the clip matrix, glm stores columns. Depth runs from 0 to 1 in Vulkan, so the near plane is row 2 alone.
+    vec4 rows[4];
+    for(int row = 0; row < 4; row++){
+        rows[row] = vec4(viewProj[0][row], viewProj[1][row], viewProj[2][row], viewProj[3][row]);
+    }
+    vec4 planes[6] = {rows[3] + rows[0], rows[3] - rows[0], rows[3] + rows[1], rows[3] - rows[1], rows[2], rows[3] - rows[2]};
+
+    FrustumPlanes frustum{};
+    for(int i = 0; i < 6; i++){
+        float length = sqrtf(planes[i].x*planes[i].x + planes[i].y*planes[i].y + planes[i].z*planes[i].z);
+        frustum.a[i] = planes[i].x/length;
+        frustum.b[i] = planes[i].y/length;
+        frustum.c[i] = planes[i].z/length;
+        frustum.d[i] = planes[i].w/length;
+    }
+    return frustum;
+}
+
+CullKernel bestCullKernel(){
+#ifdef CULL_X86
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")){
+        return CULL_KERNEL_AVX2;
+    }
+    if(__builtin_cpu_supports("sse2")){
+        return CULL_KERNEL_SSE;
+    }
+#endif
+    return CULL_KERNEL_SCALAR;
+}
+
+const char* cullKernelName(CullKernel kernel){
+    switch(kernel){
+        case CULL_KERNEL_SCALAR: return "scalar";
+        case CULL_KERNEL_SSE: return "sse";
+        case CULL_KERNEL_AVX2: return "avx2";
+        default: return "unknown";
+    }
+}
+
+static uint32_t cullSpheresScalar(const BoundsTable *table, const FrustumPlanes *planes, uint32_t first, uint32_t* visible, uint32_t visibleCount){
+    for(uint32_t i = first; i < table->count; i++){
+        bool inside = true;
+        for(int p = 0; p < 6; p++){
+            float distance = planes->a[p]*table->centerX[i] + planes->b[p]*table->centerY[i] + planes->c[p]*table->centerZ[i] + planes->d[p];
+            inside &= distance >= -table->radius[i];
+        }
+        if(inside){
+            visible[visibleCount++] = i;
+        }
+    }
+    return visibleCount;
+}
+
+#ifdef CULL_X86
+static uint32_t cullSpheresSse(const BoundsTable *table, const FrustumPlanes *planes, uint32_t* visible){
+    uint32_t visibleCount = 0;
+    uint32_t blockEnd = table->count & ~3u;
+    for(uint32_t i = 0; i < blockEnd; i += 4){
+        __m128 x = _mm_load_ps(table->centerX + i);
+        __m128 y = _mm_load_ps(table->centerY + i);
+        __m128 z = _mm_load_ps(table->centerZ + i);
+        __m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_load_ps(table->radius + i));
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for(int p = 0; p < 6; p++){
+            __m128 distance = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes->a[p]), x), _mm_mul_ps(_mm_set1_ps(planes->b[p]), y)),
+                _mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes->c[p]), z), _mm_set1_ps(planes->d[p]))
+            );
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+        }
+        //One bit per lane, each set bit becomes the next entry of the compact list
+        uint32_t mask = _mm_movemask_ps(inside);
+        while(mask != 0){
+            visible[visibleCount++] = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+    return cullSpheresScalar(table, planes, blockEnd, visible, visibleCount);
+}
+
+__attribute__((target("avx2,fma")))
+static uint32_t cullSpheresAvx2(const BoundsTable *table, const FrustumPlanes *planes, uint32_t* visible){
+    uint32_t visibleCount = 0;
+    uint32_t blockEnd = table->count & ~7u;
+    for(uint32_t i = 0; i < blockEnd; i += 8){
+        __m256 x = _mm256_load_ps(table->centerX + i);
+        __m256 y = _mm256_load_ps(table->centerY + i);
+        __m256 z = _mm256_load_ps(table->centerZ + i);
+        __m256 negativeRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_load_ps(table->radius + i));
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for(int p = 0; p < 6; p++){
+            __m256 distance = _mm256_fmadd_ps(_mm256_set1_ps(planes->a[p]), x, _mm256_set1_ps(planes->d[p]));
+            distance = _mm256_fmadd_ps(_mm256_set1_ps(planes->b[p]), y, distance);
+            distance = _mm256_fmadd_ps(_mm256_set1_ps(planes->c[p]), z, distance);
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negativeRadius, _CMP_GE_OQ));
+        }
+        uint32_t mask = _mm256_movemask_ps(inside);
+        while(mask != 0){
+            visible[visibleCount++] = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+    return cullSpheresScalar(table, planes, blockEnd, visible, visibleCount);
+}
+#endif
+
+uint32_t cullSpheres(const BoundsTable *table, const FrustumPlanes *planes, CullKernel kernel, uint32_t* visible){
+    switch(kernel){
+#ifdef CULL_X86
+        case CULL_KERNEL_AVX2: return cullSpheresAvx2(table, planes, visible);
+        case CULL_KERNEL_SSE: return cullSpheresSse(table, planes, visible);
+#endif
+        default: return cullSpheresScalar(table, planes, 0, visible, 0);
+    }
+}
+
+void createCpuCuller(uint32_t capacity, CpuCuller *culler){
+    createBoundsTable(capacity, &culler->bounds);
+    culler->kernel = bestCullKernel();
+    culler->visible = (uint32_t*)malloc(sizeof(uint32_t)*culler->bounds.capacity);
+    culler->previousVisible = (uint32_t*)malloc(sizeof(uint32_t)*culler->bounds.capacity);
+    culler->visibleCount = 0;
+    culler->previousVisibleCount = 0;
+    culler->version = 0;
+}
+
+void destroyCpuCuller(CpuCuller *culler){
+    destroyBoundsTable(&culler->bounds);
+    free(culler->visible);
+    free(culler->previousVisible);
+}
+
+void cullObjects(CpuCuller *culler, const FrustumPlanes *planes){
+    uint32_t* previous = culler->visible;
+    culler->previousVisibleCount = culler->visibleCount;
+    culler->visible = culler->previousVisible;
+    culler->previousVisible = previous;
+
+    culler->visibleCount = cullSpheres(&culler->bounds, planes, culler->kernel, culler->visible);
+
+    //Recorded command buffers bake in the visible list, so only a different list forces a re-record
+    if(culler->visibleCount != culler->previousVisibleCount || memcmp(culler->visible, culler->previousVisible, sizeof(uint32_t)*culler->visibleCount) != 0){
+        culler->version++;
+    }
+}
+
+void runCullBenchmark(uint32_t objectCount, uint32_t iterations){
+    BoundsTable table;
+    createBoundsTable(objectCount, &table);
+    table.count = objectCount;
+
+    //Spheres spread well past the view so roughly half of them survive, which keeps the compaction honest
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> position(-8.0f, 8.0f);
+    std::uniform_real_distribution<float> radius(0.01f, 0.5f);
+    for(uint32_t i = 0; i < objectCount; i++){
+        setBounds(&table, i, vec3(position(random), position(random), position(random)), radius(random));
+    }
+
+    //The same camera updateUniformBuffer uses
+    mat4 view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+    mat4 proj = glm::perspective(glm::radians(45.0f), 800.0f/600.0f, 0.1f, 10.0f);
+    proj[1][1] *= -1;
+    FrustumPlanes planes = extractFrustumPlanes(proj*view);
+
+    uint32_t* visible = (uint32_t*)malloc(sizeof(uint32_t)*table.capacity);
+
+    printf("Culling %u spheres, %u iterations\n", objectCount, iterations);
+    CullKernel best = bestCullKernel();
+    for(int kernel = 0; kernel <= best; kernel++){
+        //FMA rounds differently, so a sphere grazing a plane may land on the other side with AVX2
+        uint32_t visibleCount = cullSpheres(&table, &planes, (CullKernel)kernel, visible);
+
+        auto start = std::chrono::steady_clock::now();
+        for(uint32_t i = 0; i < iterations; i++){
+            cullSpheres(&table, &planes, (CullKernel)kernel, visible);
+        }
+        double nanoseconds = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count()/iterations;
+        printf("  %-6s %10.3f ms  %6.3f objects/ns  %u visible\n", cullKernelName((CullKernel)kernel), nanoseconds/1e6, objectCount/nanoseconds, visibleCount);
+    }
+
+    free(visible);
+    destroyBoundsTable(&table);
+}
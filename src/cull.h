@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdint>
+#include <glm/glm.hpp>
+
+using namespace glm;
+
+#define CULL_BENCHMARK_DEFAULT_OBJECTS 1000000
+#define CULL_BENCHMARK_ITERATIONS 100
+
+enum CullKernel{
+    CULL_KERNEL_SCALAR,
+    CULL_KERNEL_SSE,
+    CULL_KERNEL_AVX2,
+    CULL_KERNEL_COUNT
+};
+
+//World space bounding spheres, one array per component so a SIMD register holds the same field of consecutive objects
+struct BoundsTable{
+    float* centerX;
+    float* centerY;
+    float* centerZ;
+    float* radius;
+    uint32_t count;
+    uint32_t capacity;//Rounded up to a whole AVX register, the padding is never tested
+};
+
+//Normalised planes pointing inwards, stored like the table so each plane component can be broadcast
+struct FrustumPlanes{
+    float a[6];
+    float b[6];
+    float c[6];
+    float d[6];
+};
+
+//Culls the bounds table every frame and keeps the visible list the draw recording walks
+struct CpuCuller{
+    BoundsTable bounds;
+    CullKernel kernel;
+    uint32_t* visible;
+    uint32_t visibleCount;
+    uint32_t* previousVisible;
+    uint32_t previousVisibleCount;
+    uint64_t version;//Bumped whenever the visible list differs from the previous frame's
+};
+
+void createBoundsTable(uint32_t capacity, BoundsTable *table);
+void destroyBoundsTable(BoundsTable *table);
+
+inline void setBounds(BoundsTable *table, uint32_t index, vec3 center, float radius){
+    table->centerX[index] = center.x;
+    table->centerY[index] = center.y;
+    table->centerZ[index] = center.z;
+    table->radius[index] = radius;
+}
+
+FrustumPlanes extractFrustumPlanes(const mat4 &viewProj);
+
+CullKernel bestCullKernel();
+const char* cullKernelName(CullKernel kernel);
+
+//Writes the indices of every sphere touching the frustum to visible in ascending order and returns how many there are
+uint32_t cullSpheres(const BoundsTable *table, const FrustumPlanes *planes, CullKernel kernel, uint32_t* visible);
+
+void createCpuCuller(uint32_t capacity, CpuCuller *culler);
+void destroyCpuCuller(CpuCuller *culler);
+void cullObjects(CpuCuller *culler, const FrustumPlanes *planes);
+
+//Times every kernel the CPU supports against random spheres and reports objects culled per nanosecond
+void runCullBenchmark(uint32_t objectCount, uint32_t iterations);
@@ -0,0 +1,344 @@
+#include "defrag.h"
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include "vk.h"
+#include "initvk.h"
+
+void createDefragmenter(
+    VkDevice device,
+    DeviceAllocator *allocator,
+    const QueueFamilyIndices *queueFamilyIndices,
+    VkQueue graphicsQueue,
+    VkDeviceSize bytesPerFrame,
+    Defragmenter *defrag
+){
+    defrag->device = device;
+    defrag->allocator = allocator;
+    defrag->queue = graphicsQueue;//Moved buffers are owned by the graphics family, so no ownership transfer is needed
+    defrag->submitted = false;
+    defrag->bytesPerFrame = bytesPerFrame;
+    defrag->framesInFlight = 1;//Set for real alongside the per-frame resources
+    defrag->frameIndex = 0;
+    defrag->lastFreeCount = UINT64_MAX;
+    defrag->bytesMoved = 0;
+    defrag->movesApplied = 0;
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = queueFamilyIndices->graphics;
+
+    if(vkCreateCommandPool(device, &poolInfo, nullptr, &defrag->commandPool) != VK_SUCCESS){
+        printf("Failed to create Defragmenter Command Pool!\n");
+        exit(EXIT_FAILURE);
+    }
+    defrag->commandBuffer = createCommandBuffer(device, defrag->commandPool);
+
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    if(vkCreateFence(device, &fenceInfo, nullptr, &defrag->fence) != VK_SUCCESS){
+        printf("Failed to create Defragmenter Fence!\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void cancelMoves(Defragmenter *defrag){
+    if(defrag->submitted){
+        vkWaitForFences(defrag->device, 1, &defrag->fence, VK_TRUE, UINT64_MAX);
+        defrag->submitted = false;
+    }
+    for(DefragMove &move : defrag->moves){
+        destroyBuffer(defrag->device, defrag->allocator, move.newBuffer, &move.newAllocation);
+    }
+    defrag->moves.clear();
+}
+
+void destroyDefragmenter(Defragmenter *defrag){
+    cancelMoves(defrag);
+    for(RetiredBuffer &retired : defrag->retired){
+        destroyBuffer(defrag->device, defrag->allocator, retired.buffer, &retired.allocation);
+    }
+    defrag->retired.clear();
+    defrag->entries.clear();
+    vkDestroyFence(defrag->device, defrag->fence, nullptr);
+    vkDestroyCommandPool(defrag->device, defrag->commandPool, nullptr);
+}
+
+uint32_t defragmenterRegister(
+    Defragmenter *defrag,
+    VkBuffer *buffer,
+    Allocation *allocation,
+    VkBufferUsageFlags usage,
+    VkDeviceSize size,
+    DefragUsedBytesFunction usedBytes,
+    const void* owner
+){
+    DefragEntry entry{};
+    entry.buffer = buffer;
+    entry.allocation = allocation;
+    entry.usage = usage;
+    entry.size = size;
+    entry.usedBytes = usedBytes;
+    entry.owner = owner;
+    entry.frameSlot = UINT32_MAX;
+    entry.mapped = nullptr;
+    entry.lastWrite = 0;
+    defrag->entries.push_back(entry);
+    defrag->lastFreeCount = UINT64_MAX;
+    return defrag->entries.size() - 1;
+}
+
+void defragmenterBindDescriptor(
+    Defragmenter *defrag,
+    uint32_t entryIndex,
+    uint32_t frameSlot,
+    VkDescriptorSet descriptorSet,
+    uint32_t binding,
+    VkDescriptorType type,
+    VkDeviceSize offset,
+    VkDeviceSize range
+){
+    DefragEntry *entry = &defrag->entries[entryIndex];
+    entry->frameSlot = frameSlot;
+    entry->descriptorWrites.push_back({descriptorSet, binding, type, offset, range});
+}
+
+void defragmenterTrackMapping(Defragmenter *defrag, uint32_t entryIndex, void** mapped){
+    defrag->entries[entryIndex].mapped = mapped;
+}
+
+void defragmenterUnregister(Defragmenter *defrag, VkBuffer *buffer){
+    cancelMoves(defrag);//Entry indices are about to shift
+    for(size_t i = 0; i < defrag->entries.size(); i++){
+        if(defrag->entries[i].buffer == buffer){
+            defrag->entries.erase(defrag->entries.begin() + i);
+            return;
+        }
+    }
+}
+
+void defragmenterBufferWritten(Defragmenter *defrag, VkBuffer buffer, UploadToken token){
+    for(size_t i = 0; i < defrag->moves.size(); i++){
+        DefragEntry *entry = &defrag->entries[defrag->moves[i].entryIndex];
+        if(*entry->buffer != buffer){
+            continue;
+        }
+        //Anything submitted later on the graphics queue is fenced behind the copy, so the new buffer only has to outlive the frames in flight
+        DefragMove *move = &defrag->moves[i];
+        defrag->retired.push_back({move->newBuffer, move->newAllocation, defrag->frameIndex});
+        defrag->moves.erase(defrag->moves.begin() + i);
+        defrag->lastFreeCount = UINT64_MAX;
+        break;
+    }
+    for(DefragEntry &entry : defrag->entries){
+        if(*entry.buffer == buffer){
+            entry.lastWrite = std::max(entry.lastWrite, token);
+        }
+    }
+}
+
+static void retireBuffers(Defragmenter *defrag){
+    //A buffer swapped out before frame N was last recorded by frame N-1, whose fence has been waited on once frame N-1+framesInFlight starts
+    size_t kept = 0;
+    for(size_t i = 0; i < defrag->retired.size(); i++){
+        RetiredBuffer &retired = defrag->retired[i];
+        if(defrag->frameIndex >= retired.retireFrame + defrag->framesInFlight){
+            destroyBuffer(defrag->device, defrag->allocator, retired.buffer, &retired.allocation);
+        }
+        else{
+            defrag->retired[kept++] = retired;
+        }
+    }
+    defrag->retired.resize(kept);
+}
+
+static void applyMove(Defragmenter *defrag, DefragMove *move){
+    DefragEntry *entry = &defrag->entries[move->entryIndex];
+    defrag->retired.push_back({*entry->buffer, *entry->allocation, defrag->frameIndex});
+    *entry->buffer = move->newBuffer;
+    *entry->allocation = move->newAllocation;
+    if(entry->mapped != nullptr){
+        *entry->mapped = entry->allocation->mapped;
+    }
+    for(const DefragDescriptorWrite &write : entry->descriptorWrites){
+        VkDescriptorBufferInfo bufferInfo{};
+        bufferInfo.buffer = *entry->buffer;
+        bufferInfo.offset = write.offset;
+        bufferInfo.range = write.range;
+
+        VkWriteDescriptorSet descriptorWrite{};
+        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrite.dstSet = write.descriptorSet;
+        descriptorWrite.dstBinding = write.binding;
+        descriptorWrite.dstArrayElement = 0;
+        descriptorWrite.descriptorType = write.type;
+        descriptorWrite.descriptorCount = 1;
+        descriptorWrite.pBufferInfo = &bufferInfo;
+        vkUpdateDescriptorSets(defrag->device, 1, &descriptorWrite, 0, nullptr);
+    }
+    defrag->bytesMoved += move->copySize;
+    defrag->movesApplied++;
+}
+
+static void planMoves(Defragmenter *defrag, UploadQueue *uploadQueue){
+    if(defrag->allocator->freeCount == defrag->lastFreeCount){
+        return;
+    }
+
+    //Move the allocations furthest from the front first, that is what lets trailing blocks empty out and be freed
+    std::vector<uint32_t> order(defrag->entries.size());
+    for(uint32_t i = 0; i < order.size(); i++){
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [defrag](uint32_t a, uint32_t b){
+        const Allocation *allocA = defrag->entries[a].allocation;
+        const Allocation *allocB = defrag->entries[b].allocation;
+        if(allocA->blockIndex != allocB->blockIndex){
+            return allocA->blockIndex > allocB->blockIndex;
+        }
+        return allocA->offset > allocB->offset;
+    });
+
+    VkDeviceSize plannedBytes = 0;
+    for(uint32_t i = 0; i < order.size() && plannedBytes < defrag->bytesPerFrame; i++){
+        DefragEntry *entry = &defrag->entries[order[i]];
+        if(!uploadQueuePoll(uploadQueue, entry->lastWrite)){
+            continue;
+        }
+
+        VkBufferCreateInfo bufferInfo{};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = entry->size;
+        bufferInfo.usage = entry->usage;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        DefragMove move{};
+        move.entryIndex = order[i];
+        move.copySize = entry->usedBytes != nullptr ? std::min(entry->usedBytes(entry->owner), entry->size) : entry->size;
+        if(vkCreateBuffer(defrag->device, &bufferInfo, nullptr, &move.newBuffer) != VK_SUCCESS){
+            printf("Failed to create Defragmentation Buffer!\n");
+            exit(EXIT_FAILURE);
+        }
+        VkMemoryRequirements memRequirements;
+        vkGetBufferMemoryRequirements(defrag->device, move.newBuffer, &memRequirements);
+
+        if(!allocateMemoryBefore(defrag->allocator, &memRequirements, entry->allocation, &move.newAllocation)){
+            vkDestroyBuffer(defrag->device, move.newBuffer, nullptr);
+            continue;
+        }
+        vkBindBufferMemory(defrag->device, move.newBuffer, move.newAllocation.memory, move.newAllocation.offset);
+        defrag->moves.push_back(move);
+        plannedBytes += move.copySize;
+    }
+
+    bool uploading = false;
+    for(const DefragEntry &entry : defrag->entries){
+        uploading = uploading || entry.lastWrite > uploadQueue->completedToken;
+    }
+    if(defrag->moves.empty() && !uploading){
+        defrag->lastFreeCount = defrag->allocator->freeCount;//Compact until the next free
+    }
+}
+
+static void recordCopies(Defragmenter *defrag){
+    vkResetCommandBuffer(defrag->commandBuffer, 0);
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(defrag->commandBuffer, &beginInfo);
+
+    //Large buffers are copied in slices so no single frame pays for more than bytesPerFrame
+    VkDeviceSize budget = defrag->bytesPerFrame;
+    for(DefragMove &move : defrag->moves){
+        if(budget == 0){
+            break;
+        }
+        VkDeviceSize remaining = move.copySize - move.copiedBytes;
+        if(remaining == 0){
+            continue;
+        }
+        VkBufferCopy region{};
+        region.srcOffset = move.copiedBytes;
+        region.dstOffset = move.copiedBytes;
+        region.size = std::min(remaining, budget);
+        vkCmdCopyBuffer(defrag->commandBuffer, *defrag->entries[move.entryIndex].buffer, move.newBuffer, 1, &region);
+        move.copiedBytes += region.size;
+        budget -= region.size;
+    }
+
+    //Frames recorded after the swap read the new buffers, this orders those reads after the copies
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(
+        defrag->commandBuffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+        0,
+        1, &barrier,
+        0, nullptr,
+        0, nullptr
+    );
+
+    if(vkEndCommandBuffer(defrag->commandBuffer) != VK_SUCCESS){
+        printf("Failed to end Defragmenter Command Buffer!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &defrag->commandBuffer;
+
+    vkResetFences(defrag->device, 1, &defrag->fence);
+    if(vkQueueSubmit(defrag->queue, 1, &submitInfo, defrag->fence) != VK_SUCCESS){
+        printf("Failed to submit Defragmentation Copies!\n");
+        exit(EXIT_FAILURE);
+    }
+    defrag->submitted = true;
+}
+
+void defragmenterStep(Defragmenter *defrag, uint32_t currentFrame, UploadQueue *uploadQueue){
+    defrag->frameIndex++;
+    retireBuffers(defrag);
+
+    if(defrag->submitted){
+        if(vkGetFenceStatus(defrag->device, defrag->fence) != VK_SUCCESS){
+            return;//Still copying, check again next frame
+        }
+        defrag->submitted = false;
+    }
+
+    if(!defrag->moves.empty()){
+        bool copied = true;
+        for(const DefragMove &move : defrag->moves){
+            copied = copied && move.copiedBytes == move.copySize;
+        }
+        if(!copied){
+            recordCopies(defrag);
+            return;
+        }
+
+        //Buffers tied to a frame slot only swap when that slot's descriptor set is known to be idle
+        size_t kept = 0;
+        for(size_t i = 0; i < defrag->moves.size(); i++){
+            uint32_t frameSlot = defrag->entries[defrag->moves[i].entryIndex].frameSlot;
+            if(frameSlot == UINT32_MAX || frameSlot == currentFrame){
+                applyMove(defrag, &defrag->moves[i]);
+            }
+            else{
+                defrag->moves[kept++] = defrag->moves[i];
+            }
+        }
+        defrag->moves.resize(kept);
+        return;
+    }
+
+    planMoves(defrag, uploadQueue);
+    if(!defrag->moves.empty()){
+        recordCopies(defrag);
+    }
+}
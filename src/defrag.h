@@ -0,0 +1,111 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include "allocator.h"
+#include "upload.h"
+
+#define DEFAULT_DEFRAG_BYTES_PER_FRAME (4ull*1024*1024)
+
+struct QueueFamilyIndices;
+
+//Bytes at the front of a registered buffer that hold data, owner is whatever was passed to defragmenterRegister
+typedef VkDeviceSize (*DefragUsedBytesFunction)(const void* owner);
+
+//A descriptor that points into a registered buffer and has to follow it when it moves
+struct DefragDescriptorWrite{
+    VkDescriptorSet descriptorSet;
+    uint32_t binding;
+    VkDescriptorType type;
+    VkDeviceSize offset;
+    VkDeviceSize range;
+};
+
+//A buffer the defragmenter may move. The owner keeps reading *buffer and *allocation, which get swapped in place.
+//Writes through the upload queue cancel the buffer's move, anything else writing it must call defragmenterBufferWritten first.
+struct DefragEntry{
+    VkBuffer *buffer;
+    Allocation *allocation;
+    VkBufferUsageFlags usage;//Must include VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+    VkDeviceSize size;
+    DefragUsedBytesFunction usedBytes;//Only that much is copied when the buffer moves, null copies all of it
+    const void* owner;
+    uint32_t frameSlot;//Frame in flight the buffer belongs to, UINT32_MAX when it is bound by every frame
+    std::vector<DefragDescriptorWrite> descriptorWrites;//Rewritten when the buffer moves
+    void** mapped;//Repointed when the buffer moves, may be null
+    UploadToken lastWrite;//Not moved until the upload queue has completed it, the copy would read stale data otherwise
+};
+
+struct DefragMove{
+    uint32_t entryIndex;
+    VkBuffer newBuffer;
+    Allocation newAllocation;
+    VkDeviceSize copySize;//Bytes in use when the move was planned, later writes cancel the move or are redone by the owner
+    VkDeviceSize copiedBytes;
+};
+
+struct RetiredBuffer{
+    VkBuffer buffer;
+    Allocation allocation;
+    uint64_t retireFrame;
+};
+
+struct Defragmenter{
+    VkDevice device;
+    DeviceAllocator *allocator;
+    VkQueue queue;
+    VkCommandPool commandPool;
+    VkCommandBuffer commandBuffer;
+    VkFence fence;
+    bool submitted;
+    VkDeviceSize bytesPerFrame;
+    uint32_t framesInFlight;
+    uint64_t frameIndex;
+    uint64_t lastFreeCount;//Allocator free count when the last pass found nothing to move
+    std::vector<DefragEntry> entries;
+    std::vector<DefragMove> moves;//The pass being copied, swapped in together once every copy has landed
+    std::vector<RetiredBuffer> retired;//Old locations, kept until no frame in flight can reference them
+    uint64_t bytesMoved;
+    uint64_t movesApplied;//Command buffers recorded before a move reference the old buffer or descriptor
+};
+
+void createDefragmenter(
+    VkDevice device,
+    DeviceAllocator *allocator,
+    const QueueFamilyIndices *queueFamilyIndices,
+    VkQueue graphicsQueue,
+    VkDeviceSize bytesPerFrame,
+    Defragmenter *defrag
+);
+
+void destroyDefragmenter(Defragmenter *defrag);
+
+uint32_t defragmenterRegister(
+    Defragmenter *defrag,
+    VkBuffer *buffer,
+    Allocation *allocation,
+    VkBufferUsageFlags usage,
+    VkDeviceSize size,
+    DefragUsedBytesFunction usedBytes,
+    const void* owner
+);
+
+void defragmenterBindDescriptor(
+    Defragmenter *defrag,
+    uint32_t entryIndex,
+    uint32_t frameSlot,
+    VkDescriptorSet descriptorSet,
+    uint32_t binding,
+    VkDescriptorType type,
+    VkDeviceSize offset,
+    VkDeviceSize range
+);
+
+void defragmenterTrackMapping(Defragmenter *defrag, uint32_t entryIndex, void** mapped);
+
+void defragmenterUnregister(Defragmenter *defrag, VkBuffer *buffer);
+
+//Cancels the move of buffer if one is in flight, the write would land in the old location and be lost. token is when the write completes.
+void defragmenterBufferWritten(Defragmenter *defrag, VkBuffer buffer, UploadToken token);
+
+//Call once per frame after waiting on currentFrame's fence, before recording. Never blocks.
+void defragmenterStep(Defragmenter *defrag, uint32_t currentFrame, UploadQueue *uploadQueue);
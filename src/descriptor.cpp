@@ -2,22 +2,26 @@
 #include <cstdio>
 #include <cstdlib>
 #include <glm/gtc/matrix_transform.hpp>
-#include <chrono>
 #include <cstring>
 #include "vk.h"
 
 VkDescriptorSetLayout createDescriptorSetLayout(VkDevice device){
-    VkDescriptorSetLayoutBinding uboLayoutBinding{};
-    uboLayoutBinding.binding = 0;
-    uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    uboLayoutBinding.descriptorCount = 1;
-    uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-    uboLayoutBinding.pImmutableSamplers = nullptr;
+    VkDescriptorSetLayoutBinding layoutBindings[2]{};
+    layoutBindings[0].binding = 0;
+    layoutBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    layoutBindings[0].descriptorCount = 1;
+    layoutBindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    layoutBindings[0].pImmutableSamplers = nullptr;
+    layoutBindings[1].binding = 1;
+    layoutBindings[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    layoutBindings[1].descriptorCount = 1;
+    layoutBindings[1].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    layoutBindings[1].pImmutableSamplers = nullptr;
 
     VkDescriptorSetLayoutCreateInfo layoutInfo{};
     layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    layoutInfo.bindingCount = 1;
-    layoutInfo.pBindings = &uboLayoutBinding;
+    layoutInfo.bindingCount = 2;
+    layoutInfo.pBindings = layoutBindings;
 
     VkDescriptorSetLayout descriptorSetLayout;
     if(vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS){
@@ -28,60 +32,122 @@ VkDescriptorSetLayout createDescriptorSetLayout(VkDevice device){
     return descriptorSetLayout;
 }
 
-void createUniformBuffers(
+void createUniformRing(
     VkDevice device,
-    VkPhysicalDevice physicalDevice,
-    uint32_t uniformBufferCount, 
-    VkBuffer uniformBuffers[], 
-    VkDeviceMemory uniformBuffersMemory[],
-    void* uniformBuffersMapped[]
+    DeviceAllocator *allocator,
+    uint32_t objectCapacity,
+    VkDeviceSize minUniformBufferOffsetAlignment,
+    UniformRing *ring
 ){
-    VkDeviceSize bufferSize = sizeof(UniformBufferObject);
-
-    for(int i = 0; i < uniformBufferCount; i++){
-        createBuffer(
-            device,
-            physicalDevice,
-            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-            bufferSize,
-            &uniformBuffers[i],
-            &uniformBuffersMemory[i]
-        );
-
-        vkMapMemory(device, uniformBuffersMemory[i], 0, bufferSize, 0, &uniformBuffersMapped[i]);
+    VkDeviceSize alignment = minUniformBufferOffsetAlignment > 0 ? minUniformBufferOffsetAlignment : 1;
+    ring->objectStride = (sizeof(ObjectUniforms) + alignment - 1)/alignment*alignment;
+    ring->objectsOffset = (sizeof(FrameUniforms) + alignment - 1)/alignment*alignment;
+    ring->objectCapacity = objectCapacity;
+    ring->objectCount = 0;
+    ring->sceneUpdate = 0;
+    ring->sceneMapped = nullptr;
+
+    createBuffer(
+        device,
+        allocator,
+        UNIFORM_BUFFER_USAGE,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,//Rewritten every frame, so worth a BAR slot when there is one
+        ring->objectsOffset + ring->objectStride*objectCapacity,
+        &ring->buffer,
+        &ring->allocation
+    );
+
+    ring->mapped = ring->allocation.mapped;//Host visible allocations are persistently mapped
+}
+
+void destroyUniformRing(VkDevice device, DeviceAllocator *allocator, UniformRing *ring){
+    destroyBuffer(device, allocator, ring->buffer, &ring->allocation);
+    ring->mapped = nullptr;
+}
+
+VkDeviceSize usedUniformRingBytes(const void* ring){
+    const UniformRing *uniformRing = (const UniformRing*)ring;
+    return uniformRing->objectsOffset + uniformRing->objectStride*uniformRing->objectCount;
+}
+
+uint32_t uniformRingWriteObject(UniformRing *ring, uint32_t objectIndex, const ObjectUniforms *object){
+    if(objectIndex >= ring->objectCapacity){
+        printf("Uniform Ring is full, grow it before writing more than %u objects!\n", ring->objectCapacity);
+        exit(EXIT_FAILURE);
     }
+    uint32_t dynamicOffset = ring->objectStride*objectIndex;
+    memcpy((char*)ring->mapped + ring->objectsOffset + dynamicOffset, object, sizeof(ObjectUniforms));
+    return dynamicOffset;
 }
 
-void updateUniformBuffer(
-    void* mappedUniformBuffer,
-    VkExtent2D swapchainExtent
+FrameUniforms updateUniformBuffer(
+    UniformRing *ring,
+    VkExtent2D swapchainExtent,
+    const SceneGraph *scene,
+    const GeometryStore *geometryStore,
+    BoundsTable *worldBounds
 ){
-    static auto startTime = std::chrono::high_resolution_clock::now();
+    FrameUniforms frame{};
+    frame.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+    frame.proj = glm::perspective(glm::radians(45.0f), swapchainExtent.width/(float)swapchainExtent.height, 0.1f, 10.0f);
+    frame.proj[1][1] *= -1;
+    memcpy(ring->mapped, &frame, sizeof(FrameUniforms));
+
+    uint32_t objectCount = geometryStore->meshes.size();
+    if(worldBounds != nullptr && objectCount > worldBounds->capacity){
+        printf("Bounds Table is full, cannot hold more than %u objects!\n", worldBounds->capacity);
+        exit(EXIT_FAILURE);
+    }
 
-    auto currentTime = std::chrono::high_resolution_clock::now();
-    float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
+    if(ring->mapped != ring->sceneMapped){
+        ring->sceneUpdate = 0;//Moved, and writes made while the copy was in flight only reached the old buffer
+        ring->sceneMapped = ring->mapped;
+    }
 
-    UniformBufferObject ubo{};
-    ubo.model = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-    ubo.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-    ubo.proj = glm::perspective(glm::radians(45.0f), swapchainExtent.width/(float)swapchainExtent.height, 0.1f, 10.0f);
-    ubo.proj[1][1] *= -1;
+    //Every frame slot has its own ring, so a change has to reach each of them once
+    for(uint32_t i = 0; i < objectCount; i++){
+        uint32_t slot = sceneObjectSlot(scene, i);
+        if(slot == SCENE_NO_OBJECT){
+            continue;
+        }
+        uint64_t changed = scene->worldUpdates[slot];
+        const mat4 &model = scene->worldTransforms[slot];
+        if(changed > ring->sceneUpdate){
+            ObjectUniforms object{};
+            object.model = model;
+            uniformRingWriteObject(ring, i, &object);
+        }
+
+        //The bounds table is shared by all frames, so only this update's changes and new objects need writing
+        if(worldBounds != nullptr && (changed == scene->updateCount || i >= worldBounds->count)){
+            vec4 sphere = geometryStore->meshes[i].boundingSphere;
+            vec4 center = model * vec4(sphere.x, sphere.y, sphere.z, 1.0f);
+            float scale = glm::max(glm::length(vec3(model[0])), glm::max(glm::length(vec3(model[1])), glm::length(vec3(model[2]))));
+            setBounds(worldBounds, i, vec3(center), sphere.w*scale);
+        }
+    }
+    ring->objectCount = objectCount;
+    ring->sceneUpdate = scene->updateCount;
+    if(worldBounds != nullptr){
+        worldBounds->count = objectCount;
+    }
 
-    memcpy(mappedUniformBuffer, &ubo, sizeof(UniformBufferObject));
-    //Using a UBO this way is not the most efficient way to pass frequently changing values to the shader. A more efficient way to pass a small buffer of data to shaders are push constants. 
+    return frame;
 }
 
-VkDescriptorPool createDescriptorPool(VkDevice device, uint32_t uniformBufferCount){
-    VkDescriptorPoolSize poolSize{};
-    poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    poolSize.descriptorCount = uniformBufferCount;
+VkDescriptorPool createDescriptorPool(VkDevice device, uint32_t descriptorSetCount){
+    VkDescriptorPoolSize poolSizes[2]{};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    poolSizes[0].descriptorCount = descriptorSetCount;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    poolSizes[1].descriptorCount = descriptorSetCount;
 
     VkDescriptorPoolCreateInfo poolInfo{};
     poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    poolInfo.poolSizeCount = 1;
-    poolInfo.pPoolSizes = &poolSize;
-    poolInfo.maxSets = uniformBufferCount;
+    poolInfo.poolSizeCount = 2;
+    poolInfo.pPoolSizes = poolSizes;
+    poolInfo.maxSets = descriptorSetCount;
 
     VkDescriptorPool descriptorPool;
 
@@ -98,7 +164,7 @@ void createDescriptorSets(
     VkDescriptorPool descriptorPool,
     uint32_t descriptorSetCount,
     VkDescriptorSetLayout descriptorSetLayouts[],
-    VkBuffer uniformBuffers[],
+    const UniformRing uniformRings[],
     VkDescriptorSet *descriptorSets
 ){
     VkDescriptorSetAllocateInfo allocInfo{};
@@ -112,23 +178,34 @@ void createDescriptorSets(
         exit(EXIT_FAILURE);
     }
 
+    //Per-object data is selected with dynamic offsets at bind time
     for(int i = 0; i < descriptorSetCount; i++){
-        VkDescriptorBufferInfo bufferInfo{};
-        bufferInfo.buffer = uniformBuffers[i];
-        bufferInfo.offset = 0;
-        bufferInfo.range = sizeof(UniformBufferObject);
-
-        VkWriteDescriptorSet descriptorWrite{};
-        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrite.dstSet = descriptorSets[i];
-        descriptorWrite.dstBinding = 0;
-        descriptorWrite.dstArrayElement = 0;
-        descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        descriptorWrite.descriptorCount = 1;
-        descriptorWrite.pBufferInfo = &bufferInfo;
-        descriptorWrite.pImageInfo = nullptr;
-        descriptorWrite.pTexelBufferView = nullptr;
-
-        vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+        writeUniformDescriptors(device, descriptorSets[i], &uniformRings[i]);
+    }
+}
+
+void writeUniformDescriptors(VkDevice device, VkDescriptorSet descriptorSet, const UniformRing *ring){
+    VkDescriptorBufferInfo bufferInfos[2]{};
+    bufferInfos[0].buffer = ring->buffer;
+    bufferInfos[0].offset = 0;
+    bufferInfos[0].range = sizeof(FrameUniforms);
+    bufferInfos[1].buffer = ring->buffer;
+    bufferInfos[1].offset = ring->objectsOffset;
+    bufferInfos[1].range = sizeof(ObjectUniforms);
+
+    VkWriteDescriptorSet descriptorWrites[2]{};
+    for(int binding = 0; binding < 2; binding++){
+        descriptorWrites[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[binding].dstSet = descriptorSet;
+        descriptorWrites[binding].dstBinding = binding;
+        descriptorWrites[binding].dstArrayElement = 0;
+        descriptorWrites[binding].descriptorCount = 1;
+        descriptorWrites[binding].pBufferInfo = &bufferInfos[binding];
+        descriptorWrites[binding].pImageInfo = nullptr;
+        descriptorWrites[binding].pTexelBufferView = nullptr;
     }
-}
\ No newline at end of file
+    descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+
+    vkUpdateDescriptorSets(device, 2, descriptorWrites, 0, nullptr);
+}
@@ -2,39 +2,86 @@
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
 #include <vulkan/vulkan.h>
+#include "allocator.h"
+#include "geometry.h"
+#include "cull.h"
+#include "scene.h"
 
 using namespace glm;
 
-struct UniformBufferObject
+#define UNIFORM_BUFFER_USAGE (VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)//Source usage lets the defragmenter move them, storage usage lets culling read them
+#define DEFAULT_OBJECT_UNIFORM_CAPACITY 32768
+
+//Shared by every draw in a frame, binding 0
+struct FrameUniforms
 {
-    mat4 model;
     mat4 view;
     mat4 proj;
 };
 
+//One per object, binding 1 is a dynamic uniform buffer pointed at the object's slot
+struct ObjectUniforms
+{
+    mat4 model;
+};
+
+//Small per-draw values that are not worth a uniform slot
+struct DrawPushConstants
+{
+    vec4 tint;
+};
+
+//One per frame in flight: the frame block followed by a linear ring of object blocks
+struct UniformRing{
+    VkBuffer buffer;
+    Allocation allocation;
+    void* mapped;
+    VkDeviceSize objectsOffset;
+    VkDeviceSize objectStride;//sizeof(ObjectUniforms) rounded up to minUniformBufferOffsetAlignment
+    uint32_t objectCapacity;
+    uint32_t objectCount;
+    uint64_t sceneUpdate;//Scene graph update the object blocks were last brought up to date with
+    void* sceneMapped;//Mapping that update was written through, the defragmenter repoints mapped when the ring moves
+};
+
 VkDescriptorSetLayout createDescriptorSetLayout(VkDevice device);
 
-void createUniformBuffers(
+void createUniformRing(
     VkDevice device,
-    VkPhysicalDevice physicalDevice,
-    uint32_t uniformBufferCount, 
-    VkBuffer uniformBuffers[], 
-    VkDeviceMemory uniformBuffersMemory[],
-    void* uniformBuffersMapped[]
+    DeviceAllocator *allocator,
+    uint32_t objectCapacity,
+    VkDeviceSize minUniformBufferOffsetAlignment,
+    UniformRing *ring
 );
 
-void updateUniformBuffer(
-    void* mappedUniformBuffer,
-    VkExtent2D swapchainExtent
+void destroyUniformRing(VkDevice device, DeviceAllocator *allocator, UniformRing *ring);
+
+//The frame block and the objects written by the last update, ring is a UniformRing. Used by the defragmenter.
+VkDeviceSize usedUniformRingBytes(const void* ring);
+
+//Object i always lives at slot i, so recorded dynamic offsets stay valid
+uint32_t uniformRingWriteObject(UniformRing *ring, uint32_t objectIndex, const ObjectUniforms *object);
+
+//Writes the frame block and the model of every mesh whose world transform changed since this ring last saw the scene.
+//World bounding spheres of changed meshes go to worldBounds when it is not null.
+FrameUniforms updateUniformBuffer(
+    UniformRing *ring,
+    VkExtent2D swapchainExtent,
+    const SceneGraph *scene,
+    const GeometryStore *geometryStore,
+    BoundsTable *worldBounds
 );
 
-VkDescriptorPool createDescriptorPool(VkDevice device, uint32_t uniformBufferCount);
+VkDescriptorPool createDescriptorPool(VkDevice device, uint32_t descriptorSetCount);
 
 void createDescriptorSets(
     VkDevice device,
     VkDescriptorPool descriptorPool,
     uint32_t descriptorSetCount,
     VkDescriptorSetLayout descriptorSetLayouts[],
-    VkBuffer uniformBuffers[],
+    const UniformRing uniformRings[],
     VkDescriptorSet *descriptorSets
-);
\ No newline at end of file
+);
+
+//Points both bindings at ring, again whenever the ring is replaced
+void writeUniformDescriptors(VkDevice device, VkDescriptorSet descriptorSet, const UniformRing *ring);
@@ -1,33 +1,19 @@
 #include "draw.h"
 #include <cstdio>
 #include <cstdlib>
+#include <algorithm>
 #include <GLFW/glfw3.h>
 #include "vk.h"
 #include "initvk.h"
 #include "descriptor.h"
 
-void recordCommandBuffer(
-    VkCommandBuffer commandBuffer, 
-    VkRenderPass renderPass, 
-    VkFramebuffer swapChainFramebuffer, 
+void beginSwapchainRenderPass(
+    VkCommandBuffer commandBuffer,
+    VkRenderPass renderPass,
+    VkFramebuffer swapChainFramebuffer,
     VkExtent2D swapChainExtent,
-    VkPipelineLayout graphicsPipelineLayout,
-    VkPipeline graphicsPipeline,
-    const VkDescriptorSet descriptorSet,
-    VkBuffer vertexBuffer,
-    VkBuffer indexBuffer,
-    uint32_t indicesCount
+    VkSubpassContents contents
 ){
-    VkCommandBufferBeginInfo beginInfo{};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = 0;
-    beginInfo.pInheritanceInfo = nullptr;
-
-    if(vkBeginCommandBuffer(commandBuffer, &beginInfo)!= VK_SUCCESS){
-        printf("Failed to begin Command Buffer Recording!\n");
-        exit(EXIT_FAILURE);
-    }
-
     VkRenderPassBeginInfo renderPassInfo{};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
     renderPassInfo.renderPass = renderPass;
@@ -38,14 +24,34 @@ void recordCommandBuffer(
     renderPassInfo.clearValueCount = 1;
     renderPassInfo.pClearValues = &clearColor;
 
-    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, contents);
+}
+
+vec4 objectTint(uint32_t objectIndex){
+    if(objectIndex == 0){
+        return vec4(1.0f);
+    }
+    uint32_t i = objectIndex;
+    return vec4(0.5f + 0.5f*(i % 3)/2.0f, 0.5f + 0.5f*(i % 5)/4.0f, 0.5f + 0.5f*(i % 7)/6.0f, 1.0f);
+}
 
-    VkBuffer vertexBuffers[] = {vertexBuffer};
-    VkDeviceSize offsets[] = {0};
-    vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+void recordMeshDraws(
+    VkCommandBuffer commandBuffer,
+    VkExtent2D swapChainExtent,
+    VkPipelineLayout graphicsPipelineLayout,
+    VkPipeline graphicsPipeline,
+    const VkDescriptorSet descriptorSet,
+    const GeometryStore *geometryStore,
+    VkBuffer instanceBuffer,
+    VkDeviceSize objectStride,
+    const uint32_t* drawList,
+    uint32_t firstDraw,
+    uint32_t drawCount
+){
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
 
-    vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+    bindGeometryStore(commandBuffer, geometryStore);//Every mesh shares these two buffers
+    bindInstanceStream(commandBuffer, instanceBuffer);
 
     VkViewport viewport{};
     viewport.x = 0.0f;
@@ -61,11 +67,150 @@ void recordCommandBuffer(
     scissor.extent = swapChainExtent;
     vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+    //Object i always lives at slot i of the frame's uniform ring, so only the dynamic offset changes between draws
+    for(uint32_t draw = firstDraw; draw < firstDraw + drawCount; draw++){
+        uint32_t i = drawList != nullptr ? drawList[draw] : draw;
+        uint32_t dynamicOffset = objectStride*i;
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipelineLayout, 0, 1, &descriptorSet, 1, &dynamicOffset);
 
-    vkCmdDrawIndexed(commandBuffer, indicesCount, 1, 0, 0, 0);
+        DrawPushConstants pushConstants{};
+        pushConstants.tint = objectTint(i);
+        vkCmdPushConstants(commandBuffer, graphicsPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(DrawPushConstants), &pushConstants);
 
+        drawMesh(commandBuffer, geometryStore, i);
+    }
+}
+
+void recordCommandBuffer(
+    VkCommandBuffer commandBuffer, 
+    VkRenderPass renderPass, 
+    VkFramebuffer swapChainFramebuffer, 
+    VkExtent2D swapChainExtent,
+    VkPipelineLayout graphicsPipelineLayout,
+    VkPipeline graphicsPipeline,
+    const VkDescriptorSet descriptorSet,
+    const GeometryStore *geometryStore,
+    VkBuffer instanceBuffer,
+    const InstanceScene *instanceScene,
+    VkDeviceSize objectStride,
+    const uint32_t* drawList,
+    uint32_t drawCount,
+    GpuProfiler *profiler,
+    uint32_t profilerScope
+){
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = 0;
+    beginInfo.pInheritanceInfo = nullptr;
+
+    if(vkBeginCommandBuffer(commandBuffer, &beginInfo)!= VK_SUCCESS){
+        printf("Failed to begin Command Buffer Recording!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    gpuProfilerBeginRegion(profiler, profilerScope, commandBuffer, "frame");
+    gpuProfilerBeginRegion(profiler, profilerScope, commandBuffer, "main pass");
+    beginSwapchainRenderPass(commandBuffer, renderPass, swapChainFramebuffer, swapChainExtent, VK_SUBPASS_CONTENTS_INLINE);
+    gpuProfilerBeginRegion(profiler, profilerScope, commandBuffer, "mesh draws");
+    recordMeshDraws(commandBuffer, swapChainExtent, graphicsPipelineLayout, graphicsPipeline, descriptorSet, geometryStore, instanceBuffer, objectStride, drawList, 0, drawCount);
+    gpuProfilerEndRegion(profiler, profilerScope, commandBuffer);
+    gpuProfilerBeginRegion(profiler, profilerScope, commandBuffer, "instanced draws");
+    recordInstanceDraws(commandBuffer, graphicsPipelineLayout, descriptorSet, geometryStore, instanceScene, objectStride);
+    gpuProfilerEndRegion(profiler, profilerScope, commandBuffer);
     vkCmdEndRenderPass(commandBuffer);
+    gpuProfilerEndRegion(profiler, profilerScope, commandBuffer);
+    gpuProfilerEndRegion(profiler, profilerScope, commandBuffer);
+
+    if(vkEndCommandBuffer(commandBuffer) != VK_SUCCESS){
+        printf("Failed to end Command Buffer!\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+struct IndirectGraphContext{
+    VulkanObjects *vko;
+    uint32_t frame;
+    uint32_t swapchainImageIndex;
+};
+
+static void recordClearGraphPass(VkCommandBuffer commandBuffer, void* userData){
+    IndirectGraphContext *context = (IndirectGraphContext*)userData;
+    recordDrawCountClear(commandBuffer, &context->vko->indirectRenderer, context->frame);
+}
+
+static void recordCullGraphPass(VkCommandBuffer commandBuffer, void* userData){
+    IndirectGraphContext *context = (IndirectGraphContext*)userData;
+    recordCullDispatch(commandBuffer, &context->vko->indirectRenderer, context->frame, &context->vko->uniformRings[context->frame]);
+}
+
+static void recordMainGraphPass(VkCommandBuffer commandBuffer, void* userData){
+    IndirectGraphContext *context = (IndirectGraphContext*)userData;
+    VulkanObjects *vko = context->vko;
+    uint32_t frame = context->frame;
+
+    beginSwapchainRenderPass(commandBuffer, vko->graphRenderPass, vko->swapchainFramebuffers[context->swapchainImageIndex], vko->swapchainExtent, VK_SUBPASS_CONTENTS_INLINE);
+    recordIndirectDraws(commandBuffer, &vko->indirectRenderer, frame, vko->swapchainExtent, vko->graphicsPipelineLayout, vko->descriptorSets[frame], &vko->geometryStore);
+    if(!vko->instanceScene.batches.empty()){
+        //Instanced batches are not culled, they go through the regular pipeline after the indirect draw
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, vko->graphicsPipeline);
+        bindInstanceStream(commandBuffer, vko->instanceStreams[frame].buffer);
+        recordInstanceDraws(commandBuffer, vko->graphicsPipelineLayout, vko->descriptorSets[frame], &vko->geometryStore, &vko->instanceScene, vko->uniformRings[frame].objectStride);
+    }
+    vkCmdEndRenderPass(commandBuffer);
+}
+
+void recordCommandBufferIndirect(
+    VulkanObjects *vko,
+    VkCommandBuffer commandBuffer,
+    uint32_t frame,
+    uint32_t swapchainImageIndex
+){
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = 0;
+    beginInfo.pInheritanceInfo = nullptr;
+
+    if(vkBeginCommandBuffer(commandBuffer, &beginInfo)!= VK_SUCCESS){
+        printf("Failed to begin Command Buffer Recording!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    //Host written buffers (uniform ring, instance stream) are visible at submission and need no declaring
+    IndirectGraphContext context = {vko, frame, swapchainImageIndex};
+    const IndirectFrame *indirectFrame = &vko->indirectRenderer.frames[frame];
+    RenderGraph *graph = &vko->renderGraphs[frame];
+    resetRenderGraph(graph);
+
+    uint32_t swapchainImage = importGraphImage(
+        graph, "swapchain", vko->swapchainImages[swapchainImageIndex], VK_IMAGE_ASPECT_COLOR_BIT,
+        VK_IMAGE_LAYOUT_UNDEFINED, vko->targetFinalLayout, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT//The acquire semaphore waits at this stage
+    );
+    uint32_t drawCount = importGraphBuffer(graph, "draw count", indirectFrame->drawCount);
+    uint32_t drawCommands = importGraphBuffer(graph, "draw commands", indirectFrame->drawCommands);
+    uint32_t culledInstances = importGraphBuffer(graph, "culled instances", indirectFrame->instances);
+
+    uint32_t clearPass = addGraphPass(graph, "clear draw count", 0, recordClearGraphPass, &context);
+    graphPassUse(graph, clearPass, drawCount, RENDER_GRAPH_TRANSFER_DST);
+
+    uint32_t cullPass = addGraphPass(graph, "cull", VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, recordCullGraphPass, &context);
+    graphPassUse(graph, cullPass, drawCount, RENDER_GRAPH_STORAGE_WRITE);
+    graphPassUse(graph, cullPass, drawCommands, RENDER_GRAPH_STORAGE_WRITE);
+    graphPassUse(graph, cullPass, culledInstances, RENDER_GRAPH_STORAGE_WRITE);
+
+    uint32_t mainPass = addGraphPass(graph, "main", VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, recordMainGraphPass, &context);
+    graphPassUse(graph, mainPass, drawCommands, RENDER_GRAPH_INDIRECT);
+    graphPassUse(graph, mainPass, drawCount, RENDER_GRAPH_INDIRECT);
+    graphPassUse(graph, mainPass, culledInstances, RENDER_GRAPH_VERTEX);
+    graphPassUse(graph, mainPass, swapchainImage, RENDER_GRAPH_COLOR_ATTACHMENT);
+
+    compileRenderGraph(graph);
+    if(vko->printRenderGraph){
+        printRenderGraph(graph);
+    }
+    uint32_t profilerScope = frameProfilerScope(frame*vko->swapchainImageCount + swapchainImageIndex);
+    gpuProfilerBeginRegion(&vko->gpuProfiler, profilerScope, commandBuffer, "frame");
+    executeRenderGraph(graph, commandBuffer, &vko->gpuProfiler, profilerScope);
+    gpuProfilerEndRegion(&vko->gpuProfiler, profilerScope, commandBuffer);
 
     if(vkEndCommandBuffer(commandBuffer) != VK_SUCCESS){
         printf("Failed to end Command Buffer!\n");
@@ -76,57 +221,154 @@ void recordCommandBuffer(
 void drawFrame(
     VulkanObjects *vko,
     uint32_t currentFrame,
-    WindowObjects *wo,
-    uint32_t indicesCount
+    WindowObjects *wo
 ){
+    frameStatsBegin(&vko->frameStats);
     vkWaitForFences(vko->device, 1, &vko->syncObjects[currentFrame].inFlightFence, VK_TRUE, UINT64_MAX);
+    frameStatsMark(&vko->frameStats, FRAME_STAGE_FENCE_WAIT);
+    defragmenterStep(&vko->defragmenter, currentFrame, &vko->uploadQueue);//This frame's descriptor set is idle now, so moves tied to it can land
+    releaseRetiredSwapchains(vko, currentFrame);
+    frameCaptureCollect(&vko->frameCapture, currentFrame);//Read back framesInFlight frames ago, so this never waits on the GPU
+    for(uint32_t i = 0; i < vko->swapchainImageCount; i++){
+        gpuProfilerCollect(&vko->gpuProfiler, frameProfilerScope(currentFrame*vko->swapchainImageCount + i));//Timestamps from framesInFlight frames ago, already complete
+    }
+    frameStatsMark(&vko->frameStats, FRAME_STAGE_UPDATE);
 
-    uint32_t swapchainImageIndex;
-    VkResult result = vkAcquireNextImageKHR(vko->device, vko->swapchain, UINT64_MAX, vko->syncObjects[currentFrame].imageAvailableSemaphore, VK_NULL_HANDLE, &swapchainImageIndex);
-
-    if(result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || wo->framebufferResized){
+    uint32_t swapchainImageIndex = currentFrame;//Headless targets belong to a frame slot, so the fence above covers them
+    VkResult result = VK_SUCCESS;
+    if(!vko->headless){
+        result = vkAcquireNextImageKHR(vko->device, vko->swapchain, UINT64_MAX, vko->syncObjects[currentFrame].imageAvailableSemaphore, VK_NULL_HANDLE, &swapchainImageIndex);
+    }
+    if(result == VK_ERROR_OUT_OF_DATE_KHR){
+        //Nothing was acquired, so recreate and try once more instead of dropping the frame
         wo->framebufferResized = false;
         recreateSwapchainResources(vko, wo);
+        result = vkAcquireNextImageKHR(vko->device, vko->swapchain, UINT64_MAX, vko->syncObjects[currentFrame].imageAvailableSemaphore, VK_NULL_HANDLE, &swapchainImageIndex);
+    }
+
+    frameStatsMark(&vko->frameStats, FRAME_STAGE_ACQUIRE);
+
+    if(result == VK_ERROR_OUT_OF_DATE_KHR){
+        return;//Still out of date, e.g. while minimised
     }
-    else if (result != VK_SUCCESS){
+    else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR){
         printf("Failed to acquire Next Swapchain Image!\n");
         exit(EXIT_FAILURE);
     }
     else{
         vkResetFences(vko->device, 1, &vko->syncObjects[currentFrame].inFlightFence);//Only reset if we are submitting work
-        vkResetCommandBuffer(vko->commandBuffers[currentFrame], 0);
-
-        updateUniformBuffer(vko->mappedUniformBuffers[currentFrame], vko->swapchainExtent);
-
-        recordCommandBuffer(
-            vko->commandBuffers[currentFrame], 
-            vko->renderPass, 
-            vko->swapchainFramebuffers[swapchainImageIndex], 
-            vko->swapchainExtent, 
-            vko->graphicsPipelineLayout,
-            vko->graphicsPipeline, 
-            vko->descriptorSets[currentFrame],
-            vko->vertexBuffer,
-            vko->indexBuffer,
-            indicesCount
-        );
+
+        bool cpuCulling = vko->cpuCulling && !vko->gpuDriven;
+        if(vko->geometryStore.meshes.size() > vko->uniformRings[currentFrame].objectCapacity){
+            growUniformRing(vko, currentFrame, vko->geometryStore.meshes.size());//Meshes registered at runtime, this slot's fence has signalled
+        }
+        syncObjectScene(&vko->objectScene, vko->geometryStore.meshes.size());
+        animateObjectScene(&vko->objectScene);
+        updateSceneGraph(&vko->objectScene.graph);
+        FrameUniforms frameUniforms = updateUniformBuffer(&vko->uniformRings[currentFrame], vko->swapchainExtent, &vko->objectScene.graph, &vko->geometryStore, cpuCulling ? &vko->cpuCuller.bounds : nullptr);
+        const uint32_t* drawList = nullptr;
+        uint32_t drawCount = vko->geometryStore.meshes.size();
+        if(cpuCulling){
+            FrustumPlanes planes = extractFrustumPlanes(frameUniforms.proj*frameUniforms.view);
+            cullObjects(&vko->cpuCuller, &planes);
+            drawList = vko->cpuCuller.visible;
+            drawCount = vko->cpuCuller.visibleCount;
+        }
+        InstanceStream *instanceStream = &vko->instanceStreams[currentFrame];
+        if(1 + vko->instanceScene.instanceCount > instanceStream->capacity){
+            growInstanceStream(vko->device, &vko->allocator, std::max(1 + vko->instanceScene.instanceCount, 2*instanceStream->capacity), instanceStream);
+            vko->sceneVersion++;//Cached command buffers of this slot bind the old buffer
+        }
+        streamInstances(instanceStream, &vko->instanceScene);
+
+        //The fence wait above means no earlier submission of this frame slot's buffers is still pending
+        uint32_t commandBufferIndex = currentFrame*vko->swapchainImageCount + swapchainImageIndex;
+        VkCommandBuffer commandBuffer = vko->commandBuffers[commandBufferIndex];
+        if(vko->gpuDriven && vko->indirectRenderer.geometryVersion != vko->geometryStore.version){
+            updateIndirectDrawRecords(&vko->indirectRenderer, &vko->uploadQueue, &vko->geometryStore);
+        }
+        uint64_t sceneVersion = currentSceneVersion(vko);
+        frameStatsMark(&vko->frameStats, FRAME_STAGE_UPDATE);
+        uint32_t profilerScope = frameProfilerScope(commandBufferIndex);
+        if(vko->commandBufferVersions[commandBufferIndex] != sceneVersion){
+            vkResetCommandBuffer(commandBuffer, 0);
+            gpuProfilerBeginScope(&vko->gpuProfiler, profilerScope, vko->queueFamilyIndices.graphics);
+            if(vko->gpuDriven){
+                recordCommandBufferIndirect(vko, commandBuffer, currentFrame, swapchainImageIndex);//Same commands whatever the object count, so recording stays cheap
+            }
+            else if(vko->recorder.workerCount > 0 && drawCount >= PARALLEL_RECORD_MIN_DRAWS){
+                RecordJob job{};
+                job.frame = currentFrame;
+                job.image = swapchainImageIndex;
+                job.renderPass = vko->renderPass;
+                job.framebuffer = vko->swapchainFramebuffers[swapchainImageIndex];
+                job.extent = vko->swapchainExtent;
+                job.pipelineLayout = vko->graphicsPipelineLayout;
+                job.pipeline = vko->graphicsPipeline;
+                job.descriptorSet = vko->descriptorSets[currentFrame];
+                job.geometryStore = &vko->geometryStore;
+                job.instanceBuffer = vko->instanceStreams[currentFrame].buffer;
+                job.instanceScene = &vko->instanceScene;
+                job.objectStride = vko->uniformRings[currentFrame].objectStride;
+                job.drawList = drawList;
+                job.drawCount = drawCount;
+                job.profiler = &vko->gpuProfiler;
+                job.profilerScope = profilerScope;
+                recordCommandBufferParallel(&vko->recorder, commandBuffer, &job);
+            }
+            else{
+                recordCommandBuffer(
+                    commandBuffer, 
+                    vko->renderPass, 
+                    vko->swapchainFramebuffers[swapchainImageIndex], 
+                    vko->swapchainExtent, 
+                    vko->graphicsPipelineLayout,
+                    vko->graphicsPipeline, 
+                    vko->descriptorSets[currentFrame],
+                    &vko->geometryStore,
+                    vko->instanceStreams[currentFrame].buffer,
+                    &vko->instanceScene,
+                    vko->uniformRings[currentFrame].objectStride,
+                    drawList,
+                    drawCount,
+                    &vko->gpuProfiler,
+                    profilerScope
+                );
+            }
+            vko->commandBufferVersions[commandBufferIndex] = sceneVersion;
+        }
+        frameStatsMark(&vko->frameStats, FRAME_STAGE_RECORD);
+
+        uploadQueueFlush(&vko->uploadQueue);//Uploads queued since the last frame land before this frame's draws
 
         VkSubmitInfo submitInfo{};
         submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        submitInfo.waitSemaphoreCount = 1;
+        submitInfo.waitSemaphoreCount = vko->headless ? 0 : 1;
         submitInfo.pWaitSemaphores = &vko->syncObjects[currentFrame].imageAvailableSemaphore;
         VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
         submitInfo.pWaitDstStageMask = waitStages;
         //Each entry in the waitStages array corresponds to the semaphore with the same index in pWaitSemaphores.
-        submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &vko->commandBuffers[currentFrame];
-        submitInfo.signalSemaphoreCount = 1;
+        //The capture copy goes last, so it sees the finished frame and the present waits for it too
+        VkCommandBuffer submitCommandBuffers[2] = {
+            commandBuffer,
+            frameCaptureRecord(&vko->frameCapture, currentFrame, vko->swapchainImages[swapchainImageIndex], vko->targetFinalLayout, vko->swapchainExtent)
+        };
+        submitInfo.commandBufferCount = submitCommandBuffers[1] == VK_NULL_HANDLE ? 1 : 2;
+        submitInfo.pCommandBuffers = submitCommandBuffers;
+        submitInfo.signalSemaphoreCount = vko->headless ? 0 : 1;
         submitInfo.pSignalSemaphores = &vko->syncObjects[currentFrame].renderFinishedSemaphore;
 
         if (vkQueueSubmit(vko->graphicsQueue, 1, &submitInfo, vko->syncObjects[currentFrame].inFlightFence) != VK_SUCCESS) {
             printf("Failed to submit to Graphics Queue!\n");
             exit(EXIT_FAILURE);
         }
+        gpuProfilerSubmitted(&vko->gpuProfiler, profilerScope);
+        frameStatsMark(&vko->frameStats, FRAME_STAGE_SUBMIT);
+
+        if(vko->headless){
+            frameStatsEnd(&vko->frameStats);
+            return;
+        }
 
         VkPresentInfoKHR presentInfo{};
         presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -136,6 +378,29 @@ void drawFrame(
         presentInfo.pSwapchains = &vko->swapchain;
         presentInfo.pImageIndices = &swapchainImageIndex;
 
-        vkQueuePresentKHR(vko->graphicsQueue, &presentInfo);
+        uint64_t presentId = frameStatsPresentId(&vko->frameStats, vko->swapchain);
+        VkPresentIdKHR presentIdInfo{};
+        if(presentId != 0){
+            presentIdInfo.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR;
+            presentIdInfo.swapchainCount = 1;
+            presentIdInfo.pPresentIds = &presentId;
+            presentInfo.pNext = &presentIdInfo;
+        }
+
+        //A suboptimal image was acquired and its semaphore waited on, so it is presented before recreating
+        {
+            std::lock_guard<std::mutex> lock(vko->frameStats.presentMutex);
+            result = vkQueuePresentKHR(vko->graphicsQueue, &presentInfo);
+        }
+        frameStatsMark(&vko->frameStats, FRAME_STAGE_PRESENT);
+        frameStatsEnd(&vko->frameStats);
+        if(result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || wo->framebufferResized){
+            wo->framebufferResized = false;
+            recreateSwapchainResources(vko, wo);
+        }
+        else if(result != VK_SUCCESS){
+            printf("Failed to present Swapchain Image!\n");
+            exit(EXIT_FAILURE);
+        }
     }
 }
\ No newline at end of file
@@ -4,6 +4,32 @@
 #include <vulkan/vulkan.h>
 #include "window.h"
 #include "vk.h"
+#include "geometry.h"
+#include "instance.h"
+
+void beginSwapchainRenderPass(
+    VkCommandBuffer commandBuffer,
+    VkRenderPass renderPass,
+    VkFramebuffer swapChainFramebuffer,
+    VkExtent2D swapChainExtent,
+    VkSubpassContents contents
+);
+
+vec4 objectTint(uint32_t objectIndex);
+
+void recordMeshDraws(
+    VkCommandBuffer commandBuffer,
+    VkExtent2D swapChainExtent,
+    VkPipelineLayout graphicsPipelineLayout,
+    VkPipeline graphicsPipeline,
+    const VkDescriptorSet descriptorSet,
+    const GeometryStore *geometryStore,
+    VkBuffer instanceBuffer,
+    VkDeviceSize objectStride,
+    const uint32_t* drawList,//Object indices to draw, every mesh in order when null
+    uint32_t firstDraw,
+    uint32_t drawCount
+);
 
 void recordCommandBuffer(
     VkCommandBuffer commandBuffer, 
@@ -13,14 +39,26 @@ void recordCommandBuffer(
     VkPipelineLayout graphicsPipelineLayout,
     VkPipeline graphicsPipeline,
     const VkDescriptorSet descriptorSet,
-    VkBuffer vertexBuffer,
-    VkBuffer indexBuffer,
-    uint32_t indicesCount
+    const GeometryStore *geometryStore,
+    VkBuffer instanceBuffer,
+    const InstanceScene *instanceScene,
+    VkDeviceSize objectStride,
+    const uint32_t* drawList,
+    uint32_t drawCount,
+    GpuProfiler *profiler,
+    uint32_t profilerScope
+);
+
+//GPU-driven variant: a render graph of the cull dispatch and the render pass, then one indirect draw for every mesh
+void recordCommandBufferIndirect(
+    VulkanObjects *vko,
+    VkCommandBuffer commandBuffer,
+    uint32_t frame,
+    uint32_t swapchainImageIndex
 );
 
 void drawFrame(
     VulkanObjects *vko,
     uint32_t currentFrame,
-    WindowObjects *wo,
-    uint32_t indicesCount
+    WindowObjects *wo
 );
\ No newline at end of file
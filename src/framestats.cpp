@@ -0,0 +1,336 @@
+#include "framestats.h"
+#include <cstdio>
+#include <cinttypes>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+
+static const char* metricNames[FRAME_METRIC_COUNT] = {
+    "fence_wait", "acquire", "update", "record", "submit", "present", "cpu_frame", "present_latency", "input_to_photon"
+};
+
+static double now(){
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint32_t bucketIndex(double ms){
+    uint64_t us = ms > 0.0 ? (uint64_t)(ms*1000.0) : 0;
+    if(us < HISTOGRAM_LINEAR_BUCKETS){
+        return us;
+    }
+    //Keep the top bits of the value, like a float with a 9 bit mantissa
+    uint32_t shift = 63 - __builtin_clzll(us) - 9;
+    uint32_t index = HISTOGRAM_LINEAR_BUCKETS + (shift - 1)*HISTOGRAM_SUB_BUCKETS + (uint32_t)((us >> shift) - HISTOGRAM_SUB_BUCKETS);
+    return index < HISTOGRAM_BUCKETS ? index : HISTOGRAM_BUCKETS - 1;
+}
+
+static double bucketValue(uint32_t index){
+    if(index < HISTOGRAM_LINEAR_BUCKETS){
+        return (index + 0.5)/1000.0;
+    }
+    uint32_t shift = (index - HISTOGRAM_LINEAR_BUCKETS)/HISTOGRAM_SUB_BUCKETS + 1;
+    uint64_t lower = (uint64_t)(HISTOGRAM_SUB_BUCKETS + (index - HISTOGRAM_LINEAR_BUCKETS)%HISTOGRAM_SUB_BUCKETS) << shift;
+    return (lower + (1ull << shift)/2.0)/1000.0;
+}
+
+static void histogramAdd(LatencyHistogram *histogram, double ms){
+    histogram->counts[bucketIndex(ms)]++;
+    histogram->total++;
+    histogram->sum += ms;
+    if(ms > histogram->max){
+        histogram->max = ms;
+    }
+}
+
+static double histogramPercentile(const LatencyHistogram *histogram, double percentile){
+    if(histogram->total == 0){
+        return 0.0;
+    }
+    uint64_t rank = (uint64_t)ceil(percentile*histogram->total);
+    uint64_t seen = 0;
+    for(uint32_t i = 0; i < HISTOGRAM_BUCKETS; i++){
+        seen += histogram->counts[i];
+        if(seen >= rank && seen > 0){
+            return std::min(bucketValue(i), histogram->max);
+        }
+    }
+    return histogram->max;
+}
+
+static void printHistograms(const char* title, const LatencyHistogram histograms[], uint64_t dropped){
+    printf("%s: %" PRIu64 " frames", title, histograms[FRAME_METRIC_CPU_FRAME].total);
+    if(dropped > 0){
+        printf(", %" PRIu64 " samples dropped", dropped);
+    }
+    printf("\n  %-16s %9s %9s %9s %9s %9s (ms)\n", "", "mean", "p50", "p95", "p99", "max");
+    for(uint32_t m = 0; m < FRAME_METRIC_COUNT; m++){
+        const LatencyHistogram *histogram = &histograms[m];
+        if(histogram->total == 0){
+            continue;
+        }
+        printf(
+            "  %-16s %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+            metricNames[m],
+            histogram->sum/histogram->total,
+            histogramPercentile(histogram, 0.50),
+            histogramPercentile(histogram, 0.95),
+            histogramPercentile(histogram, 0.99),
+            histogram->max
+        );
+    }
+}
+
+static bool ringPop(FrameStatsRing *ring, FrameSample *sample){
+    uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+    if(tail == ring->head.load(std::memory_order_acquire)){
+        return false;
+    }
+    *sample = ring->samples[tail % FRAME_STATS_RING_SIZE];
+    ring->tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+static bool ringPush(FrameStatsRing *ring, const FrameSample *sample){
+    uint32_t head = ring->head.load(std::memory_order_relaxed);
+    if(head - ring->tail.load(std::memory_order_acquire) == FRAME_STATS_RING_SIZE){
+        return false;
+    }
+    ring->samples[head % FRAME_STATS_RING_SIZE] = *sample;
+    ring->head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+//vkWaitForPresentKHR needs the swapchain externally synchronised against presents, so presentMutex has to be held across the call.
+//It is only polled with a zero timeout and the lock only tried, so the render thread's present waits for at most one non-blocking call.
+static double waitForPresentCompletion(FrameStats *stats, const FrameSample *sample){
+    while(true){
+        VkResult result = VK_TIMEOUT;
+        {
+            std::unique_lock<std::mutex> lock(stats->presentMutex, std::try_to_lock);
+            if(lock.owns_lock()){
+                if(sample->swapchain != stats->swapchain){
+                    return NAN;//Retired, it may be destroyed any moment
+                }
+                result = stats->waitForPresent(stats->device, sample->swapchain, sample->presentId, 0);
+            }
+        }
+        if(result == VK_SUCCESS){
+            return now();
+        }
+        if(result != VK_TIMEOUT || stats->stop.load() || now() - sample->presentTime > FRAME_STATS_PRESENT_TIMEOUT){
+            return NAN;
+        }
+        std::this_thread::sleep_for(std::chrono::duration<double>(FRAME_STATS_POLL_INTERVAL));
+    }
+}
+
+static void recordSample(FrameStats *stats, const FrameSample *sample){
+    FrameRow row{};
+    row.frame = sample->frame;
+    double cpuFrame = 0.0;
+    for(uint32_t s = 0; s < FRAME_STAGE_COUNT; s++){
+        row.metricMs[s] = sample->stageMs[s];
+        cpuFrame += sample->stageMs[s];
+    }
+    row.metricMs[FRAME_METRIC_CPU_FRAME] = cpuFrame;
+    row.metricMs[FRAME_METRIC_PRESENT_LATENCY] = NAN;
+    row.metricMs[FRAME_METRIC_INPUT_TO_PHOTON] = NAN;
+
+    if(sample->presentId != 0){
+        double completed = waitForPresentCompletion(stats, sample);
+        if(!std::isnan(completed)){
+            row.metricMs[FRAME_METRIC_PRESENT_LATENCY] = (completed - sample->presentTime)*1000.0;
+            row.metricMs[FRAME_METRIC_INPUT_TO_PHOTON] = (completed - sample->inputTime)*1000.0;
+        }
+    }
+
+    for(uint32_t m = 0; m < FRAME_METRIC_COUNT; m++){
+        if(!std::isnan(row.metricMs[m])){
+            histogramAdd(&stats->intervalHistograms[m], row.metricMs[m]);
+            histogramAdd(&stats->totalHistograms[m], row.metricMs[m]);
+        }
+    }
+    if(stats->rows.size() < FRAME_STATS_MAX_ROWS){
+        stats->rows.push_back(row);
+    }
+}
+
+static void statsThread(FrameStats *stats){
+    FrameSample sample;
+    while(true){
+        if(ringPop(stats->ring, &sample)){
+            recordSample(stats, &sample);
+        }
+        else if(stats->stop.load()){
+            break;
+        }
+        else{
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        if(stats->reportInterval > 0.0 && now() - stats->lastReport >= stats->reportInterval){
+            printHistograms("Frame stats", stats->intervalHistograms, stats->droppedSamples.load());
+            memset(stats->intervalHistograms, 0, sizeof(LatencyHistogram)*FRAME_METRIC_COUNT);
+            stats->lastReport = now();
+        }
+    }
+}
+
+void createFrameStats(
+    VkDevice device,
+    bool presentWaitSupported,
+    double reportInterval,
+    const char* csvPath,
+    const char* jsonPath,
+    FrameStats *stats
+){
+    stats->device = device;
+    stats->waitForPresent = nullptr;
+    if(presentWaitSupported){
+        stats->waitForPresent = (PFN_vkWaitForPresentKHR)vkGetDeviceProcAddr(device, "vkWaitForPresentKHR");
+    }
+    stats->swapchain = VK_NULL_HANDLE;
+    stats->nextPresentId = 1;
+
+    stats->ring = new FrameStatsRing;
+    stats->ring->head.store(0);
+    stats->ring->tail.store(0);
+    stats->droppedSamples.store(0);
+    stats->stop.store(false);
+
+    stats->current = FrameSample{};
+    stats->stageStart = 0.0;
+    stats->inputTime = now();
+    stats->frameCount = 0;
+
+    stats->reportInterval = reportInterval;
+    stats->lastReport = now();
+    stats->intervalHistograms = (LatencyHistogram*)calloc(FRAME_METRIC_COUNT, sizeof(LatencyHistogram));
+    stats->totalHistograms = (LatencyHistogram*)calloc(FRAME_METRIC_COUNT, sizeof(LatencyHistogram));
+    stats->rows.clear();
+    stats->csvPath = csvPath;
+    stats->jsonPath = jsonPath;
+
+    stats->thread = std::thread(statsThread, stats);
+}
+
+static void writeCsv(const FrameStats *stats){
+    FILE* file = fopen(stats->csvPath, "w");
+    if(file == nullptr){
+        printf("Failed to open %s for writing!\n", stats->csvPath);
+        return;
+    }
+    fprintf(file, "frame");
+    for(uint32_t m = 0; m < FRAME_METRIC_COUNT; m++){
+        fprintf(file, ",%s_ms", metricNames[m]);
+    }
+    fprintf(file, "\n");
+    for(const FrameRow &row : stats->rows){
+        fprintf(file, "%" PRIu64, row.frame);
+        for(uint32_t m = 0; m < FRAME_METRIC_COUNT; m++){
+            if(std::isnan(row.metricMs[m])){
+                fprintf(file, ",");
+            }
+            else{
+                fprintf(file, ",%.4f", row.metricMs[m]);
+            }
+        }
+        fprintf(file, "\n");
+    }
+    fclose(file);
+    printf("Wrote %zu frames to %s\n", stats->rows.size(), stats->csvPath);
+}
+
+static void writeJson(const FrameStats *stats){
+    FILE* file = fopen(stats->jsonPath, "w");
+    if(file == nullptr){
+        printf("Failed to open %s for writing!\n", stats->jsonPath);
+        return;
+    }
+    fprintf(file, "{\n  \"frames\": %" PRIu64 ",\n", stats->totalHistograms[FRAME_METRIC_CPU_FRAME].total);
+    fprintf(file, "  \"dropped_samples\": %" PRIu64 ",\n", stats->droppedSamples.load());
+    fprintf(file, "  \"present_wait\": %s,\n", stats->waitForPresent != nullptr ? "true" : "false");
+    fprintf(file, "  \"metrics_ms\": {");
+    bool first = true;
+    for(uint32_t m = 0; m < FRAME_METRIC_COUNT; m++){
+        const LatencyHistogram *histogram = &stats->totalHistograms[m];
+        if(histogram->total == 0){
+            continue;
+        }
+        fprintf(
+            file,
+            "%s\n    \"%s\": {\"count\": %" PRIu64 ", \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f}",
+            first ? "" : ",",
+            metricNames[m],
+            histogram->total,
+            histogram->sum/histogram->total,
+            histogramPercentile(histogram, 0.50),
+            histogramPercentile(histogram, 0.95),
+            histogramPercentile(histogram, 0.99),
+            histogram->max
+        );
+        first = false;
+    }
+    fprintf(file, "\n  }\n}\n");
+    fclose(file);
+    printf("Wrote frame stats summary to %s\n", stats->jsonPath);
+}
+
+void destroyFrameStats(FrameStats *stats){
+    stats->stop.store(true);
+    stats->thread.join();
+
+    printHistograms("Frame stats totals", stats->totalHistograms, stats->droppedSamples.load());
+    if(stats->csvPath != nullptr){
+        writeCsv(stats);
+    }
+    if(stats->jsonPath != nullptr){
+        writeJson(stats);
+    }
+
+    delete stats->ring;
+    free(stats->intervalHistograms);
+    free(stats->totalHistograms);
+    stats->rows.clear();
+    stats->rows.shrink_to_fit();
+}
+
+void frameStatsSetSwapchain(FrameStats *stats, VkSwapchainKHR swapchain){
+    std::lock_guard<std::mutex> lock(stats->presentMutex);
+    stats->swapchain = swapchain;
+}
+
+void frameStatsMarkInput(FrameStats *stats){
+    stats->inputTime = now();
+}
+
+void frameStatsBegin(FrameStats *stats){
+    stats->current = FrameSample{};
+    stats->current.frame = stats->frameCount++;
+    stats->current.inputTime = stats->inputTime;
+    stats->stageStart = now();
+}
+
+void frameStatsMark(FrameStats *stats, FrameStage stage){
+    double time = now();
+    stats->current.stageMs[stage] += (time - stats->stageStart)*1000.0;
+    stats->stageStart = time;
+}
+
+uint64_t frameStatsPresentId(FrameStats *stats, VkSwapchainKHR swapchain){
+    if(stats->waitForPresent == nullptr){
+        return 0;
+    }
+    stats->current.presentId = stats->nextPresentId++;
+    stats->current.swapchain = swapchain;
+    return stats->current.presentId;
+}
+
+void frameStatsEnd(FrameStats *stats){
+    stats->current.presentTime = stats->stageStart;
+    if(!ringPush(stats->ring, &stats->current)){
+        stats->droppedSamples.fetch_add(1, std::memory_order_relaxed);
+    }
+}
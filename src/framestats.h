@@ -0,0 +1,111 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define FRAME_STATS_RING_SIZE 1024//Power of two, frames the stats thread may fall behind before samples are dropped
+#define FRAME_STATS_DEFAULT_INTERVAL 10.0//Seconds between printed summaries
+#define FRAME_STATS_MAX_ROWS (1u << 20)//Per-frame rows kept for the CSV dump
+#define FRAME_STATS_PRESENT_TIMEOUT 1.0//Seconds to wait for a present to complete before giving up on it
+#define FRAME_STATS_POLL_INTERVAL 0.00025//Present completion is polled, so its timing is this coarse
+#define HISTOGRAM_LINEAR_BUCKETS 1024//1us buckets below this many microseconds
+#define HISTOGRAM_SUB_BUCKETS 512//Buckets per power of two above that, about 0.2% precision
+#define HISTOGRAM_BUCKETS (HISTOGRAM_LINEAR_BUCKETS + 17*HISTOGRAM_SUB_BUCKETS)//Up to about 67 seconds
+
+//CPU side stages of drawFrame, in order
+enum FrameStage{
+    FRAME_STAGE_FENCE_WAIT,
+    FRAME_STAGE_ACQUIRE,
+    FRAME_STAGE_UPDATE,//Scene graph, uniforms, instance stream and culling
+    FRAME_STAGE_RECORD,
+    FRAME_STAGE_SUBMIT,
+    FRAME_STAGE_PRESENT,
+    FRAME_STAGE_COUNT
+};
+
+enum FrameMetric{
+    FRAME_METRIC_CPU_FRAME = FRAME_STAGE_COUNT,//Sum of the stages
+    FRAME_METRIC_PRESENT_LATENCY,//vkQueuePresentKHR returning to the image being displayed
+    FRAME_METRIC_INPUT_TO_PHOTON,//Last input poll before the frame to the image being displayed
+    FRAME_METRIC_COUNT
+};
+
+struct FrameSample{
+    uint64_t frame;
+    double stageMs[FRAME_STAGE_COUNT];
+    double inputTime;//Seconds on the steady clock
+    double presentTime;
+    uint64_t presentId;//0 without present wait
+    VkSwapchainKHR swapchain;
+};
+
+//Single producer (the render thread) and single consumer (the stats thread), neither ever blocks
+struct FrameStatsRing{
+    FrameSample samples[FRAME_STATS_RING_SIZE];
+    alignas(64) std::atomic<uint32_t> head;//Next slot the producer writes
+    alignas(64) std::atomic<uint32_t> tail;//Next slot the consumer reads
+};
+
+struct LatencyHistogram{
+    uint32_t counts[HISTOGRAM_BUCKETS];
+    uint64_t total;
+    double sum;
+    double max;
+};
+
+struct FrameRow{
+    uint64_t frame;
+    float metricMs[FRAME_METRIC_COUNT];//NaN when unknown
+};
+
+struct FrameStats{
+    VkDevice device;
+    PFN_vkWaitForPresentKHR waitForPresent;//Null without VK_KHR_present_wait
+    std::mutex presentMutex;//vkQueuePresentKHR and vkWaitForPresentKHR both need the swapchain to themselves
+    VkSwapchainKHR swapchain;//Only presents to this one are waited on, guarded by presentMutex
+    uint64_t nextPresentId;
+
+    FrameStatsRing *ring;
+    std::atomic<uint64_t> droppedSamples;
+    std::thread thread;
+    std::atomic<bool> stop;
+
+    //Render thread only
+    FrameSample current;
+    double stageStart;
+    double inputTime;
+    uint64_t frameCount;
+
+    //Stats thread only until it has been joined
+    double reportInterval;//0 disables periodic printing
+    double lastReport;
+    LatencyHistogram *intervalHistograms;
+    LatencyHistogram *totalHistograms;
+    std::vector<FrameRow> rows;
+    const char* csvPath;
+    const char* jsonPath;
+};
+
+void createFrameStats(
+    VkDevice device,
+    bool presentWaitSupported,
+    double reportInterval,
+    const char* csvPath,
+    const char* jsonPath,
+    FrameStats *stats
+);
+
+//Joins the stats thread, prints the totals and writes the CSV and JSON files
+void destroyFrameStats(FrameStats *stats);
+
+void frameStatsSetSwapchain(FrameStats *stats, VkSwapchainKHR swapchain);
+void frameStatsMarkInput(FrameStats *stats);
+
+void frameStatsBegin(FrameStats *stats);
+//Time since the previous mark goes to stage
+void frameStatsMark(FrameStats *stats, FrameStage stage);
+//Id to chain into the present through VkPresentIdKHR, 0 when present wait is off
+uint64_t frameStatsPresentId(FrameStats *stats, VkSwapchainKHR swapchain);
+void frameStatsEnd(FrameStats *stats);
@@ -0,0 +1,134 @@
+#include "geometry.h"
+#include <cstdio>
+#include <cstdlib>
+#include "vk.h"
+
+void createGeometryStore(
+    VkDevice device,
+    DeviceAllocator *allocator,
+    uint32_t vertexCapacity,
+    uint32_t indexCapacity,
+    GeometryStore *store
+){
+    createBuffer(
+        device,
+        allocator,
+        GEOMETRY_VERTEX_BUFFER_USAGE,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        deviceLocalPreferredFlags(allocator),
+        sizeof(Vertex)*(VkDeviceSize)vertexCapacity,
+        &store->vertexBuffer,
+        &store->vertexBufferAllocation
+    );
+    createBuffer(
+        device,
+        allocator,
+        GEOMETRY_INDEX_BUFFER_USAGE,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        deviceLocalPreferredFlags(allocator),
+        sizeof(uint32_t)*(VkDeviceSize)indexCapacity,
+        &store->indexBuffer,
+        &store->indexBufferAllocation
+    );
+    store->vertexCapacity = vertexCapacity;
+    store->vertexCount = 0;
+    store->indexCapacity = indexCapacity;
+    store->indexCount = 0;
+    store->meshes.clear();
+    store->version = 0;
+}
+
+void destroyGeometryStore(VkDevice device, DeviceAllocator *allocator, GeometryStore *store){
+    destroyBuffer(device, allocator, store->vertexBuffer, &store->vertexBufferAllocation);
+    destroyBuffer(device, allocator, store->indexBuffer, &store->indexBufferAllocation);
+    store->meshes.clear();
+}
+
+uint32_t registerMesh(
+    GeometryStore *store,
+    UploadQueue *uploadQueue,
+    const Vertex* vertices,
+    uint32_t verticesCount,
+    const uint32_t* indices,
+    uint32_t indicesCount
+){
+    if(store->vertexCount + verticesCount > store->vertexCapacity || store->indexCount + indicesCount > store->indexCapacity){
+        printf("Geometry Store is full, cannot register a Mesh with %u vertices and %u indices!\n", verticesCount, indicesCount);
+        exit(EXIT_FAILURE);
+    }
+
+    MeshRecord mesh{};
+    mesh.vertexOffset = (int32_t)store->vertexCount;
+    mesh.firstIndex = store->indexCount;
+    mesh.indexCount = indicesCount;
+
+    vec2 boundsMin = vertices[0].pos;
+    vec2 boundsMax = vertices[0].pos;
+    for(uint32_t i = 1; i < verticesCount; i++){
+        boundsMin = glm::min(boundsMin, vertices[i].pos);
+        boundsMax = glm::max(boundsMax, vertices[i].pos);
+    }
+    vec2 center = (boundsMin + boundsMax)*0.5f;
+    float radius = 0.0f;
+    for(uint32_t i = 0; i < verticesCount; i++){
+        radius = glm::max(radius, glm::length(vertices[i].pos - center));
+    }
+    mesh.boundingSphere = vec4(center, 0.0f, radius);
+
+    //Indices stay relative to the mesh, vertexOffset rebases them at draw time. Meshes are appended, so no frame reads these ranges yet.
+    writeBufferData(
+        uploadQueue,
+        store->vertexBuffer,
+        &store->vertexBufferAllocation,
+        sizeof(Vertex)*(VkDeviceSize)store->vertexCount,
+        vertices,
+        sizeof(Vertex)*(VkDeviceSize)verticesCount,
+        true
+    );
+    mesh.uploadToken = writeBufferData(
+        uploadQueue,
+        store->indexBuffer,
+        &store->indexBufferAllocation,
+        sizeof(uint32_t)*(VkDeviceSize)store->indexCount,
+        indices,
+        sizeof(uint32_t)*(VkDeviceSize)indicesCount,
+        true
+    );
+
+    store->vertexCount += verticesCount;
+    store->indexCount += indicesCount;
+    store->meshes.push_back(mesh);
+    store->version++;
+    return store->meshes.size() - 1;
+}
+
+VkDeviceSize usedVertexBytes(const void* store){
+    return sizeof(Vertex)*(VkDeviceSize)((const GeometryStore*)store)->vertexCount;
+}
+
+VkDeviceSize usedIndexBytes(const void* store){
+    return sizeof(uint32_t)*(VkDeviceSize)((const GeometryStore*)store)->indexCount;
+}
+
+void bindGeometryStore(VkCommandBuffer commandBuffer, const GeometryStore *store){
+    VkBuffer vertexBuffers[] = {store->vertexBuffer};
+    VkDeviceSize offsets[] = {0};
+    vkCmdBindVertexBuffers(commandBuffer, VERTEX_BINDING, 1, vertexBuffers, offsets);
+    vkCmdBindIndexBuffer(commandBuffer, store->indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+}
+
+void drawMesh(VkCommandBuffer commandBuffer, const GeometryStore *store, uint32_t meshId){
+    const MeshRecord *mesh = &store->meshes[meshId];
+    vkCmdDrawIndexed(commandBuffer, mesh->indexCount, 1, mesh->firstIndex, mesh->vertexOffset, 0);//Instance 0 is the identity instance
+}
+
+void drawMeshInstanced(
+    VkCommandBuffer commandBuffer,
+    const GeometryStore *store,
+    uint32_t meshId,
+    uint32_t firstInstance,
+    uint32_t instanceCount
+){
+    const MeshRecord *mesh = &store->meshes[meshId];
+    vkCmdDrawIndexed(commandBuffer, mesh->indexCount, instanceCount, mesh->firstIndex, mesh->vertexOffset, firstInstance);
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include "allocator.h"
+#include "upload.h"
+#include "vertex.h"
+
+#define DEFAULT_GEOMETRY_VERTEX_CAPACITY (1024*1024)
+#define DEFAULT_GEOMETRY_INDEX_CAPACITY (4*1024*1024)
+#define GEOMETRY_VERTEX_BUFFER_USAGE (VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT)
+#define GEOMETRY_INDEX_BUFFER_USAGE (VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT)
+
+//Where a mesh lives inside the shared buffers, in the form vkCmdDrawIndexed wants it
+struct MeshRecord{
+    int32_t vertexOffset;
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    vec4 boundingSphere;//Centre in xyz and radius in w, in the mesh's own space
+    UploadToken uploadToken;//Complete before the mesh is first drawn
+};
+
+//One vertex buffer and one index buffer that every mesh is sub-allocated from, so drawing needs a single bind
+struct GeometryStore{
+    VkBuffer vertexBuffer;
+    Allocation vertexBufferAllocation;
+    uint32_t vertexCapacity;
+    uint32_t vertexCount;
+    VkBuffer indexBuffer;
+    Allocation indexBufferAllocation;
+    uint32_t indexCapacity;
+    uint32_t indexCount;
+    std::vector<MeshRecord> meshes;//Indexed by the id registerMesh returns
+    uint64_t version;//Bumped by every registerMesh so cached draws know to re-record
+};
+
+void createGeometryStore(
+    VkDevice device,
+    DeviceAllocator *allocator,
+    uint32_t vertexCapacity,
+    uint32_t indexCapacity,
+    GeometryStore *store
+);
+
+void destroyGeometryStore(VkDevice device, DeviceAllocator *allocator, GeometryStore *store);
+
+uint32_t registerMesh(
+    GeometryStore *store,
+    UploadQueue *uploadQueue,
+    const Vertex* vertices,
+    uint32_t verticesCount,
+    const uint32_t* indices,
+    uint32_t indicesCount
+);
+
+//Bytes of the shared buffers that hold registered meshes, store is a GeometryStore. Used by the defragmenter.
+VkDeviceSize usedVertexBytes(const void* store);
+VkDeviceSize usedIndexBytes(const void* store);
+
+void bindGeometryStore(VkCommandBuffer commandBuffer, const GeometryStore *store);
+void drawMesh(VkCommandBuffer commandBuffer, const GeometryStore *store, uint32_t meshId);
+
+//Draws instanceCount copies of a mesh in one call, reading per-instance data from the bound instance stream
+void drawMeshInstanced(
+    VkCommandBuffer commandBuffer,
+    const GeometryStore *store,
+    uint32_t meshId,
+    uint32_t firstInstance,
+    uint32_t instanceCount
+);
@@ -0,0 +1,250 @@
+#include "gpuprofiler.h"
+#include <cstdio>
+#include <cinttypes>
+#include <cstdlib>
+#include <cstring>
+#include <cfloat>
+
+void createGpuProfiler(VkPhysicalDevice physicalDevice, VkDevice device, bool hostQueryReset, GpuProfiler *profiler){
+    profiler->device = device;
+    profiler->queryPool = VK_NULL_HANDLE;
+    profiler->scopeCount = 0;
+    profiler->scopes = nullptr;
+    profiler->regions.clear();
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    profiler->timestampPeriod = properties.limits.timestampPeriod;
+
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+    profiler->timestampValidBits.resize(familyCount);
+    bool anyTimestamps = false;
+    for(uint32_t i = 0; i < familyCount; i++){
+        profiler->timestampValidBits[i] = families[i].timestampValidBits;
+        anyTimestamps = anyTimestamps || families[i].timestampValidBits > 0;
+    }
+
+    profiler->enabled = hostQueryReset && anyTimestamps && profiler->timestampPeriod > 0.0;
+    if(!profiler->enabled){
+        printf("GPU profiling is unavailable, the device lacks %s.\n", hostQueryReset ? "timestamp queries" : "host query reset");
+    }
+}
+
+void destroyGpuProfiler(GpuProfiler *profiler){
+    destroyGpuProfilerScopes(profiler);
+    profiler->regions.clear();
+    profiler->enabled = false;
+}
+
+void createGpuProfilerScopes(GpuProfiler *profiler, uint32_t scopeCount){
+    if(!profiler->enabled){
+        return;
+    }
+    uint32_t queriesPerScope = 2*GPU_PROFILER_MAX_REGIONS;
+
+    VkQueryPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    poolInfo.queryCount = scopeCount*queriesPerScope;
+
+    if(vkCreateQueryPool(profiler->device, &poolInfo, nullptr, &profiler->queryPool) != VK_SUCCESS){
+        printf("Failed to create Timestamp Query Pool!\n");
+        exit(EXIT_FAILURE);
+    }
+    vkResetQueryPool(profiler->device, profiler->queryPool, 0, poolInfo.queryCount);
+
+    profiler->scopeCount = scopeCount;
+    profiler->scopes = new GpuProfilerScope[scopeCount];
+    for(uint32_t i = 0; i < scopeCount; i++){
+        profiler->scopes[i].firstQuery = i*queriesPerScope;
+        profiler->scopes[i].timestampMask = 0;
+        profiler->scopes[i].pending = false;
+    }
+}
+
+void destroyGpuProfilerScopes(GpuProfiler *profiler){
+    if(profiler->queryPool != VK_NULL_HANDLE){
+        vkDestroyQueryPool(profiler->device, profiler->queryPool, nullptr);
+        profiler->queryPool = VK_NULL_HANDLE;
+    }
+    delete[] profiler->scopes;
+    profiler->scopes = nullptr;
+    profiler->scopeCount = 0;
+}
+
+//Null when profiling is off, so callers can pass a null profiler too
+static GpuProfilerScope* activeScope(GpuProfiler *profiler, uint32_t scope){
+    if(profiler == nullptr || !profiler->enabled || scope >= profiler->scopeCount){
+        return nullptr;
+    }
+    return &profiler->scopes[scope];
+}
+
+static uint32_t findOrAddRegion(GpuProfiler *profiler, const char* name){
+    for(uint32_t i = 0; i < profiler->regions.size(); i++){
+        if(strcmp(profiler->regions[i].name, name) == 0){
+            return i;
+        }
+    }
+    GpuRegionStats region{};
+    region.name = name;
+    region.minMs = DBL_MAX;
+    profiler->regions.push_back(region);
+    return profiler->regions.size() - 1;
+}
+
+void gpuProfilerBeginScope(GpuProfiler *profiler, uint32_t scope, uint32_t queueFamilyIndex){
+    GpuProfilerScope *profilerScope = activeScope(profiler, scope);
+    if(profilerScope == nullptr){
+        return;
+    }
+    uint32_t validBits = profiler->timestampValidBits[queueFamilyIndex];
+    profilerScope->timestampMask = validBits >= 64 ? UINT64_MAX : (1ull << validBits) - 1;
+    profilerScope->uses.clear();
+    profilerScope->openUses.clear();
+}
+
+void gpuProfilerBeginRegion(GpuProfiler *profiler, uint32_t scope, VkCommandBuffer commandBuffer, const char* name){
+    GpuProfilerScope *profilerScope = activeScope(profiler, scope);
+    if(profilerScope == nullptr){
+        return;
+    }
+    if(profilerScope->timestampMask == 0 || profilerScope->uses.size() == GPU_PROFILER_MAX_REGIONS){
+        profilerScope->openUses.push_back(UINT32_MAX);//Still pushed so the matching end pops it
+        return;
+    }
+    GpuRegionUse use{};
+    use.region = findOrAddRegion(profiler, name);
+    use.query = profilerScope->firstQuery + 2*profilerScope->uses.size();
+    use.ended = false;
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, profiler->queryPool, use.query);
+    profilerScope->openUses.push_back(profilerScope->uses.size());
+    profilerScope->uses.push_back(use);
+}
+
+void gpuProfilerEndRegion(GpuProfiler *profiler, uint32_t scope, VkCommandBuffer commandBuffer){
+    GpuProfilerScope *profilerScope = activeScope(profiler, scope);
+    if(profilerScope == nullptr || profilerScope->openUses.empty()){
+        return;
+    }
+    uint32_t useIndex = profilerScope->openUses.back();
+    profilerScope->openUses.pop_back();
+    if(useIndex == UINT32_MAX){
+        return;
+    }
+    GpuRegionUse *use = &profilerScope->uses[useIndex];
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, profiler->queryPool, use->query + 1);
+    use->ended = true;
+}
+
+void gpuProfilerSubmitted(GpuProfiler *profiler, uint32_t scope){
+    GpuProfilerScope *profilerScope = activeScope(profiler, scope);
+    if(profilerScope != nullptr && !profilerScope->uses.empty()){
+        profilerScope->pending = true;
+    }
+}
+
+static void addSample(GpuRegionStats *region, double ms){
+    region->history[region->historyNext] = ms;
+    region->historyNext = (region->historyNext + 1) % GPU_PROFILER_WINDOW;
+    if(region->historyCount < GPU_PROFILER_WINDOW){
+        region->historyCount++;
+    }
+    double sum = 0.0;
+    for(uint32_t i = 0; i < region->historyCount; i++){
+        sum += region->history[i];
+    }
+    region->averageMs = sum/region->historyCount;
+    region->lastMs = ms;
+    region->minMs = ms < region->minMs ? ms : region->minMs;
+    region->maxMs = ms > region->maxMs ? ms : region->maxMs;
+    region->samples++;
+}
+
+void gpuProfilerCollect(GpuProfiler *profiler, uint32_t scope){
+    GpuProfilerScope *profilerScope = activeScope(profiler, scope);
+    if(profilerScope == nullptr || !profilerScope->pending){
+        return;
+    }
+    profilerScope->pending = false;
+
+    //Value and availability for every query of the scope, no WAIT_BIT so this never blocks
+    uint32_t queryCount = 2*profilerScope->uses.size();
+    uint64_t results[4*GPU_PROFILER_MAX_REGIONS];
+    VkResult result = vkGetQueryPoolResults(
+        profiler->device,
+        profiler->queryPool,
+        profilerScope->firstQuery,
+        queryCount,
+        sizeof(uint64_t)*2*queryCount,
+        results,
+        sizeof(uint64_t)*2,
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT
+    );
+
+    if(result == VK_SUCCESS || result == VK_NOT_READY){
+        for(const GpuRegionUse &use : profilerScope->uses){
+            uint32_t i = use.query - profilerScope->firstQuery;
+            if(!use.ended || results[2*i + 1] == 0 || results[2*i + 3] == 0){
+                continue;
+            }
+            uint64_t ticks = (results[2*i + 2] - results[2*i]) & profilerScope->timestampMask;
+            GpuRegionStats *region = &profiler->regions[use.region];
+            region->frameMs += ticks*profiler->timestampPeriod/1000000.0;
+            region->touched = true;
+        }
+        //A region recorded several times in one command buffer counts as one sample
+        for(GpuRegionStats &region : profiler->regions){
+            if(region.touched){
+                addSample(&region, region.frameMs);
+                region.frameMs = 0.0;
+                region.touched = false;
+            }
+        }
+    }
+
+    //Ready for the next submission of the same command buffer
+    vkResetQueryPool(profiler->device, profiler->queryPool, profilerScope->firstQuery, queryCount);
+}
+
+const GpuRegionStats* findGpuRegion(const GpuProfiler *profiler, const char* name){
+    for(const GpuRegionStats &region : profiler->regions){
+        if(strcmp(region.name, name) == 0){
+            return &region;
+        }
+    }
+    return nullptr;
+}
+
+void printGpuProfiler(const GpuProfiler *profiler){
+    if(!profiler->enabled || profiler->regions.empty()){
+        return;
+    }
+    printf("GPU time per region (ms, average of the last %u samples):\n", GPU_PROFILER_WINDOW);
+    for(const GpuRegionStats &region : profiler->regions){
+        if(region.samples == 0){
+            continue;
+        }
+        printf("  %-20s %8.3f  (min %.3f, max %.3f, %" PRIu64 " samples)\n", region.name, region.averageMs, region.minMs, region.maxMs, region.samples);
+    }
+}
+
+void writeGpuProfilerReport(const GpuProfiler *profiler, const char* path){
+    FILE* file = fopen(path, "w");
+    if(file == nullptr){
+        printf("Failed to open %s for writing!\n", path);
+        return;
+    }
+    fprintf(file, "region,samples,average_ms,last_ms,min_ms,max_ms\n");
+    for(const GpuRegionStats &region : profiler->regions){
+        if(region.samples == 0){
+            continue;
+        }
+        fprintf(file, "%s,%" PRIu64 ",%.4f,%.4f,%.4f,%.4f\n", region.name, region.samples, region.averageMs, region.lastMs, region.minMs, region.maxMs);
+    }
+    fclose(file);
+    printf("Wrote GPU profile to %s\n", path);
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+
+#define GPU_PROFILER_MAX_REGIONS 16//Per scope, regions past this are not timed
+#define GPU_PROFILER_WINDOW 120//Samples in each region's rolling average
+
+//One timed begin/end pair recorded into a scope
+struct GpuRegionUse{
+    uint32_t region;
+    uint32_t query;//Begin timestamp, the end one follows it
+    bool ended;
+};
+
+//The regions of one command buffer. Cached command buffers keep their scope until they are re-recorded.
+struct GpuProfilerScope{
+    uint32_t firstQuery;
+    uint64_t timestampMask;//0 when the queue family can't write timestamps
+    std::vector<GpuRegionUse> uses;
+    std::vector<uint32_t> openUses;
+    bool pending;//Submitted and not collected yet
+};
+
+struct GpuRegionStats{
+    const char* name;
+    double history[GPU_PROFILER_WINDOW];
+    uint32_t historyNext;
+    uint32_t historyCount;
+    double averageMs;//Over the last GPU_PROFILER_WINDOW samples
+    double lastMs;
+    double minMs;
+    double maxMs;
+    uint64_t samples;
+    double frameMs;//Summed over the scope being collected
+    bool touched;
+};
+
+struct GpuProfiler{
+    VkDevice device;
+    bool enabled;
+    double timestampPeriod;//Nanoseconds per tick
+    std::vector<uint32_t> timestampValidBits;//Per queue family
+    VkQueryPool queryPool;//Two queries per region and scope
+    uint32_t scopeCount;
+    GpuProfilerScope* scopes;
+    std::vector<GpuRegionStats> regions;//Outlive the scopes, so stats survive frame resource recreation
+};
+
+//Timestamps are reset from the host, so hostQueryReset must have been enabled on the device
+void createGpuProfiler(VkPhysicalDevice physicalDevice, VkDevice device, bool hostQueryReset, GpuProfiler *profiler);
+void destroyGpuProfiler(GpuProfiler *profiler);
+
+//The device must be idle, pending results are dropped
+void createGpuProfilerScopes(GpuProfiler *profiler, uint32_t scopeCount);
+void destroyGpuProfilerScopes(GpuProfiler *profiler);
+
+//Call before re-recording the scope's command buffer, drops the regions recorded into it before
+void gpuProfilerBeginScope(GpuProfiler *profiler, uint32_t scope, uint32_t queueFamilyIndex);
+void gpuProfilerBeginRegion(GpuProfiler *profiler, uint32_t scope, VkCommandBuffer commandBuffer, const char* name);
+void gpuProfilerEndRegion(GpuProfiler *profiler, uint32_t scope, VkCommandBuffer commandBuffer);
+void gpuProfilerSubmitted(GpuProfiler *profiler, uint32_t scope);
+//Only once the submission's fence has signalled. Never waits, regions whose results aren't there are skipped.
+void gpuProfilerCollect(GpuProfiler *profiler, uint32_t scope);
+
+const GpuRegionStats* findGpuRegion(const GpuProfiler *profiler, const char* name);
+void printGpuProfiler(const GpuProfiler *profiler);
+void writeGpuProfilerReport(const GpuProfiler *profiler, const char* path);
@@ -0,0 +1,277 @@
+#include "indirect.h"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "vk.h"
+#include "initvk.h"
+#include "draw.h"
+
+void createIndirectRenderer(
+    VkDevice device,
+    DeviceAllocator *allocator,
+    VkPipelineCache pipelineCache,
+    VkRenderPass renderPass,
+    VkPipelineLayout graphicsPipelineLayout,
+    uint32_t objectCapacity,
+    bool drawCountSupported,
+    IndirectRenderer *renderer
+){
+    renderer->device = device;
+    renderer->allocator = allocator;
+    renderer->drawCountSupported = drawCountSupported;
+    renderer->objectCapacity = objectCapacity;
+    renderer->objectCount = 0;
+    renderer->geometryVersion = 0;
+    renderer->frameCount = 0;
+    renderer->frames = nullptr;
+
+    //0 uniform ring, 1 draw records, 2 draw commands, 3 draw count, 4 culled instances
+    VkDescriptorSetLayoutBinding layoutBindings[5]{};
+    for(uint32_t i = 0; i < 5; i++){
+        layoutBindings[i].binding = i;
+        layoutBindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        layoutBindings[i].descriptorCount = 1;
+        layoutBindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        layoutBindings[i].pImmutableSamplers = nullptr;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = 5;
+    layoutInfo.pBindings = layoutBindings;
+    if(vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &renderer->descriptorSetLayout) != VK_SUCCESS){
+        printf("Failed to create Cull Descriptor Set Layout!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(CullPushConstants);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &renderer->descriptorSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+    if(vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &renderer->cullPipelineLayout) != VK_SUCCESS){
+        printf("Failed to create Cull Pipeline Layout!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    renderer->cullPipeline = createComputePipeline(device, pipelineCache, renderer->cullPipelineLayout, "shaders/spirv/cull.spv");
+    //Same vertex input and descriptor layout as the CPU path, the model matrix just arrives as instance data
+    renderer->drawPipeline = createGraphicsPipeline(device, pipelineCache, graphicsPipelineLayout, renderPass, "shaders/spirv/indirect.spv");
+
+    createBuffer(
+        device,
+        allocator,
+        DRAW_RECORD_BUFFER_USAGE,
+        0,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        sizeof(GpuDrawRecord)*(VkDeviceSize)objectCapacity,
+        &renderer->drawRecords,
+        &renderer->drawRecordsAllocation
+    );
+}
+
+void destroyIndirectRenderer(IndirectRenderer *renderer){
+    destroyBuffer(renderer->device, renderer->allocator, renderer->drawRecords, &renderer->drawRecordsAllocation);
+    vkDestroyPipeline(renderer->device, renderer->drawPipeline, nullptr);
+    vkDestroyPipeline(renderer->device, renderer->cullPipeline, nullptr);
+    vkDestroyPipelineLayout(renderer->device, renderer->cullPipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(renderer->device, renderer->descriptorSetLayout, nullptr);
+}
+
+void updateIndirectDrawRecords(IndirectRenderer *renderer, UploadQueue *uploadQueue, const GeometryStore *geometryStore){
+    uint32_t objectCount = geometryStore->meshes.size();
+    if(objectCount > renderer->objectCapacity){
+        printf("Indirect Renderer cannot cull more than %u objects!\n", renderer->objectCapacity);
+        exit(EXIT_FAILURE);
+    }
+
+    std::vector<GpuDrawRecord> records(objectCount);
+    for(uint32_t i = 0; i < objectCount; i++){
+        const MeshRecord *mesh = &geometryStore->meshes[i];
+        records[i].indexCount = mesh->indexCount;
+        records[i].firstIndex = mesh->firstIndex;
+        records[i].vertexOffset = mesh->vertexOffset;
+        records[i].objectIndex = i;
+        records[i].boundingSphere = mesh->boundingSphere;
+        records[i].tint = objectTint(i);
+    }
+
+    if(renderer->geometryVersion != 0){
+        vkDeviceWaitIdle(renderer->device);//Only after meshes are added at runtime, which is rare
+    }
+    if(objectCount > 0){
+        //Nothing reads the records now, either they are new or the device is idle
+        writeBufferData(uploadQueue, renderer->drawRecords, &renderer->drawRecordsAllocation, 0, records.data(), sizeof(GpuDrawRecord)*(VkDeviceSize)objectCount, true);
+    }
+    renderer->objectCount = objectCount;
+    renderer->geometryVersion = geometryStore->version;
+}
+
+void createIndirectFrames(
+    IndirectRenderer *renderer,
+    uint32_t frameCount,
+    const UniformRing uniformRings[]
+){
+    VkDescriptorPoolSize poolSize{};
+    poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSize.descriptorCount = 5*frameCount;
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+    poolInfo.maxSets = frameCount;
+    if(vkCreateDescriptorPool(renderer->device, &poolInfo, nullptr, &renderer->descriptorPool) != VK_SUCCESS){
+        printf("Failed to create Cull Descriptor Pool!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    renderer->frameCount = frameCount;
+    renderer->frames = new IndirectFrame[frameCount];
+    VkDeviceSize capacity = renderer->objectCapacity;
+    for(uint32_t i = 0; i < frameCount; i++){
+        IndirectFrame *frame = &renderer->frames[i];
+        //The GPU writes all three every frame and nothing reads them on the host
+        createBuffer(renderer->device, renderer->allocator, DRAW_COMMAND_BUFFER_USAGE, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, sizeof(VkDrawIndexedIndirectCommand)*capacity, &frame->drawCommands, &frame->drawCommandsAllocation);
+        createBuffer(renderer->device, renderer->allocator, DRAW_COUNT_BUFFER_USAGE, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, sizeof(uint32_t), &frame->drawCount, &frame->drawCountAllocation);
+        createBuffer(renderer->device, renderer->allocator, CULLED_INSTANCE_BUFFER_USAGE, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, sizeof(InstanceData)*capacity, &frame->instances, &frame->instancesAllocation);
+
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = renderer->descriptorPool;
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.pSetLayouts = &renderer->descriptorSetLayout;
+        if(vkAllocateDescriptorSets(renderer->device, &allocInfo, &frame->descriptorSet) != VK_SUCCESS){
+            printf("Failed to allocate Cull Descriptor Set!\n");
+            exit(EXIT_FAILURE);
+        }
+
+        VkDescriptorBufferInfo bufferInfos[5]{};
+        bufferInfos[1].buffer = renderer->drawRecords;
+        bufferInfos[1].offset = 0;
+        bufferInfos[1].range = VK_WHOLE_SIZE;
+        bufferInfos[2].buffer = frame->drawCommands;
+        bufferInfos[2].offset = 0;
+        bufferInfos[2].range = VK_WHOLE_SIZE;
+        bufferInfos[3].buffer = frame->drawCount;
+        bufferInfos[3].offset = 0;
+        bufferInfos[3].range = VK_WHOLE_SIZE;
+        bufferInfos[4].buffer = frame->instances;
+        bufferInfos[4].offset = 0;
+        bufferInfos[4].range = VK_WHOLE_SIZE;
+
+        VkWriteDescriptorSet descriptorWrites[5]{};
+        for(uint32_t binding = 1; binding < 5; binding++){
+            descriptorWrites[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[binding].dstSet = frame->descriptorSet;
+            descriptorWrites[binding].dstBinding = binding;
+            descriptorWrites[binding].dstArrayElement = 0;
+            descriptorWrites[binding].descriptorCount = 1;
+            descriptorWrites[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            descriptorWrites[binding].pBufferInfo = &bufferInfos[binding];
+        }
+        vkUpdateDescriptorSets(renderer->device, 4, descriptorWrites + 1, 0, nullptr);
+        setIndirectFrameUniformRing(renderer, i, &uniformRings[i]);
+    }
+}
+
+void setIndirectFrameUniformRing(IndirectRenderer *renderer, uint32_t frame, const UniformRing *uniformRing){
+    VkDescriptorBufferInfo bufferInfo{};
+    bufferInfo.buffer = uniformRing->buffer;
+    bufferInfo.offset = 0;
+    bufferInfo.range = uniformRing->objectsOffset + uniformRing->objectStride*uniformRing->objectCapacity;
+
+    VkWriteDescriptorSet descriptorWrite{};
+    descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrite.dstSet = renderer->frames[frame].descriptorSet;
+    descriptorWrite.dstBinding = 0;
+    descriptorWrite.dstArrayElement = 0;
+    descriptorWrite.descriptorCount = 1;
+    descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    descriptorWrite.pBufferInfo = &bufferInfo;
+    vkUpdateDescriptorSets(renderer->device, 1, &descriptorWrite, 0, nullptr);
+}
+
+void destroyIndirectFrames(IndirectRenderer *renderer){
+    for(uint32_t i = 0; i < renderer->frameCount; i++){
+        IndirectFrame *frame = &renderer->frames[i];
+        destroyBuffer(renderer->device, renderer->allocator, frame->drawCommands, &frame->drawCommandsAllocation);
+        destroyBuffer(renderer->device, renderer->allocator, frame->drawCount, &frame->drawCountAllocation);
+        destroyBuffer(renderer->device, renderer->allocator, frame->instances, &frame->instancesAllocation);
+    }
+    vkDestroyDescriptorPool(renderer->device, renderer->descriptorPool, nullptr);
+    delete[] renderer->frames;
+    renderer->frames = nullptr;
+    renderer->frameCount = 0;
+}
+
+void recordDrawCountClear(VkCommandBuffer commandBuffer, const IndirectRenderer *renderer, uint32_t frame){
+    vkCmdFillBuffer(commandBuffer, renderer->frames[frame].drawCount, 0, sizeof(uint32_t), 0);
+}
+
+void recordCullDispatch(
+    VkCommandBuffer commandBuffer,
+    const IndirectRenderer *renderer,
+    uint32_t frame,
+    const UniformRing *uniformRing
+){
+    const IndirectFrame *indirectFrame = &renderer->frames[frame];
+
+    CullPushConstants pushConstants{};
+    pushConstants.objectCount = renderer->objectCount;
+    pushConstants.objectsOffset = uniformRing->objectsOffset/sizeof(mat4);
+    pushConstants.objectStride = uniformRing->objectStride/sizeof(mat4);
+    pushConstants.compact = renderer->drawCountSupported ? 1 : 0;
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, renderer->cullPipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, renderer->cullPipelineLayout, 0, 1, &indirectFrame->descriptorSet, 0, nullptr);
+    vkCmdPushConstants(commandBuffer, renderer->cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullPushConstants), &pushConstants);
+    vkCmdDispatch(commandBuffer, (renderer->objectCount + CULL_WORKGROUP_SIZE - 1)/CULL_WORKGROUP_SIZE, 1, 1);
+}
+
+void recordIndirectDraws(
+    VkCommandBuffer commandBuffer,
+    const IndirectRenderer *renderer,
+    uint32_t frame,
+    VkExtent2D swapChainExtent,
+    VkPipelineLayout graphicsPipelineLayout,
+    const VkDescriptorSet descriptorSet,
+    const GeometryStore *geometryStore
+){
+    const IndirectFrame *indirectFrame = &renderer->frames[frame];
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, renderer->drawPipeline);
+    bindGeometryStore(commandBuffer, geometryStore);
+    bindInstanceStream(commandBuffer, indirectFrame->instances);
+
+    VkViewport viewport{};
+    viewport.x = 0.0f;
+    viewport.y = 0.0f;
+    viewport.width = (float)swapChainExtent.width;
+    viewport.height = (float)swapChainExtent.height;
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+    VkRect2D scissor{};
+    scissor.offset = {0, 0};
+    scissor.extent = swapChainExtent;
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+    uint32_t dynamicOffset = 0;//The draw shader only reads the frame block
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipelineLayout, 0, 1, &descriptorSet, 1, &dynamicOffset);
+
+    if(renderer->drawCountSupported){
+        vkCmdDrawIndexedIndirectCount(commandBuffer, indirectFrame->drawCommands, 0, indirectFrame->drawCount, 0, renderer->objectCount, sizeof(VkDrawIndexedIndirectCommand));
+    }
+    else{
+        //Culled objects are left in place as zero instance draws
+        vkCmdDrawIndexedIndirect(commandBuffer, indirectFrame->drawCommands, 0, renderer->objectCount, sizeof(VkDrawIndexedIndirectCommand));
+    }
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <glm/glm.hpp>
+#include "allocator.h"
+#include "upload.h"
+#include "geometry.h"
+#include "descriptor.h"
+
+using namespace glm;
+
+#define CULL_WORKGROUP_SIZE 64
+#define DRAW_RECORD_BUFFER_USAGE (VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)
+#define DRAW_COMMAND_BUFFER_USAGE (VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT)
+#define DRAW_COUNT_BUFFER_USAGE (VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT)
+#define CULLED_INSTANCE_BUFFER_USAGE (VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT)
+
+//Everything the cull shader needs to emit one object's draw, std430 layout to match cull.comp
+struct GpuDrawRecord{
+    uint32_t indexCount;
+    uint32_t firstIndex;
+    int32_t vertexOffset;
+    uint32_t objectIndex;//Slot of the object's model matrix in the uniform ring
+    vec4 boundingSphere;
+    vec4 tint;
+};
+
+//Offsets into the uniform ring are in whole matrices, the ring is read as a mat4 array
+struct CullPushConstants{
+    uint32_t objectCount;
+    uint32_t objectsOffset;
+    uint32_t objectStride;
+    uint32_t compact;//Visible draws are packed behind a count, otherwise culled ones keep their slot with zero instances
+};
+
+//Written by the cull pass and consumed by the same frame's indirect draw
+struct IndirectFrame{
+    VkBuffer drawCommands;
+    Allocation drawCommandsAllocation;
+    VkBuffer drawCount;
+    Allocation drawCountAllocation;
+    VkBuffer instances;//One InstanceData per emitted draw, picked up through firstInstance
+    Allocation instancesAllocation;
+    VkDescriptorSet descriptorSet;
+};
+
+struct IndirectRenderer{
+    VkDevice device;
+    DeviceAllocator *allocator;
+    bool drawCountSupported;//vkCmdDrawIndexedIndirectCount is available
+    VkDescriptorSetLayout descriptorSetLayout;
+    VkPipelineLayout cullPipelineLayout;
+    VkPipeline cullPipeline;
+    VkPipeline drawPipeline;
+    VkBuffer drawRecords;
+    Allocation drawRecordsAllocation;
+    uint32_t objectCapacity;
+    uint32_t objectCount;
+    uint64_t geometryVersion;//GeometryStore version the draw records were built from
+    VkDescriptorPool descriptorPool;
+    uint32_t frameCount;
+    IndirectFrame* frames;
+};
+
+void createIndirectRenderer(
+    VkDevice device,
+    DeviceAllocator *allocator,
+    VkPipelineCache pipelineCache,
+    VkRenderPass renderPass,
+    VkPipelineLayout graphicsPipelineLayout,
+    uint32_t objectCapacity,
+    bool drawCountSupported,
+    IndirectRenderer *renderer
+);
+
+void destroyIndirectRenderer(IndirectRenderer *renderer);
+
+//One draw record per mesh, the same objects the CPU path draws. Waits for the device when records are in use.
+void updateIndirectDrawRecords(IndirectRenderer *renderer, UploadQueue *uploadQueue, const GeometryStore *geometryStore);
+
+void createIndirectFrames(
+    IndirectRenderer *renderer,
+    uint32_t frameCount,
+    const UniformRing uniformRings[]
+);
+
+void destroyIndirectFrames(IndirectRenderer *renderer);
+
+//The cull shader reads model matrices straight out of the frame's uniform ring, call again when the ring is replaced
+void setIndirectFrameUniformRing(IndirectRenderer *renderer, uint32_t frame, const UniformRing *uniformRing);
+
+//Outside a render pass, ahead of the cull dispatch. Barriers between the two come from the render graph.
+void recordDrawCountClear(VkCommandBuffer commandBuffer, const IndirectRenderer *renderer, uint32_t frame);
+
+void recordCullDispatch(
+    VkCommandBuffer commandBuffer,
+    const IndirectRenderer *renderer,
+    uint32_t frame,
+    const UniformRing *uniformRing
+);
+
+//Inside the render pass: a single indirect draw covering every object that survived culling
+void recordIndirectDraws(
+    VkCommandBuffer commandBuffer,
+    const IndirectRenderer *renderer,
+    uint32_t frame,
+    VkExtent2D swapChainExtent,
+    VkPipelineLayout graphicsPipelineLayout,
+    const VkDescriptorSet descriptorSet,
+    const GeometryStore *geometryStore
+);
@@ -1,13 +1,18 @@
 #include "initvk.h"
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <vector>
 #include <algorithm>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
 #include "io.h"
 #include "window.h"
 #include "vertex.h"
+#include "descriptor.h"
 
-VkInstance createVkInstance(bool validationLayersEnabled){
+VkInstance createVkInstance(bool validationLayersEnabled, bool headless){
     VkInstance instance{};
 
     VkApplicationInfo appInfo{};
@@ -22,9 +27,11 @@ VkInstance createVkInstance(bool validationLayersEnabled){
     createInfo.pApplicationInfo = &appInfo;
 
     uint32_t glfwExtensionCount = 0;
-    const char** glfwExtensions;
+    const char** glfwExtensions = nullptr;
 
-    glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    if(!headless){
+        glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);//Surface extensions, GLFW must be initialised
+    }
 
     createInfo.enabledExtensionCount = glfwExtensionCount;
     createInfo.ppEnabledExtensionNames = glfwExtensions;
@@ -70,6 +77,9 @@ QueueFamilyIndices findQueueFamilies(VkPhysicalDevice physicalDevice, VkSurfaceK
     for(int i = 0; i < queueFamilyCount; i++){
         if(queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT){
             indices.graphics = i;
+            if(surface == VK_NULL_HANDLE){
+                break;//Headless, nothing is presented
+            }
             VkBool32 presentSupport = false;
             vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, i, surface, &presentSupport);
             if(!presentSupport){
@@ -88,24 +98,67 @@ QueueFamilyIndices findQueueFamilies(VkPhysicalDevice physicalDevice, VkSurfaceK
         exit(EXIT_FAILURE);
     }
 
+    //Prefer a pure DMA family, then any non-graphics family that can copy, otherwise share the graphics queue
+    for(int i = 0; i < queueFamilyCount && indices.transfer == UINT32_MAX; i++){
+        VkQueueFlags flags = queueFamilies[i].queueFlags;
+        if((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))){
+            indices.transfer = i;
+        }
+    }
+    for(int i = 0; i < queueFamilyCount && indices.transfer == UINT32_MAX; i++){
+        VkQueueFlags flags = queueFamilies[i].queueFlags;
+        if((flags & (VK_QUEUE_TRANSFER_BIT | VK_QUEUE_COMPUTE_BIT)) && !(flags & VK_QUEUE_GRAPHICS_BIT)){
+            indices.transfer = i;//Compute queues support transfers even without advertising the bit
+        }
+    }
+    if(indices.transfer == UINT32_MAX){
+        indices.transfer = indices.graphics;
+    }
+
+    free(queueFamilies);
+
     return indices;
 }
 
-VkDevice createLogicalDevice(VkPhysicalDevice physicalDevice, QueueFamilyIndices *indices, const char* deviceExtensions[]){
-    VkDeviceQueueCreateInfo queueCreateInfo{};
-    queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    queueCreateInfo.queueFamilyIndex = indices->graphics;
-    queueCreateInfo.queueCount = 1;
+bool isDeviceExtensionSupported(VkPhysicalDevice physicalDevice, const char* extensionName){
+    uint32_t extensionCount = 0;
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+    VkExtensionProperties* extensions = (VkExtensionProperties*)malloc(sizeof(VkExtensionProperties)*extensionCount);
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, extensions);
+
+    bool supported = false;
+    for(uint32_t i = 0; i < extensionCount && !supported; i++){
+        supported = strcmp(extensions[i].extensionName, extensionName) == 0;
+    }
+
+    free(extensions);
+    return supported;
+}
+
+VkDevice createLogicalDevice(VkPhysicalDevice physicalDevice, QueueFamilyIndices *indices, const char* deviceExtensions[], uint32_t deviceExtensionCount, const VkPhysicalDeviceFeatures2 *enabledFeatures){
     float queuePriority = 1;
-    queueCreateInfo.pQueuePriorities = &queuePriority;
+    VkDeviceQueueCreateInfo queueCreateInfos[2]{};
+    queueCreateInfos[0].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queueCreateInfos[0].queueFamilyIndex = indices->graphics;
+    queueCreateInfos[0].queueCount = 1;
+    queueCreateInfos[0].pQueuePriorities = &queuePriority;
+    uint32_t queueCreateInfoCount = 1;
+
+    if(indices->transfer != indices->graphics){
+        queueCreateInfos[1].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        queueCreateInfos[1].queueFamilyIndex = indices->transfer;
+        queueCreateInfos[1].queueCount = 1;
+        queueCreateInfos[1].pQueuePriorities = &queuePriority;
+        queueCreateInfoCount++;
+    }
 
     VkDeviceCreateInfo createInfo{};
     createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    createInfo.pQueueCreateInfos = &queueCreateInfo;
-    createInfo.queueCreateInfoCount = 1;
-    VkPhysicalDeviceFeatures deviceFeatures{};
-    createInfo.pEnabledFeatures = &deviceFeatures;
-    createInfo.enabledExtensionCount = 1;
+    createInfo.pQueueCreateInfos = queueCreateInfos;
+    createInfo.queueCreateInfoCount = queueCreateInfoCount;
+    createInfo.pNext = enabledFeatures;//Core and chained newer features together, so pEnabledFeatures stays null
+    createInfo.pEnabledFeatures = nullptr;
+    createInfo.enabledExtensionCount = deviceExtensionCount;
     createInfo.ppEnabledExtensionNames = deviceExtensions;
 
     VkDevice device;
@@ -157,15 +210,48 @@ VkSurfaceFormatKHR selectSurfaceFormat(SwapChainSupport *support){
     exit(EXIT_FAILURE);
 }
 
-VkPresentModeKHR selectPresentMode(SwapChainSupport *support){
-    for(const VkPresentModeKHR& presentMode : support->presentModes){
-        if(presentMode == VK_PRESENT_MODE_MAILBOX_KHR){
-            return presentMode;
+const char* presentModeName(VkPresentModeKHR presentMode){
+    switch(presentMode){
+        case VK_PRESENT_MODE_IMMEDIATE_KHR: return "immediate";
+        case VK_PRESENT_MODE_MAILBOX_KHR: return "mailbox";
+        case VK_PRESENT_MODE_FIFO_KHR: return "fifo";
+        case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "fifo_relaxed";
+        default: return "unknown";
+    }
+}
+
+bool parsePresentMode(const char* name, VkPresentModeKHR *presentMode){
+    const VkPresentModeKHR modes[] = {VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR, VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR};
+    for(VkPresentModeKHR mode : modes){
+        if(strcmp(name, presentModeName(mode)) == 0){
+            *presentMode = mode;
+            return true;
         }
     }
+    return false;
+}
 
-    printf("Mailbox Present Mode not available!\n");
-    exit(EXIT_FAILURE);
+VkPresentModeKHR selectPresentMode(const SwapChainSupport *support, VkPresentModeKHR requested){
+    //Each mode falls back to the closest latency behaviour first, FIFO is the only mode every device has to support
+    VkPresentModeKHR fallbacks[PRESENT_MODE_COUNT][3] = {
+        {VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_FIFO_KHR},
+        {VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_FIFO_KHR},
+        {VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_KHR},
+        {VK_PRESENT_MODE_FIFO_RELAXED_KHR, VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_KHR},
+    };
+    if(requested >= PRESENT_MODE_COUNT){
+        requested = VK_PRESENT_MODE_FIFO_KHR;
+    }
+
+    for(VkPresentModeKHR candidate : fallbacks[requested]){
+        if(std::find(support->presentModes.begin(), support->presentModes.end(), candidate) != support->presentModes.end()){
+            if(candidate != requested){
+                printf("Present mode %s not available, using %s.\n", presentModeName(requested), presentModeName(candidate));
+            }
+            return candidate;
+        }
+    }
+    return VK_PRESENT_MODE_FIFO_KHR;
 }
 
 VkExtent2D selectSwapchainExtent(const VkSurfaceCapabilitiesKHR *capabilities, GLFWwindow *window){
@@ -183,7 +269,7 @@ VkExtent2D selectSwapchainExtent(const VkSurfaceCapabilitiesKHR *capabilities, G
     }
 }
 
-VkSwapchainKHR createSwapChain(VkDevice device, VkPhysicalDevice physicalDevice, VkSurfaceKHR surface, GLFWwindow *window, VkExtent2D extent, VkSurfaceCapabilitiesKHR *capabilities, VkSurfaceFormatKHR surfaceFormat, VkPresentModeKHR presentMode){
+VkSwapchainKHR createSwapChain(VkDevice device, VkPhysicalDevice physicalDevice, VkSurfaceKHR surface, GLFWwindow *window, VkExtent2D extent, VkSurfaceCapabilitiesKHR *capabilities, VkSurfaceFormatKHR surfaceFormat, VkPresentModeKHR presentMode, VkSwapchainKHR oldSwapchain){
     uint32_t imageCount = capabilities->minImageCount + 1;
     if(capabilities->maxImageCount > 0 && imageCount > capabilities->maxImageCount){
         imageCount = capabilities->maxImageCount;
@@ -197,7 +283,7 @@ VkSwapchainKHR createSwapChain(VkDevice device, VkPhysicalDevice physicalDevice,
     createInfo.imageColorSpace = surfaceFormat.colorSpace;
     createInfo.imageExtent = extent;
     createInfo.imageArrayLayers = 1;
-    createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | (capabilities->supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT);//Transfer source lets frames be captured
     //Assume Graphics and Present Queue Family are shared
     createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
     createInfo.queueFamilyIndexCount = 0; // Optional
@@ -206,7 +292,7 @@ VkSwapchainKHR createSwapChain(VkDevice device, VkPhysicalDevice physicalDevice,
     createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
     createInfo.presentMode = presentMode;
     createInfo.clipped = VK_TRUE;
-    createInfo.oldSwapchain = VK_NULL_HANDLE;
+    createInfo.oldSwapchain = oldSwapchain;//Lets the driver hand over resources, the old one stays valid for what is already in flight
 
     VkSwapchainKHR swapchain;
     if(vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapchain) != VK_SUCCESS){
@@ -230,7 +316,7 @@ VkShaderModule createShaderModule(VkDevice device, char* code, size_t codeSize){
     return shaderModule;
 }
 
-VkRenderPass createRenderPass(VkDevice device, VkFormat swapChainImageFormat){
+VkRenderPass createRenderPass(VkDevice device, VkFormat swapChainImageFormat, VkImageLayout initialLayout, VkImageLayout finalLayout){
     VkAttachmentDescription colorAttachment{};
     colorAttachment.format = swapChainImageFormat;
     colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
@@ -238,8 +324,8 @@ VkRenderPass createRenderPass(VkDevice device, VkFormat swapChainImageFormat){
     colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
     colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    colorAttachment.initialLayout = initialLayout;//COLOR_ATTACHMENT_OPTIMAL on both ends when a render graph does the transitions
+    colorAttachment.finalLayout = finalLayout;
 
     VkAttachmentReference colorAttachmentRef{};
     colorAttachmentRef.attachment = 0;//Index to the Attachment Descriptions array
@@ -278,9 +364,137 @@ VkRenderPass createRenderPass(VkDevice device, VkFormat swapChainImageFormat){
     return renderPass;
 }
 
-VkPipeline createGraphicsPipeline(VkDevice device, VkPipelineLayout pipelineLayout, VkRenderPass renderPass){
+VkPipelineCache createPipelineCache(VkDevice device){
+    VkPipelineCacheCreateInfo cacheInfo{};
+    cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+
+    VkPipelineCache pipelineCache;
+    if(vkCreatePipelineCache(device, &cacheInfo, nullptr, &pipelineCache) != VK_SUCCESS){
+        printf("Failed to create Pipeline Cache!\n");
+        exit(EXIT_FAILURE);
+    }
+    return pipelineCache;
+}
+
+//Drivers reject or misbehave on data from another driver build, so only a header naming this exact device is trusted
+static bool isPipelineCacheCompatible(const char* data, size_t size, const VkPhysicalDeviceProperties *properties){
+    VkPipelineCacheHeaderVersionOne header;
+    if(size < sizeof(header)){
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    return header.headerSize >= sizeof(header) && header.headerSize <= size &&
+        header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+        header.vendorID == properties->vendorID &&
+        header.deviceID == properties->deviceID &&
+        memcmp(header.pipelineCacheUUID, properties->pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+VkPipelineCache loadPipelineCache(VkDevice device, const VkPhysicalDeviceProperties *properties, const char* path){
+    FILE* file = fopen(path, "rb");
+    if(file == nullptr){
+        printf("No pipeline cache at %s, pipelines are compiled from scratch.\n", path);
+        return createPipelineCache(device);
+    }
+    long size = fseek(file, 0L, SEEK_END) == 0 ? ftell(file) : -1;
+    rewind(file);
+    char* data = (char*)malloc(size > 0 ? size : 1);
+    bool read = size > 0 && fread(data, 1, size, file) == (size_t)size;
+    int readError = ferror(file) ? errno : 0;
+    fclose(file);
+
+    if(!read){
+        if(size == 0){
+            printf("Discarding the pipeline cache at %s, it is empty.\n", path);
+        }
+        else{
+            printf("Failed to read the pipeline cache at %s (%s), pipelines are compiled from scratch.\n", path, readError != 0 ? strerror(readError) : "truncated");
+        }
+        free(data);
+        return createPipelineCache(device);
+    }
+    if(!isPipelineCacheCompatible(data, size, properties)){
+        printf("Discarding the pipeline cache at %s, it was written by another device or driver.\n", path);
+        free(data);
+        return createPipelineCache(device);
+    }
+
+    VkPipelineCacheCreateInfo cacheInfo{};
+    cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    cacheInfo.initialDataSize = size;
+    cacheInfo.pInitialData = data;
+
+    VkPipelineCache pipelineCache;
+    VkResult result = vkCreatePipelineCache(device, &cacheInfo, nullptr, &pipelineCache);
+    free(data);
+    if(result != VK_SUCCESS){
+        printf("Discarding the pipeline cache at %s, the driver rejected it.\n", path);
+        return createPipelineCache(device);
+    }
+    printf("Loaded a %ld byte pipeline cache from %s.\n", size, path);
+    return pipelineCache;
+}
+
+//A rename is only durable once the directory entry is, fsyncing the file alone doesn't cover it
+static bool syncParentDirectory(const char* path){
+    const char* slash = strrchr(path, '/');
+    size_t length = slash == nullptr ? 1 : std::max<size_t>(1, slash - path);
+    char* directory = (char*)malloc(length + 1);
+    memcpy(directory, slash == nullptr ? "." : path, length);
+    directory[length] = '\0';
+
+    int fd = open(directory, O_RDONLY | O_DIRECTORY);
+    free(directory);
+    if(fd < 0){
+        return false;
+    }
+    bool synced = fsync(fd) == 0;
+    close(fd);
+    return synced;
+}
+
+void savePipelineCache(VkDevice device, VkPipelineCache pipelineCache, const char* path){
+    size_t size = 0;
+    if(vkGetPipelineCacheData(device, pipelineCache, &size, nullptr) != VK_SUCCESS || size == 0){
+        return;
+    }
+    char* data = (char*)malloc(size);
+    if(vkGetPipelineCacheData(device, pipelineCache, &size, data) != VK_SUCCESS){
+        free(data);
+        return;
+    }
+
+    //Same directory as path, so the rename can't cross filesystems
+    size_t pathLength = strlen(path);
+    char* tempPath = (char*)malloc(pathLength + 5);
+    memcpy(tempPath, path, pathLength);
+    memcpy(tempPath + pathLength, ".tmp", 5);
+
+    FILE* file = fopen(tempPath, "wb");
+    bool written = file != nullptr && fwrite(data, 1, size, file) == size;
+    if(file != nullptr){
+        written = fflush(file) == 0 && fsync(fileno(file)) == 0 && written;
+        written = fclose(file) == 0 && written;
+    }
+    if(written && rename(tempPath, path) == 0){
+        if(!syncParentDirectory(path)){
+            printf("Saved the pipeline cache to %s, but its directory couldn't be synced, a crash may lose it.\n", path);
+        }
+        else{
+            printf("Saved a %zu byte pipeline cache to %s.\n", size, path);
+        }
+    }
+    else{
+        printf("Failed to save the pipeline cache to %s!\n", path);
+        remove(tempPath);
+    }
+    free(tempPath);
+    free(data);
+}
+
+VkPipeline createGraphicsPipeline(VkDevice device, VkPipelineCache pipelineCache, VkPipelineLayout pipelineLayout, VkRenderPass renderPass, const char* vertShaderPath){
     int vertShaderCodeSize, fragShaderCodeSize;
-    char* vertShaderCode = readFile("shaders/spirv/vert.spv", &vertShaderCodeSize);
+    char* vertShaderCode = readFile(vertShaderPath, &vertShaderCodeSize);
     char* fragShaderCode = readFile("shaders/spirv/frag.spv", &fragShaderCodeSize);
 
     VkShaderModule vertShaderModule = createShaderModule(device, vertShaderCode, vertShaderCodeSize);
@@ -308,9 +522,10 @@ VkPipeline createGraphicsPipeline(VkDevice device, VkPipelineLayout pipelineLayo
 
     VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
     vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertexInputInfo.vertexBindingDescriptionCount = 1;
-    VkVertexInputBindingDescription bindingDescription = getBindingDescription();
-    vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+    uint32_t bindingDescriptionsSize;
+    VkVertexInputBindingDescription* bindingDescriptions = getBindingDescriptions(&bindingDescriptionsSize);
+    vertexInputInfo.vertexBindingDescriptionCount = bindingDescriptionsSize;
+    vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions;
     uint32_t attrDescriptionsSize;
     VkVertexInputAttributeDescription* attrDescriptions = getAttributeDescriptions(&attrDescriptionsSize);
     vertexInputInfo.vertexAttributeDescriptionCount = attrDescriptionsSize;
@@ -388,7 +603,7 @@ VkPipeline createGraphicsPipeline(VkDevice device, VkPipelineLayout pipelineLayo
     pipelineInfo.basePipelineIndex = -1; // Optional
 
     VkPipeline pipeline;
-    if(vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS){
+    if(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS){
         printf("Failed to create Graphics Pipeline!\n");
         exit(EXIT_FAILURE);
     }
@@ -398,11 +613,39 @@ VkPipeline createGraphicsPipeline(VkDevice device, VkPipelineLayout pipelineLayo
     vkDestroyShaderModule(device, fragShaderModule, nullptr);
     vkDestroyShaderModule(device, vertShaderModule, nullptr);
 
+    free(bindingDescriptions);
     free(attrDescriptions);
 
     return pipeline;
 }
 
+VkPipeline createComputePipeline(VkDevice device, VkPipelineCache pipelineCache, VkPipelineLayout pipelineLayout, const char* compShaderPath){
+    int compShaderCodeSize;
+    char* compShaderCode = readFile(compShaderPath, &compShaderCodeSize);
+    VkShaderModule compShaderModule = createShaderModule(device, compShaderCode, compShaderCodeSize);
+
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = compShaderModule;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = pipelineLayout;
+    pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+    pipelineInfo.basePipelineIndex = -1;
+
+    VkPipeline pipeline;
+    if(vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS){
+        printf("Failed to create Compute Pipeline!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    free(compShaderCode);
+    vkDestroyShaderModule(device, compShaderModule, nullptr);
+
+    return pipeline;
+}
+
 VkPipelineLayout createGraphicsPipelineLayout(
     VkDevice device,
     VkDescriptorSetLayout descriptorSetLayout
@@ -411,8 +654,12 @@ VkPipelineLayout createGraphicsPipelineLayout(
     pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
     pipelineLayoutInfo.setLayoutCount = 1;
     pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
-    pipelineLayoutInfo.pushConstantRangeCount = 0; // Optional
-    pipelineLayoutInfo.pPushConstantRanges = nullptr; // Optional
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(DrawPushConstants);
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
 
     VkPipelineLayout pipelineLayout;
     if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
@@ -478,6 +725,81 @@ VkFramebuffer* createFramebuffers(VkDevice device, VkImageView* swapchainImageVi
     return swapchainFramebuffers;
 }
 
+VkFormat selectOffscreenFormat(VkPhysicalDevice physicalDevice){
+    //Same format the swapchain uses where possible, so pipelines and readbacks behave the same either way
+    const VkFormat candidates[] = {VK_FORMAT_B8G8R8A8_SRGB, VK_FORMAT_R8G8B8A8_SRGB, VK_FORMAT_B8G8R8A8_UNORM, VK_FORMAT_R8G8B8A8_UNORM};
+    VkFormatFeatureFlags required = VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT | VK_FORMAT_FEATURE_TRANSFER_SRC_BIT;
+    for(VkFormat format : candidates){
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &properties);
+        if((properties.optimalTilingFeatures & required) == required){
+            return format;
+        }
+    }
+
+    printf("No suitable Offscreen Format found!\n");
+    exit(EXIT_FAILURE);
+}
+
+void createOffscreenTargets(VulkanObjects *vko, uint32_t count){
+    vko->swapchainImageCount = count;
+    vko->swapchainImages = (VkImage*)malloc(sizeof(VkImage)*count);
+    vko->offscreenAllocations = new Allocation[count];
+
+    VkImageCreateInfo imageInfo{};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = vko->surfaceFormat.format;
+    imageInfo.extent = {vko->swapchainExtent.width, vko->swapchainExtent.height, 1};
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    for(uint32_t i = 0; i < count; i++){
+        if(vkCreateImage(vko->device, &imageInfo, nullptr, &vko->swapchainImages[i]) != VK_SUCCESS){
+            printf("Failed to create Offscreen Image %u!\n", i);
+            exit(EXIT_FAILURE);
+        }
+        VkMemoryRequirements memRequirements;
+        vkGetImageMemoryRequirements(vko->device, vko->swapchainImages[i], &memRequirements);
+        vko->offscreenAllocations[i] = allocateMemory(&vko->allocator, &memRequirements, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MEMORY_CATEGORY_IMAGE);
+        vkBindImageMemory(vko->device, vko->swapchainImages[i], vko->offscreenAllocations[i].memory, vko->offscreenAllocations[i].offset);
+    }
+    vko->swapchainImageViews = createImageViews(vko->device, vko->swapchainImages, count, vko->surfaceFormat);
+}
+
+void destroyOffscreenTargets(VulkanObjects *vko){
+    for(uint32_t i = 0; i < vko->swapchainImageCount; i++){
+        vkDestroyImage(vko->device, vko->swapchainImages[i], nullptr);
+        freeMemory(&vko->allocator, &vko->offscreenAllocations[i]);
+    }
+    delete[] vko->offscreenAllocations;
+    vko->offscreenAllocations = nullptr;
+}
+
+void resizeOffscreenTargets(VulkanObjects *vko, VkExtent2D extent){
+    vkDeviceWaitIdle(vko->device);
+    uint32_t count = vko->swapchainImageCount;
+    for(uint32_t i = 0; i < count; i++){
+        vkDestroyFramebuffer(vko->device, vko->swapchainFramebuffers[i], nullptr);
+        vkDestroyImageView(vko->device, vko->swapchainImageViews[i], nullptr);
+    }
+    free(vko->swapchainFramebuffers);
+    free(vko->swapchainImageViews);
+    destroyOffscreenTargets(vko);
+    free(vko->swapchainImages);
+
+    vko->swapchainExtent = extent;
+    createOffscreenTargets(vko, count);
+    vko->swapchainFramebuffers = createFramebuffers(vko->device, vko->swapchainImageViews, count, vko->renderPass, extent);
+    vko->swapchainRecreations++;
+    vko->sceneVersion++;//Cached command buffers reference the old framebuffers and extent
+}
+
 VkCommandPool createCommandPool(VkDevice device, VkCommandPoolCreateFlags flags, QueueFamilyIndices *queueFamilyIndices){
     VkCommandPoolCreateInfo poolInfo{};
     poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
@@ -541,6 +863,119 @@ SynchronisationObjects createSyncObjects(VkDevice device){
     return sync;
 }
 
+//Only the frame block and the objects in use are copied when the ring moves, the descriptors that point at it follow it
+static void registerUniformRing(VulkanObjects *vko, uint32_t frame){
+    UniformRing *ring = &vko->uniformRings[frame];
+    VkDeviceSize size = ring->objectsOffset + ring->objectStride*ring->objectCapacity;
+    uint32_t entry = defragmenterRegister(&vko->defragmenter, &ring->buffer, &ring->allocation, UNIFORM_BUFFER_USAGE, size, usedUniformRingBytes, ring);
+    defragmenterBindDescriptor(&vko->defragmenter, entry, frame, vko->descriptorSets[frame], 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0, sizeof(FrameUniforms));
+    defragmenterBindDescriptor(&vko->defragmenter, entry, frame, vko->descriptorSets[frame], 1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, ring->objectsOffset, sizeof(ObjectUniforms));
+    if(vko->gpuDriven){
+        defragmenterBindDescriptor(&vko->defragmenter, entry, frame, vko->indirectRenderer.frames[frame].descriptorSet, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0, size);
+    }
+    defragmenterTrackMapping(&vko->defragmenter, entry, &ring->mapped);
+}
+
+void createFrameResources(VulkanObjects *vko, uint32_t framesInFlight){
+    vko->framesInFlight = framesInFlight;
+    vko->descriptorPool = createDescriptorPool(vko->device, framesInFlight);
+
+    uint32_t commandBufferCount = framesInFlight*vko->swapchainImageCount;
+    vko->commandBuffers = (VkCommandBuffer*)malloc(sizeof(VkCommandBuffer)*commandBufferCount);
+    vko->commandBufferVersions = (uint64_t*)calloc(commandBufferCount, sizeof(uint64_t));
+    createCommandBuffers(vko->device, vko->commandPool, commandBufferCount, vko->commandBuffers);
+    createParallelRecorder(vko->device, &vko->queueFamilyIndices, framesInFlight, vko->swapchainImageCount, defaultRecordWorkerCount(), &vko->recorder);
+    createGpuProfilerScopes(&vko->gpuProfiler, frameProfilerScope(commandBufferCount));
+
+    vko->syncObjects = (SynchronisationObjects*)malloc(sizeof(SynchronisationObjects)*framesInFlight);
+    for(uint32_t i = 0; i < framesInFlight; i++){
+        vko->syncObjects[i] = createSyncObjects(vko->device);
+    }
+
+    vko->uniformRings = new UniformRing[framesInFlight];
+    for(uint32_t i = 0; i < framesInFlight; i++){
+        createUniformRing(vko->device, &vko->allocator, vko->objectCapacity, vko->physicalDeviceProperties.limits.minUniformBufferOffsetAlignment, &vko->uniformRings[i]);
+    }
+
+    vko->instanceStreams = new InstanceStream[framesInFlight];
+    uint32_t instanceCapacity = 1 + std::max<uint32_t>(DEFAULT_INSTANCE_CAPACITY, vko->instanceScene.instanceCount);
+    for(uint32_t i = 0; i < framesInFlight; i++){
+        createInstanceStream(vko->device, &vko->allocator, instanceCapacity, &vko->instanceStreams[i]);
+    }
+
+    vko->descriptorSets = (VkDescriptorSet*)malloc(sizeof(VkDescriptorSet)*framesInFlight);
+    VkDescriptorSetLayout* descriptorSetLayouts = (VkDescriptorSetLayout*)malloc(sizeof(VkDescriptorSetLayout)*framesInFlight);
+    for(uint32_t i = 0; i < framesInFlight; i++){
+        descriptorSetLayouts[i] = vko->descriptorSetLayout;
+    }
+    createDescriptorSets(vko->device, vko->descriptorPool, framesInFlight, descriptorSetLayouts, vko->uniformRings, vko->descriptorSets);
+    free(descriptorSetLayouts);
+
+    if(vko->gpuDriven){
+        createIndirectFrames(&vko->indirectRenderer, framesInFlight, vko->uniformRings);
+        vko->renderGraphs = new RenderGraph[framesInFlight];
+        for(uint32_t i = 0; i < framesInFlight; i++){
+            createRenderGraph(&vko->renderGraphs[i]);
+        }
+    }
+
+    vko->defragmenter.framesInFlight = framesInFlight;
+    for(uint32_t i = 0; i < framesInFlight; i++){
+        registerUniformRing(vko, i);
+    }
+    vko->sceneVersion++;
+}
+
+void growUniformRing(VulkanObjects *vko, uint32_t frame, uint32_t objectCount){
+    UniformRing *ring = &vko->uniformRings[frame];
+    uint32_t objectCapacity = std::max(objectCount, 2*ring->objectCapacity);
+    defragmenterUnregister(&vko->defragmenter, &ring->buffer);//Waits for a move of it that is still copying
+    destroyUniformRing(vko->device, &vko->allocator, ring);
+    createUniformRing(vko->device, &vko->allocator, objectCapacity, vko->physicalDeviceProperties.limits.minUniformBufferOffsetAlignment, ring);
+
+    writeUniformDescriptors(vko->device, vko->descriptorSets[frame], ring);
+    if(vko->gpuDriven){
+        setIndirectFrameUniformRing(&vko->indirectRenderer, frame, ring);
+    }
+    registerUniformRing(vko, frame);
+    vko->sceneVersion++;//Cached command buffers of this slot were recorded against the old descriptor writes
+    printf("Uniform Ring %u grown to %u objects.\n", frame, objectCapacity);
+}
+
+void destroyFrameResources(VulkanObjects *vko){
+    vkDeviceWaitIdle(vko->device);
+    releaseRetiredSwapchains(vko, UINT32_MAX);//Their pending masks are sized for the old frame count
+    frameCaptureCollectAll(&vko->frameCapture);//So are the capture slots in use
+
+    for(uint32_t i = 0; i < vko->framesInFlight; i++){
+        defragmenterUnregister(&vko->defragmenter, &vko->uniformRings[i].buffer);
+        destroyUniformRing(vko->device, &vko->allocator, &vko->uniformRings[i]);
+        destroyInstanceStream(vko->device, &vko->allocator, &vko->instanceStreams[i]);
+        vkDestroySemaphore(vko->device, vko->syncObjects[i].imageAvailableSemaphore, nullptr);
+        vkDestroySemaphore(vko->device, vko->syncObjects[i].renderFinishedSemaphore, nullptr);
+        vkDestroyFence(vko->device, vko->syncObjects[i].inFlightFence, nullptr);
+    }
+    vkDestroyDescriptorPool(vko->device, vko->descriptorPool, nullptr);//Frees the descriptor sets with it
+    if(vko->gpuDriven){
+        destroyIndirectFrames(&vko->indirectRenderer);
+        for(uint32_t i = 0; i < vko->framesInFlight; i++){
+            destroyRenderGraph(&vko->renderGraphs[i]);
+        }
+        delete[] vko->renderGraphs;
+    }
+    destroyParallelRecorder(&vko->recorder);
+    destroyGpuProfilerScopes(&vko->gpuProfiler);
+    vkFreeCommandBuffers(vko->device, vko->commandPool, vko->framesInFlight*vko->swapchainImageCount, vko->commandBuffers);
+
+    free(vko->commandBuffers);
+    free(vko->commandBufferVersions);
+    free(vko->syncObjects);
+    delete[] vko->uniformRings;
+    delete[] vko->instanceStreams;
+    free(vko->descriptorSets);
+    vko->framesInFlight = 0;
+}
+
 void destroySwapchainResources(
     VkDevice device, 
     uint32_t swapchainImageCount, 
@@ -559,14 +994,20 @@ void recreateSwapchainResources(
     VulkanObjects *vko,
     WindowObjects *wo
     ){
-    vkDeviceWaitIdle(vko->device);
-
-    destroySwapchainResources(vko->device, vko->swapchainImageCount, vko->swapchainImageViews, vko->swapchainFramebuffers, vko->swapchain);
+    if(vko->blockingSwapchainRecreation){
+        vkDeviceWaitIdle(vko->device);
+    }
 
     vkGetPhysicalDeviceSurfaceCapabilitiesKHR(vko->physicalDevice, vko->surface, &vko->capabilities);
-    vko->swapchainExtent = selectSwapchainExtent(&vko->capabilities, wo->window);
+    VkExtent2D extent = selectSwapchainExtent(&vko->capabilities, wo->window);
+    if(extent.width == 0 || extent.height == 0){
+        return;//Minimised, the old swapchain stays until there is something to present to
+    }
+    vko->swapchainExtent = extent;
 
-    vko->swapchain = createSwapChain(
+    //The old swapchain is passed as oldSwapchain, which needs it externally synchronised against present waits too
+    frameStatsSetSwapchain(&vko->frameStats, VK_NULL_HANDLE);
+    VkSwapchainKHR swapchain = createSwapChain(
         vko->device, 
         vko->physicalDevice, 
         vko->surface, 
@@ -574,10 +1015,81 @@ void recreateSwapchainResources(
         vko->swapchainExtent, 
         &vko->capabilities, 
         vko->surfaceFormat, 
-        vko->presentMode
+        vko->presentMode,
+        vko->swapchain
     );
 
-    vkGetSwapchainImagesKHR(vko->device, vko->swapchain, &vko->swapchainImageCount, vko->swapchainImages);
-    vko->swapchainImageViews = createImageViews(vko->device, vko->swapchainImages, vko->swapchainImageCount, vko->surfaceFormat);
-    vko->swapchainFramebuffers = createFramebuffers(vko->device, vko->swapchainImageViews, vko->swapchainImageCount, vko->renderPass, vko->swapchainExtent);
+    //Frames already submitted keep rendering into the old images, every slot's fence has to pass before they go
+    RetiredSwapchain retired{};
+    retired.swapchain = vko->swapchain;
+    retired.imageCount = vko->swapchainImageCount;
+    retired.imageViews = vko->swapchainImageViews;
+    retired.framebuffers = vko->swapchainFramebuffers;
+    vko->swapchain = swapchain;
+    frameStatsSetSwapchain(&vko->frameStats, swapchain);
+
+    uint32_t imageCount;
+    vkGetSwapchainImagesKHR(vko->device, vko->swapchain, &imageCount, nullptr);
+    if(imageCount != vko->swapchainImageCount){
+        //Command buffers and secondaries are per image, so a different count needs the slow path
+        uint32_t framesInFlight = vko->framesInFlight;
+        //vkDeviceWaitIdle doesn't cover presentation, so presents on the old swapchain may still wait on these
+        retired.renderFinishedSemaphores = (VkSemaphore*)malloc(sizeof(VkSemaphore)*framesInFlight);
+        retired.renderFinishedSemaphoreCount = framesInFlight;
+        for(uint32_t i = 0; i < framesInFlight; i++){
+            retired.renderFinishedSemaphores[i] = vko->syncObjects[i].renderFinishedSemaphore;
+            vko->syncObjects[i].renderFinishedSemaphore = VK_NULL_HANDLE;
+        }
+        destroyFrameResources(vko);
+        vko->swapchainImageCount = imageCount;
+        vko->swapchainImages = (VkImage*)realloc(vko->swapchainImages, sizeof(VkImage)*imageCount);
+        vkGetSwapchainImagesKHR(vko->device, vko->swapchain, &vko->swapchainImageCount, vko->swapchainImages);
+        vko->swapchainImageViews = createImageViews(vko->device, vko->swapchainImages, vko->swapchainImageCount, vko->surfaceFormat);
+        vko->swapchainFramebuffers = createFramebuffers(vko->device, vko->swapchainImageViews, vko->swapchainImageCount, vko->renderPass, vko->swapchainExtent);
+        createFrameResources(vko, framesInFlight);
+    }
+    else{
+        vkGetSwapchainImagesKHR(vko->device, vko->swapchain, &vko->swapchainImageCount, vko->swapchainImages);
+        vko->swapchainImageViews = createImageViews(vko->device, vko->swapchainImages, vko->swapchainImageCount, vko->surfaceFormat);
+        vko->swapchainFramebuffers = createFramebuffers(vko->device, vko->swapchainImageViews, vko->swapchainImageCount, vko->renderPass, vko->swapchainExtent);
+    }
+    //Pushed after the slow path's teardown so it isn't released along with the swapchains retired before it
+    retired.pendingFrames = (1u << vko->framesInFlight) - 1;
+    vko->retiredSwapchains.push_back(retired);
+    vko->swapchainRecreations++;
+    vko->sceneVersion++;//Cached command buffers reference the old framebuffers and extent
+
+    if(vko->blockingSwapchainRecreation){
+        releaseRetiredSwapchains(vko, UINT32_MAX);
+    }
+}
+
+void releaseRetiredSwapchains(VulkanObjects *vko, uint32_t frame){
+    for(size_t i = 0; i < vko->retiredSwapchains.size();){
+        RetiredSwapchain *retired = &vko->retiredSwapchains[i];
+        retired->pendingFrames &= frame == UINT32_MAX ? 0 : ~(1u << frame);
+        if(retired->pendingFrames != 0){
+            i++;
+            continue;
+        }
+        destroySwapchainResources(vko->device, retired->imageCount, retired->imageViews, retired->framebuffers, retired->swapchain);
+        for(uint32_t j = 0; j < retired->renderFinishedSemaphoreCount; j++){
+            vkDestroySemaphore(vko->device, retired->renderFinishedSemaphores[j], nullptr);
+        }
+        free(retired->imageViews);
+        free(retired->framebuffers);
+        free(retired->renderFinishedSemaphores);
+        vko->retiredSwapchains.erase(vko->retiredSwapchains.begin() + i);
+    }
+}
+
+void setPresentMode(VulkanObjects *vko, WindowObjects *wo, VkPresentModeKHR requested){
+    vko->requestedPresentMode = requested;
+    SwapChainSupport support = querySwapChainSupport(vko->physicalDevice, vko->surface);
+    VkPresentModeKHR presentMode = selectPresentMode(&support, requested);
+    printf("Present mode %s.\n", presentModeName(presentMode));
+    if(presentMode != vko->presentMode){
+        vko->presentMode = presentMode;
+        recreateSwapchainResources(vko, wo);
+    }
 }
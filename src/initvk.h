@@ -5,24 +5,35 @@
 #include "vk.h"
 #include "window.h"
 
+#define PRESENT_MODE_COUNT 4//Core modes, IMMEDIATE through FIFO_RELAXED, in enum order
+
 struct SwapChainSupport {
     VkSurfaceCapabilitiesKHR capabilities;
     std::vector<VkSurfaceFormatKHR> formats;
     std::vector<VkPresentModeKHR> presentModes;
 };
 
-VkInstance createVkInstance(bool validationLayersEnabled);
+VkInstance createVkInstance(bool validationLayersEnabled, bool headless);
 VkPhysicalDevice pickVkPhysicalDevice(VkInstance instance);
 QueueFamilyIndices findQueueFamilies(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface);
-VkDevice createLogicalDevice(VkPhysicalDevice physicalDevice, QueueFamilyIndices *indices, const char* deviceExtensions[]);
+bool isDeviceExtensionSupported(VkPhysicalDevice physicalDevice, const char* extensionName);
+VkDevice createLogicalDevice(VkPhysicalDevice physicalDevice, QueueFamilyIndices *indices, const char* deviceExtensions[], uint32_t deviceExtensionCount, const VkPhysicalDeviceFeatures2 *enabledFeatures);
 SwapChainSupport querySwapChainSupport(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface);
 VkSurfaceFormatKHR selectSurfaceFormat(SwapChainSupport *support);
-VkPresentModeKHR selectPresentMode(SwapChainSupport *support);
+const char* presentModeName(VkPresentModeKHR presentMode);
+bool parsePresentMode(const char* name, VkPresentModeKHR *presentMode);
+VkPresentModeKHR selectPresentMode(const SwapChainSupport *support, VkPresentModeKHR requested);
 VkExtent2D selectSwapchainExtent(const VkSurfaceCapabilitiesKHR *capabilities, GLFWwindow *window);
-VkSwapchainKHR createSwapChain(VkDevice device, VkPhysicalDevice physicalDevice, VkSurfaceKHR surface, GLFWwindow *window, VkExtent2D extent, VkSurfaceCapabilitiesKHR *capabilities, VkSurfaceFormatKHR surfaceFormat, VkPresentModeKHR presentMode);
+VkSwapchainKHR createSwapChain(VkDevice device, VkPhysicalDevice physicalDevice, VkSurfaceKHR surface, GLFWwindow *window, VkExtent2D extent, VkSurfaceCapabilitiesKHR *capabilities, VkSurfaceFormatKHR surfaceFormat, VkPresentModeKHR presentMode, VkSwapchainKHR oldSwapchain);
 VkShaderModule createShaderModule(VkDevice device, char* code, size_t codeSize);
-VkRenderPass createRenderPass(VkDevice device, VkFormat swapChainImageFormat);
-VkPipeline createGraphicsPipeline(VkDevice device, VkPipelineLayout pipelineLayout, VkRenderPass renderPass);
+VkRenderPass createRenderPass(VkDevice device, VkFormat swapChainImageFormat, VkImageLayout initialLayout, VkImageLayout finalLayout);
+VkPipelineCache createPipelineCache(VkDevice device);
+//Starts from the cache at path when its header matches this device, empty when it is missing or stale
+VkPipelineCache loadPipelineCache(VkDevice device, const VkPhysicalDeviceProperties *properties, const char* path);
+//Writes to a temporary file and renames it over path, so a crash never leaves a torn cache behind
+void savePipelineCache(VkDevice device, VkPipelineCache pipelineCache, const char* path);
+VkPipeline createGraphicsPipeline(VkDevice device, VkPipelineCache pipelineCache, VkPipelineLayout pipelineLayout, VkRenderPass renderPass, const char* vertShaderPath);
+VkPipeline createComputePipeline(VkDevice device, VkPipelineCache pipelineCache, VkPipelineLayout pipelineLayout, const char* compShaderPath);
 VkPipelineLayout createGraphicsPipelineLayout(
     VkDevice device,
     VkDescriptorSetLayout descriptorSetLayout
@@ -34,12 +45,26 @@ VkImageView* createImageViews(
     VkSurfaceFormatKHR surfaceFormat
     );
 VkFramebuffer* createFramebuffers(VkDevice device, VkImageView* swapchainImageViews, int swapchainImageCount, VkRenderPass renderPass, VkExtent2D swapchainExtent);
+VkFormat selectOffscreenFormat(VkPhysicalDevice physicalDevice);
+//Device owned images that stand in for the swapchain in headless mode, one per frame slot. Views are made too, framebuffers are not.
+void createOffscreenTargets(VulkanObjects *vko, uint32_t count);
+void destroyOffscreenTargets(VulkanObjects *vko);
+//The headless stand in for swapchain recreation, drains the device and rebuilds the targets and framebuffers at the new extent
+void resizeOffscreenTargets(VulkanObjects *vko, VkExtent2D extent);
 VkCommandPool createCommandPool(VkDevice device, VkCommandPoolCreateFlags flags, QueueFamilyIndices *queueFamilyIndices);
 VkCommandBuffer createCommandBuffer(VkDevice device, VkCommandPool commandPool);
 void createCommandBuffers(VkDevice device, VkCommandPool commandPool, int commandBuffersSize, VkCommandBuffer* commandBuffers);
 SynchronisationObjects createSyncObjects(VkDevice device);
 void destroySwapchainResources(VkDevice device, uint32_t swapchainImageCount, VkImageView* swapchainImageViews, VkFramebuffer* swapchainFramebuffers, VkSwapchainKHR swapchain);
+void createFrameResources(VulkanObjects *vko, uint32_t framesInFlight);
+void destroyFrameResources(VulkanObjects *vko);
+//Replaces frame's uniform ring with one that holds objectCount objects. Call once frame's fence has signalled.
+void growUniformRing(VulkanObjects *vko, uint32_t frame, uint32_t objectCount);
 void recreateSwapchainResources(
     VulkanObjects *vko,
     WindowObjects *wo
-);
\ No newline at end of file
+);
+//Recreates the swapchain if the best available mode for requested differs from the current one
+void setPresentMode(VulkanObjects *vko, WindowObjects *wo, VkPresentModeKHR requested);
+//frame is the slot whose fence just signalled, UINT32_MAX once the device is idle
+void releaseRetiredSwapchains(VulkanObjects *vko, uint32_t frame);
\ No newline at end of file
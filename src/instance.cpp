@@ -0,0 +1,140 @@
+#include "instance.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <glm/gtc/matrix_transform.hpp>
+#include "vk.h"
+#include "descriptor.h"
+
+void createInstanceStream(
+    VkDevice device,
+    DeviceAllocator *allocator,
+    uint32_t capacity,
+    InstanceStream *stream
+){
+    createBuffer(
+        device,
+        allocator,
+        INSTANCE_BUFFER_USAGE,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,//Rewritten every frame like the uniform rings
+        sizeof(InstanceData)*(VkDeviceSize)capacity,
+        &stream->buffer,
+        &stream->allocation
+    );
+    stream->mapped = (InstanceData*)stream->allocation.mapped;
+    stream->capacity = capacity;
+
+    InstanceData identity{};
+    identity.transform = mat4(1.0f);
+    identity.color = vec4(1.0f);
+    stream->mapped[0] = identity;
+    stream->count = 1;
+    stream->sceneChange = 0;
+    stream->sceneVersion = UINT64_MAX;
+}
+
+void destroyInstanceStream(VkDevice device, DeviceAllocator *allocator, InstanceStream *stream){
+    destroyBuffer(device, allocator, stream->buffer, &stream->allocation);
+    stream->mapped = nullptr;
+}
+
+void growInstanceStream(VkDevice device, DeviceAllocator *allocator, uint32_t capacity, InstanceStream *stream){
+    destroyInstanceStream(device, allocator, stream);
+    createInstanceStream(device, allocator, capacity, stream);
+}
+
+uint32_t addInstanceBatch(
+    InstanceScene *scene,
+    uint32_t meshId,
+    const InstanceData* instances,
+    uint32_t instanceCount
+){
+    InstanceBatch batch{};
+    batch.meshId = meshId;
+    batch.instances.assign(instances, instances + instanceCount);
+    batch.change = ++scene->changeCount;
+    scene->batches.push_back(std::move(batch));
+    scene->instanceCount += instanceCount;
+    scene->version++;
+    return scene->batches.size() - 1;
+}
+
+void setInstanceBatch(
+    InstanceScene *scene,
+    uint32_t batchId,
+    const InstanceData* instances,
+    uint32_t instanceCount
+){
+    InstanceBatch *batch = &scene->batches[batchId];
+    if(batch->instances.size() != instanceCount){
+        scene->instanceCount += instanceCount - batch->instances.size();
+        scene->version++;//Changes the instance count and every later batch's firstInstance
+    }
+    batch->instances.assign(instances, instances + instanceCount);
+    batch->change = ++scene->changeCount;
+}
+
+void streamInstances(InstanceStream *stream, const InstanceScene *scene){
+    if(1 + scene->instanceCount > stream->capacity){
+        printf("Instance Stream is full, grow it before streaming more than %u instances!\n", stream->capacity - 1);
+        exit(EXIT_FAILURE);
+    }
+
+    bool relaid = stream->sceneVersion != scene->version;
+    stream->count = 1;
+    for(const InstanceBatch &batch : scene->batches){
+        if(relaid || batch.change > stream->sceneChange){
+            memcpy(stream->mapped + stream->count, batch.instances.data(), sizeof(InstanceData)*batch.instances.size());
+        }
+        stream->count += batch.instances.size();
+    }
+    stream->sceneChange = scene->changeCount;
+    stream->sceneVersion = scene->version;
+}
+
+void bindInstanceStream(VkCommandBuffer commandBuffer, VkBuffer instanceBuffer){
+    VkDeviceSize offset = 0;
+    vkCmdBindVertexBuffers(commandBuffer, INSTANCE_BINDING, 1, &instanceBuffer, &offset);
+}
+
+void recordInstanceDraws(
+    VkCommandBuffer commandBuffer,
+    VkPipelineLayout graphicsPipelineLayout,
+    const VkDescriptorSet descriptorSet,
+    const GeometryStore *geometryStore,
+    const InstanceScene *scene,
+    VkDeviceSize objectStride
+){
+    DrawPushConstants pushConstants{};
+    pushConstants.tint = vec4(1.0f);
+    vkCmdPushConstants(commandBuffer, graphicsPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(DrawPushConstants), &pushConstants);
+
+    //Matches the layout streamInstances writes, slot 0 is the identity instance
+    uint32_t firstInstance = 1;
+    for(const InstanceBatch &batch : scene->batches){
+        if(!batch.instances.empty()){
+            //Instances are placed relative to their mesh's object
+            uint32_t dynamicOffset = objectStride*batch.meshId;
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipelineLayout, 0, 1, &descriptorSet, 1, &dynamicOffset);
+            drawMeshInstanced(commandBuffer, geometryStore, batch.meshId, firstInstance, batch.instances.size());
+        }
+        firstInstance += batch.instances.size();
+    }
+}
+
+uint32_t addStressInstanceBatch(InstanceScene *scene, uint32_t meshId, uint32_t instanceCount){
+    uint32_t side = (uint32_t)ceilf(sqrtf((float)instanceCount));
+    float cell = 2.0f/side;
+
+    std::vector<InstanceData> instances(instanceCount);
+    for(uint32_t i = 0; i < instanceCount; i++){
+        uint32_t x = i % side;
+        uint32_t y = i / side;
+        vec3 position(-1.0f + cell*(x + 0.5f), -1.0f + cell*(y + 0.5f), 0.0f);
+        instances[i].transform = glm::scale(glm::translate(mat4(1.0f), position), vec3(cell*0.8f));
+        instances[i].color = vec4((float)x/side, (float)y/side, 1.0f - (float)x/side, 1.0f);
+    }
+    return addInstanceBatch(scene, meshId, instances.data(), instanceCount);
+}
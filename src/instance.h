@@ -0,0 +1,79 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include "allocator.h"
+#include "geometry.h"
+#include "vertex.h"
+
+#define INSTANCE_BUFFER_USAGE VK_BUFFER_USAGE_VERTEX_BUFFER_BIT
+#define DEFAULT_INSTANCE_CAPACITY 65536
+#define STRESS_SCENE_DEFAULT_INSTANCES 100000
+
+//Copies of one mesh that go out as a single instanced draw
+struct InstanceBatch{
+    uint32_t meshId;
+    std::vector<InstanceData> instances;
+    uint64_t change;//changeCount when the instances were last set
+};
+
+struct InstanceScene{
+    std::vector<InstanceBatch> batches;
+    uint32_t instanceCount;//Across all batches
+    uint64_t version;//Bumped when a batch is added or changes size, instance data itself can change freely
+    uint64_t changeCount;//Bumped by every add or set
+};
+
+//One per frame in flight, refilled from the scene every frame. Slot 0 always holds the identity instance for plain draws.
+struct InstanceStream{
+    VkBuffer buffer;
+    Allocation allocation;
+    InstanceData* mapped;
+    uint32_t capacity;
+    uint32_t count;
+    uint64_t sceneChange;//Scene changeCount the stream was last brought up to date with
+    uint64_t sceneVersion;//Scene version it was laid out for, any other one shifts batches and rewrites them all
+};
+
+void createInstanceStream(
+    VkDevice device,
+    DeviceAllocator *allocator,
+    uint32_t capacity,
+    InstanceStream *stream
+);
+
+void destroyInstanceStream(VkDevice device, DeviceAllocator *allocator, InstanceStream *stream);
+
+//Replaces the stream with one that holds capacity instances, it is refilled from scratch by the next streamInstances
+void growInstanceStream(VkDevice device, DeviceAllocator *allocator, uint32_t capacity, InstanceStream *stream);
+
+uint32_t addInstanceBatch(
+    InstanceScene *scene,
+    uint32_t meshId,
+    const InstanceData* instances,
+    uint32_t instanceCount
+);
+
+void setInstanceBatch(
+    InstanceScene *scene,
+    uint32_t batchId,
+    const InstanceData* instances,
+    uint32_t instanceCount
+);
+
+//Keeps every batch in the stream back to back, in batch order, so recorded firstInstance values stay valid.
+//Each stream belongs to a frame slot, so only batches set since that slot last streamed are copied.
+void streamInstances(InstanceStream *stream, const InstanceScene *scene);
+
+void bindInstanceStream(VkCommandBuffer commandBuffer, VkBuffer instanceBuffer);
+
+void recordInstanceDraws(
+    VkCommandBuffer commandBuffer,
+    VkPipelineLayout graphicsPipelineLayout,
+    const VkDescriptorSet descriptorSet,
+    const GeometryStore *geometryStore,
+    const InstanceScene *scene,
+    VkDeviceSize objectStride
+);
+
+//Lays instanceCount copies of a mesh out on a square grid with a colour gradient
+uint32_t addStressInstanceBatch(InstanceScene *scene, uint32_t meshId, uint32_t instanceCount);
@@ -0,0 +1,80 @@
+#include "pacing.h"
+#include <cstdio>
+#include <cinttypes>
+#include <cmath>
+#include <thread>
+#include <algorithm>
+
+void createFramePacer(double targetFps, FramePacer *pacer){
+    *pacer = FramePacer{};
+    pacer->targetFrameTime = targetFps > 0.0 ? 1.0/targetFps : 0.0;
+    pacer->oversleepMean = PACING_INITIAL_OVERSLEEP;
+    pacer->nextFrame = std::chrono::steady_clock::now();
+}
+
+static double secondsBetween(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end){
+    return std::chrono::duration<double>(end - start).count();
+}
+
+static double oversleepEstimate(const FramePacer *pacer){
+    //Mean plus one standard deviation, wrong guesses only cost spin time
+    double variance = pacer->oversleepSamples > 1 ? pacer->oversleepM2/(pacer->oversleepSamples - 1) : 0.0;
+    return pacer->oversleepMean + sqrt(variance);
+}
+
+void framePacerWait(FramePacer *pacer){
+    if(pacer->targetFrameTime <= 0.0){
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    double remaining = secondsBetween(now, pacer->nextFrame);
+    if(remaining < -pacer->targetFrameTime){
+        //More than a frame behind: catching up would mean a burst of back to back frames, which reads as judder
+        pacer->missedFrames++;
+        pacer->nextFrame = now;
+        remaining = 0.0;
+    }
+
+    //Short sleeps with their overshoot measured each time, so the spin at the end only covers the timer's jitter
+    while(remaining > oversleepEstimate(pacer)){
+        double request = std::min(PACING_SLEEP_SLICE, remaining - oversleepEstimate(pacer));
+        auto sleepStart = std::chrono::steady_clock::now();
+        std::this_thread::sleep_for(std::chrono::duration<double>(request));
+        auto sleepEnd = std::chrono::steady_clock::now();
+
+        double oversleep = secondsBetween(sleepStart, sleepEnd) - request;
+        pacer->oversleepSamples++;
+        double delta = oversleep - pacer->oversleepMean;
+        pacer->oversleepMean += delta/pacer->oversleepSamples;
+        pacer->oversleepM2 += delta*(oversleep - pacer->oversleepMean);
+
+        pacer->sleptTime += secondsBetween(sleepStart, sleepEnd);
+        remaining = secondsBetween(sleepEnd, pacer->nextFrame);
+    }
+
+    auto spinStart = std::chrono::steady_clock::now();
+    while(std::chrono::steady_clock::now() < pacer->nextFrame){
+        std::this_thread::yield();
+    }
+    pacer->spunTime += secondsBetween(spinStart, std::chrono::steady_clock::now());
+
+    //Deadlines advance by whole periods, so an early or late wake doesn't shift the frames after it
+    pacer->nextFrame += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(pacer->targetFrameTime));
+    pacer->pacedFrames++;
+}
+
+void printFramePacerStats(const FramePacer *pacer){
+    if(pacer->targetFrameTime <= 0.0 || pacer->pacedFrames == 0){
+        return;
+    }
+    printf(
+        "Frame pacing at %.1f fps: %" PRIu64 " frames, %" PRIu64 " missed, %.3f ms slept and %.3f ms spun per frame, sleep overshoot %.3f ms\n",
+        1.0/pacer->targetFrameTime,
+        pacer->pacedFrames,
+        pacer->missedFrames,
+        pacer->sleptTime*1000.0/pacer->pacedFrames,
+        pacer->spunTime*1000.0/pacer->pacedFrames,
+        oversleepEstimate(pacer)*1000.0
+    );
+}
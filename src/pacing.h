@@ -0,0 +1,26 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+
+#define PACING_INITIAL_OVERSLEEP 0.001//Seconds a sleep is assumed to overshoot before any have been measured
+#define PACING_SLEEP_SLICE 0.001//Longest single sleep, short enough that the overshoot estimate keeps up with the timer
+
+//Holds a target frame rate by sleeping most of the gap and spinning only for the last stretch
+struct FramePacer{
+    double targetFrameTime;//Seconds, 0 leaves the loop unpaced
+    std::chrono::steady_clock::time_point nextFrame;
+    double oversleepMean;//Running estimate of how late a sleep wakes up
+    double oversleepM2;
+    uint64_t oversleepSamples;
+    double sleptTime;
+    double spunTime;
+    uint64_t pacedFrames;
+    uint64_t missedFrames;//Frames that started after their deadline, the schedule restarts from them
+};
+
+void createFramePacer(double targetFps, FramePacer *pacer);
+
+//Blocks until the next frame is due, call once per frame before starting it
+void framePacerWait(FramePacer *pacer);
+
+void printFramePacerStats(const FramePacer *pacer);
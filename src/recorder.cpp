@@ -0,0 +1,200 @@
+#include "recorder.h"
+#include <cstdio>
+#include <cstdlib>
+#include "vk.h"
+#include "draw.h"
+
+uint32_t defaultRecordWorkerCount(){
+    uint32_t cores = std::thread::hardware_concurrency();
+    return cores > 1 ? cores - 1 : 1;//Leave a core for the main thread, which waits on the workers anyway
+}
+
+static void recordShare(ParallelRecorder *recorder, uint32_t workerIndex, const RecordJob *job){
+    VkCommandBuffer commandBuffer = recorder->workers[workerIndex].commandBuffers[job->frame][job->image];
+    uint32_t firstDraw = (uint64_t)job->drawCount*workerIndex/recorder->workerCount;
+    uint32_t lastDraw = (uint64_t)job->drawCount*(workerIndex + 1)/recorder->workerCount;
+
+    VkCommandBufferInheritanceInfo inheritanceInfo{};
+    inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritanceInfo.renderPass = job->renderPass;
+    inheritanceInfo.subpass = 0;
+    inheritanceInfo.framebuffer = job->framebuffer;
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+    vkResetCommandBuffer(commandBuffer, 0);
+    if(vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS){
+        printf("Failed to begin Secondary Command Buffer Recording!\n");
+        exit(EXIT_FAILURE);
+    }
+    //Secondaries inherit nothing but the render pass, so each one binds its own state
+    recordMeshDraws(
+        commandBuffer,
+        job->extent,
+        job->pipelineLayout,
+        job->pipeline,
+        job->descriptorSet,
+        job->geometryStore,
+        job->instanceBuffer,
+        job->objectStride,
+        job->drawList,
+        firstDraw,
+        lastDraw - firstDraw
+    );
+    if(workerIndex == recorder->workerCount - 1){
+        //Instanced batches are only a handful of draws, so the last worker takes them after its meshes
+        recordInstanceDraws(commandBuffer, job->pipelineLayout, job->descriptorSet, job->geometryStore, job->instanceScene, job->objectStride);
+    }
+    if(vkEndCommandBuffer(commandBuffer) != VK_SUCCESS){
+        printf("Failed to end Secondary Command Buffer!\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void workerLoop(ParallelRecorder *recorder, uint32_t workerIndex){
+    uint64_t seenGeneration = 0;
+    while(true){
+        RecordJob job;
+        {
+            std::unique_lock<std::mutex> lock(recorder->mutex);
+            recorder->jobReady.wait(lock, [&]{ return recorder->quit || recorder->jobGeneration != seenGeneration; });
+            if(recorder->quit){
+                return;
+            }
+            seenGeneration = recorder->jobGeneration;
+            job = recorder->job;
+        }
+
+        recordShare(recorder, workerIndex, &job);
+
+        std::lock_guard<std::mutex> lock(recorder->mutex);
+        if(--recorder->busyWorkers == 0){
+            recorder->jobDone.notify_one();
+        }
+    }
+}
+
+void createParallelRecorder(
+    VkDevice device,
+    const QueueFamilyIndices *queueFamilyIndices,
+    uint32_t frameCount,
+    uint32_t imageCount,
+    uint32_t workerCount,
+    ParallelRecorder *recorder
+){
+    recorder->device = device;
+    recorder->workerCount = workerCount;
+    recorder->frameCount = frameCount;
+    recorder->imageCount = imageCount;
+    recorder->jobGeneration = 0;
+    recorder->busyWorkers = 0;
+    recorder->quit = false;
+    recorder->workers = new RecordWorker[workerCount];
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = queueFamilyIndices->graphics;
+
+    for(uint32_t i = 0; i < workerCount; i++){
+        recorder->workers[i].commandPools = (VkCommandPool*)malloc(sizeof(VkCommandPool)*frameCount);
+        recorder->workers[i].commandBuffers = (VkCommandBuffer**)malloc(sizeof(VkCommandBuffer*)*frameCount);
+        for(uint32_t frame = 0; frame < frameCount; frame++){
+            if(vkCreateCommandPool(device, &poolInfo, nullptr, &recorder->workers[i].commandPools[frame]) != VK_SUCCESS){
+                printf("Failed to create Worker Command Pool!\n");
+                exit(EXIT_FAILURE);
+            }
+
+            VkCommandBufferAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.commandPool = recorder->workers[i].commandPools[frame];
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            allocInfo.commandBufferCount = imageCount;
+
+            recorder->workers[i].commandBuffers[frame] = (VkCommandBuffer*)malloc(sizeof(VkCommandBuffer)*imageCount);
+            if(vkAllocateCommandBuffers(device, &allocInfo, recorder->workers[i].commandBuffers[frame]) != VK_SUCCESS){
+                printf("Failed to allocate Secondary Command Buffers!\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    //Threads start last, once every pool they could touch exists
+    for(uint32_t i = 0; i < workerCount; i++){
+        recorder->workers[i].thread = std::thread(workerLoop, recorder, i);
+    }
+}
+
+void destroyParallelRecorder(ParallelRecorder *recorder){
+    {
+        std::lock_guard<std::mutex> lock(recorder->mutex);
+        recorder->quit = true;
+    }
+    recorder->jobReady.notify_all();
+
+    for(uint32_t i = 0; i < recorder->workerCount; i++){
+        recorder->workers[i].thread.join();
+        for(uint32_t frame = 0; frame < recorder->frameCount; frame++){
+            vkDestroyCommandPool(recorder->device, recorder->workers[i].commandPools[frame], nullptr);
+            free(recorder->workers[i].commandBuffers[frame]);
+        }
+        free(recorder->workers[i].commandPools);
+        free(recorder->workers[i].commandBuffers);
+    }
+    delete[] recorder->workers;
+    recorder->workers = nullptr;
+    recorder->workerCount = 0;
+}
+
+void recordCommandBufferParallel(
+    ParallelRecorder *recorder,
+    VkCommandBuffer commandBuffer,
+    const RecordJob *job
+){
+    {
+        std::lock_guard<std::mutex> lock(recorder->mutex);
+        recorder->job = *job;
+        recorder->busyWorkers = recorder->workerCount;
+        recorder->jobGeneration++;
+    }
+    recorder->jobReady.notify_all();
+
+    {
+        std::unique_lock<std::mutex> lock(recorder->mutex);
+        recorder->jobDone.wait(lock, [&]{ return recorder->busyWorkers == 0; });
+    }
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = 0;
+    beginInfo.pInheritanceInfo = nullptr;
+
+    if(vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS){
+        printf("Failed to begin Command Buffer Recording!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    gpuProfilerBeginRegion(job->profiler, job->profilerScope, commandBuffer, "frame");
+    //Timestamps can't go inside a render pass whose contents are secondaries
+    gpuProfilerBeginRegion(job->profiler, job->profilerScope, commandBuffer, "main pass");
+    beginSwapchainRenderPass(commandBuffer, job->renderPass, job->framebuffer, job->extent, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+    VkCommandBuffer* secondaries = (VkCommandBuffer*)malloc(sizeof(VkCommandBuffer)*recorder->workerCount);
+    for(uint32_t i = 0; i < recorder->workerCount; i++){
+        secondaries[i] = recorder->workers[i].commandBuffers[job->frame][job->image];
+    }
+    vkCmdExecuteCommands(commandBuffer, recorder->workerCount, secondaries);//Worker order matches draw order
+    free(secondaries);
+
+    vkCmdEndRenderPass(commandBuffer);
+    gpuProfilerEndRegion(job->profiler, job->profilerScope, commandBuffer);
+    gpuProfilerEndRegion(job->profiler, job->profilerScope, commandBuffer);
+
+    if(vkEndCommandBuffer(commandBuffer) != VK_SUCCESS){
+        printf("Failed to end Command Buffer!\n");
+        exit(EXIT_FAILURE);
+    }
+}
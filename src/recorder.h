@@ -0,0 +1,73 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "geometry.h"
+#include "instance.h"
+#include "gpuprofiler.h"
+
+#define PARALLEL_RECORD_MIN_DRAWS 256//Below this, handing work to threads costs more than recording it inline
+
+struct QueueFamilyIndices;
+
+//Everything a worker needs to record its share of one frame's draws
+struct RecordJob{
+    uint32_t frame;
+    uint32_t image;
+    VkRenderPass renderPass;
+    VkFramebuffer framebuffer;
+    VkExtent2D extent;
+    VkPipelineLayout pipelineLayout;
+    VkPipeline pipeline;
+    VkDescriptorSet descriptorSet;
+    const GeometryStore *geometryStore;
+    VkBuffer instanceBuffer;
+    const InstanceScene *instanceScene;
+    VkDeviceSize objectStride;
+    const uint32_t* drawList;//Null draws every mesh
+    uint32_t drawCount;
+    GpuProfiler *profiler;//Only the primary is timed, may be null
+    uint32_t profilerScope;
+};
+
+struct RecordWorker{
+    VkCommandPool* commandPools;//Per frame so a worker never touches a pool the GPU may still be reading from
+    VkCommandBuffer** commandBuffers;//[frame][image], one secondary per cached primary
+    std::thread thread;
+};
+
+struct ParallelRecorder{
+    VkDevice device;
+    uint32_t workerCount;
+    uint32_t frameCount;
+    uint32_t imageCount;
+    RecordWorker* workers;
+    std::mutex mutex;
+    std::condition_variable jobReady;
+    std::condition_variable jobDone;
+    uint64_t jobGeneration;
+    uint32_t busyWorkers;
+    bool quit;
+    RecordJob job;
+};
+
+uint32_t defaultRecordWorkerCount();
+
+void createParallelRecorder(
+    VkDevice device,
+    const QueueFamilyIndices *queueFamilyIndices,
+    uint32_t frameCount,
+    uint32_t imageCount,
+    uint32_t workerCount,
+    ParallelRecorder *recorder
+);
+
+void destroyParallelRecorder(ParallelRecorder *recorder);
+
+//Workers record the draws into secondaries while this thread waits, then the primary just executes them in order
+void recordCommandBufferParallel(
+    ParallelRecorder *recorder,
+    VkCommandBuffer commandBuffer,
+    const RecordJob *job
+);
@@ -0,0 +1,391 @@
+#include "rendergraph.h"
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+#define WRITE_ACCESS_MASK (VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT)
+
+struct UsageState{
+    VkPipelineStageFlags stages;
+    VkAccessFlags access;
+    VkImageLayout layout;
+    bool write;
+};
+
+//Where the previous uses of a resource left it while barriers are worked out
+struct ResourceState{
+    VkPipelineStageFlags writeStages;
+    VkAccessFlags writeAccess;
+    VkPipelineStageFlags readStages;//Reads since the last write, a following write has to wait for them
+    VkPipelineStageFlags visibleStages;//Stages the last write was already made visible to
+    VkAccessFlags visibleAccess;
+    VkImageLayout layout;
+};
+
+static UsageState usageState(RenderGraphUsage usage, VkPipelineStageFlags shaderStages){
+    switch(usage){
+        case RENDER_GRAPH_COLOR_ATTACHMENT:
+            return {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, true};
+        case RENDER_GRAPH_DEPTH_ATTACHMENT:
+            return {VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, true};
+        case RENDER_GRAPH_SAMPLED:
+            return {shaderStages, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false};
+        case RENDER_GRAPH_STORAGE_READ:
+            return {shaderStages, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, false};
+        case RENDER_GRAPH_STORAGE_WRITE:
+            return {shaderStages, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL, true};
+        case RENDER_GRAPH_TRANSFER_SRC:
+            return {VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, false};
+        case RENDER_GRAPH_TRANSFER_DST:
+            return {VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, true};
+        case RENDER_GRAPH_INDIRECT:
+            return {VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, false};
+        case RENDER_GRAPH_VERTEX:
+            return {VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, false};
+        default:
+            printf("Unknown Render Graph usage %d!\n", usage);
+            exit(EXIT_FAILURE);
+    }
+}
+
+void createRenderGraph(RenderGraph *graph){
+    graph->barrierCount = 0;
+}
+
+void destroyRenderGraph(RenderGraph *graph){
+    resetRenderGraph(graph);
+}
+
+void resetRenderGraph(RenderGraph *graph){
+    graph->resources.clear();
+    graph->passes.clear();
+    graph->order.clear();
+    graph->barriers.clear();
+    graph->finalBarriers = RenderGraphBarrierBatch{};
+    graph->barrierCount = 0;
+}
+
+static uint32_t addResource(RenderGraph *graph, const RenderGraphResource *resource){
+    graph->resources.push_back(*resource);
+    return graph->resources.size() - 1;
+}
+
+uint32_t importGraphImage(
+    RenderGraph *graph,
+    const char* name,
+    VkImage image,
+    VkImageAspectFlags aspect,
+    VkImageLayout initialLayout,
+    VkImageLayout finalLayout,
+    VkPipelineStageFlags initialStages
+){
+    RenderGraphResource resource{};
+    resource.name = name;
+    resource.isImage = true;
+    resource.aspect = aspect;
+    resource.image = image;
+    resource.initialLayout = initialLayout;
+    resource.finalLayout = finalLayout;
+    resource.initialStages = initialStages;
+    return addResource(graph, &resource);
+}
+
+uint32_t importGraphBuffer(RenderGraph *graph, const char* name, VkBuffer buffer){
+    RenderGraphResource resource{};
+    resource.name = name;
+    resource.buffer = buffer;
+    return addResource(graph, &resource);
+}
+
+uint32_t addGraphPass(
+    RenderGraph *graph,
+    const char* name,
+    VkPipelineStageFlags shaderStages,
+    RenderGraphRecordFunction record,
+    void* userData
+){
+    RenderGraphPass pass{};
+    pass.name = name;
+    pass.shaderStages = shaderStages;
+    pass.record = record;
+    pass.userData = userData;
+    graph->passes.push_back(pass);
+    return graph->passes.size() - 1;
+}
+
+void graphPassUse(RenderGraph *graph, uint32_t pass, uint32_t resource, RenderGraphUsage usage){
+    bool imageOnly = usage == RENDER_GRAPH_COLOR_ATTACHMENT || usage == RENDER_GRAPH_DEPTH_ATTACHMENT || usage == RENDER_GRAPH_SAMPLED;
+    bool bufferOnly = usage == RENDER_GRAPH_INDIRECT || usage == RENDER_GRAPH_VERTEX;
+    if((imageOnly && !graph->resources[resource].isImage) || (bufferOnly && graph->resources[resource].isImage)){
+        printf("Render Graph pass %s can't use %s that way!\n", graph->passes[pass].name, graph->resources[resource].name);
+        exit(EXIT_FAILURE);
+    }
+    graph->passes[pass].uses.push_back({resource, usage});
+}
+
+void graphPassSideEffects(RenderGraph *graph, uint32_t pass){
+    graph->passes[pass].sideEffects = true;
+}
+
+static bool passWrites(const RenderGraphPass *pass, uint32_t resource){
+    for(const RenderGraphUse &use : pass->uses){
+        if(use.resource == resource && usageState(use.usage, 0).write){
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool passUses(const RenderGraphPass *pass, uint32_t resource){
+    for(const RenderGraphUse &use : pass->uses){
+        if(use.resource == resource){
+            return true;
+        }
+    }
+    return false;
+}
+
+//Producers go before their consumers. Writers of a resource keep their declaration order and a reader sees the
+//last writer declared before it. Independent passes stay in declaration order. Exits on a cycle, which no order can satisfy.
+static std::vector<uint32_t> sortPasses(const RenderGraph *graph){
+    uint32_t passCount = graph->passes.size();
+    std::vector<std::vector<uint32_t>> successors(passCount);
+    std::vector<uint32_t> predecessorCount(passCount, 0);
+    auto addEdge = [&](uint32_t from, uint32_t to){
+        successors[from].push_back(to);
+        predecessorCount[to]++;
+    };
+
+    for(uint32_t r = 0; r < graph->resources.size(); r++){
+        std::vector<uint32_t> writers;
+        for(uint32_t p = 0; p < passCount; p++){
+            if(passWrites(&graph->passes[p], r)){
+                if(!writers.empty()){
+                    addEdge(writers.back(), p);
+                }
+                writers.push_back(p);
+            }
+        }
+        for(uint32_t p = 0; p < passCount; p++){
+            if(!passUses(&graph->passes[p], r) || passWrites(&graph->passes[p], r)){
+                continue;
+            }
+            auto next = std::upper_bound(writers.begin(), writers.end(), p);
+            if(next != writers.begin()){
+                addEdge(*(next - 1), p);
+            }
+            if(next != writers.end()){
+                addEdge(p, *next);//Write after read
+            }
+        }
+    }
+
+    std::vector<uint32_t> sorted;
+    std::vector<bool> placed(passCount, false);
+    while(sorted.size() < passCount){
+        uint32_t ready = RENDER_GRAPH_NO_PASS;
+        for(uint32_t p = 0; p < passCount && ready == RENDER_GRAPH_NO_PASS; p++){
+            if(!placed[p] && predecessorCount[p] == 0){
+                ready = p;
+            }
+        }
+        if(ready == RENDER_GRAPH_NO_PASS){
+            printf("Render Graph passes have a dependency cycle!\n");
+            exit(EXIT_FAILURE);
+        }
+        placed[ready] = true;
+        sorted.push_back(ready);
+        for(uint32_t successor : successors[ready]){
+            predecessorCount[successor]--;
+        }
+    }
+    return sorted;
+}
+
+static void orderPasses(RenderGraph *graph){
+    std::vector<uint32_t> sorted = sortPasses(graph);
+
+    //Every resource is imported and outlives the frame, so a pass survives if it writes anything or has side effects
+    graph->order.clear();
+    for(uint32_t p : sorted){
+        const RenderGraphPass *pass = &graph->passes[p];
+        bool keep = pass->sideEffects;
+        for(size_t u = 0; u < pass->uses.size() && !keep; u++){
+            keep = usageState(pass->uses[u].usage, 0).write;
+        }
+        if(keep){
+            graph->order.push_back(p);
+        }
+    }
+}
+
+static void addBarrier(
+    RenderGraphBarrierBatch *batch,
+    const RenderGraphResource *resource,
+    VkPipelineStageFlags srcStages,
+    VkAccessFlags srcAccess,
+    VkPipelineStageFlags dstStages,
+    VkAccessFlags dstAccess,
+    VkImageLayout oldLayout,
+    VkImageLayout newLayout
+){
+    batch->srcStages |= srcStages != 0 ? srcStages : (VkPipelineStageFlags)VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    batch->dstStages |= dstStages;
+
+    if(resource->isImage && (oldLayout != newLayout || srcAccess != 0)){
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcAccessMask = srcAccess;
+        barrier.dstAccessMask = dstAccess;
+        barrier.oldLayout = oldLayout;
+        barrier.newLayout = newLayout;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = resource->image;
+        barrier.subresourceRange.aspectMask = resource->aspect;
+        barrier.subresourceRange.baseMipLevel = 0;
+        barrier.subresourceRange.levelCount = 1;
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount = 1;
+        batch->imageBarriers.push_back(barrier);
+    }
+    else if(!resource->isImage && srcAccess != 0){
+        VkBufferMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.srcAccessMask = srcAccess;
+        barrier.dstAccessMask = dstAccess;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.buffer = resource->buffer;
+        barrier.offset = 0;
+        barrier.size = VK_WHOLE_SIZE;
+        batch->bufferBarriers.push_back(barrier);
+    }
+    //Anything else is a pure execution dependency carried by the stage masks
+}
+
+static void buildBarriers(RenderGraph *graph){
+    std::vector<ResourceState> states(graph->resources.size());
+    for(size_t r = 0; r < graph->resources.size(); r++){
+        states[r] = ResourceState{};
+        states[r].readStages = graph->resources[r].initialStages;
+        states[r].layout = graph->resources[r].initialLayout;
+    }
+
+    graph->barriers.assign(graph->order.size(), RenderGraphBarrierBatch{});
+    for(uint32_t i = 0; i < graph->order.size(); i++){
+        const RenderGraphPass *pass = &graph->passes[graph->order[i]];
+        RenderGraphBarrierBatch *batch = &graph->barriers[i];
+
+        //Several uses of one resource in a pass fold into a single state, mixed image layouts fall back to GENERAL
+        std::vector<uint32_t> touched;
+        std::vector<UsageState> wanted;
+        for(size_t u = 0; u < pass->uses.size(); u++){
+            UsageState state = usageState(pass->uses[u].usage, pass->shaderStages);
+            size_t k = std::find(touched.begin(), touched.end(), pass->uses[u].resource) - touched.begin();
+            if(k == touched.size()){
+                touched.push_back(pass->uses[u].resource);
+                wanted.push_back(state);
+                continue;
+            }
+            wanted[k].stages |= state.stages;
+            wanted[k].access |= state.access;
+            wanted[k].write |= state.write;
+            if(wanted[k].layout != state.layout){
+                wanted[k].layout = VK_IMAGE_LAYOUT_GENERAL;
+            }
+        }
+
+        for(size_t k = 0; k < touched.size(); k++){
+            const RenderGraphResource *resource = &graph->resources[touched[k]];
+            ResourceState *state = &states[touched[k]];
+            UsageState dst = wanted[k];
+
+            bool layoutChange = resource->isImage && state->layout != dst.layout;
+            if(layoutChange){
+                addBarrier(batch, resource, state->writeStages | state->readStages, state->writeAccess, dst.stages, dst.access, state->layout, dst.layout);
+            }
+            else if(dst.write && (state->writeStages | state->readStages) != 0){
+                //Write after write needs the memory dependency, write after read only has to wait
+                addBarrier(batch, resource, state->writeStages | state->readStages, state->writeAccess, dst.stages, dst.access, state->layout, dst.layout);
+            }
+            else if(!dst.write && state->writeAccess != 0 && ((dst.stages & ~state->visibleStages) != 0 || (dst.access & ~state->visibleAccess) != 0)){
+                addBarrier(batch, resource, state->writeStages, state->writeAccess, dst.stages, dst.access, state->layout, dst.layout);
+            }
+
+            if(dst.write){
+                state->writeStages = dst.stages;
+                state->writeAccess = dst.access & WRITE_ACCESS_MASK;
+                state->readStages = 0;
+                state->visibleStages = 0;
+                state->visibleAccess = 0;
+            }
+            else{
+                state->readStages |= dst.stages;
+                state->visibleStages |= dst.stages;
+                state->visibleAccess |= dst.access;
+            }
+            if(resource->isImage){
+                state->layout = dst.layout;
+            }
+        }
+        if(batch->srcStages != 0){
+            graph->barrierCount++;
+        }
+    }
+
+    graph->finalBarriers = RenderGraphBarrierBatch{};
+    for(size_t r = 0; r < graph->resources.size(); r++){
+        const RenderGraphResource *resource = &graph->resources[r];
+        if(resource->isImage && resource->finalLayout != VK_IMAGE_LAYOUT_UNDEFINED && resource->finalLayout != states[r].layout){
+            addBarrier(&graph->finalBarriers, resource, states[r].writeStages | states[r].readStages, states[r].writeAccess, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, states[r].layout, resource->finalLayout);
+        }
+    }
+    if(graph->finalBarriers.srcStages != 0){
+        graph->barrierCount++;
+    }
+}
+
+void compileRenderGraph(RenderGraph *graph){
+    orderPasses(graph);
+    graph->barrierCount = 0;
+    buildBarriers(graph);
+}
+
+static void recordBarrierBatch(VkCommandBuffer commandBuffer, const RenderGraphBarrierBatch *batch){
+    if(batch->srcStages == 0){
+        return;
+    }
+    vkCmdPipelineBarrier(
+        commandBuffer,
+        batch->srcStages,
+        batch->dstStages,
+        0,
+        0, nullptr,
+        batch->bufferBarriers.size(), batch->bufferBarriers.data(),
+        batch->imageBarriers.size(), batch->imageBarriers.data()
+    );
+}
+
+void executeRenderGraph(const RenderGraph *graph, VkCommandBuffer commandBuffer, GpuProfiler *profiler, uint32_t profilerScope){
+    for(size_t i = 0; i < graph->order.size(); i++){
+        recordBarrierBatch(commandBuffer, &graph->barriers[i]);
+        const RenderGraphPass *pass = &graph->passes[graph->order[i]];
+        gpuProfilerBeginRegion(profiler, profilerScope, commandBuffer, pass->name);
+        pass->record(commandBuffer, pass->userData);
+        gpuProfilerEndRegion(profiler, profilerScope, commandBuffer);
+    }
+    recordBarrierBatch(commandBuffer, &graph->finalBarriers);
+}
+
+void printRenderGraph(const RenderGraph *graph){
+    printf("Render Graph: %zu of %zu passes, %u barriers\n", graph->order.size(), graph->passes.size(), graph->barrierCount);
+    for(size_t i = 0; i < graph->order.size(); i++){
+        const RenderGraphBarrierBatch *batch = &graph->barriers[i];
+        printf("  %s", graph->passes[graph->order[i]].name);
+        if(batch->srcStages != 0){
+            printf(" (after %zu image and %zu buffer barriers)", batch->imageBarriers.size(), batch->bufferBarriers.size());
+        }
+        printf("\n");
+    }
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include "gpuprofiler.h"
+
+#define RENDER_GRAPH_NO_PASS UINT32_MAX
+
+//How a pass touches a resource, each one maps to fixed stages, access and image layout
+enum RenderGraphUsage{
+    RENDER_GRAPH_COLOR_ATTACHMENT,
+    RENDER_GRAPH_DEPTH_ATTACHMENT,
+    RENDER_GRAPH_SAMPLED,
+    RENDER_GRAPH_STORAGE_READ,
+    RENDER_GRAPH_STORAGE_WRITE,//Read-modify-write, atomics included
+    RENDER_GRAPH_TRANSFER_SRC,
+    RENDER_GRAPH_TRANSFER_DST,
+    RENDER_GRAPH_INDIRECT,
+    RENDER_GRAPH_VERTEX,
+    RENDER_GRAPH_USAGE_COUNT
+};
+
+typedef void (*RenderGraphRecordFunction)(VkCommandBuffer commandBuffer, void* userData);
+
+struct RenderGraphResource{
+    const char* name;
+    bool isImage;
+    VkImageAspectFlags aspect;
+    VkImage image;
+    VkBuffer buffer;
+    VkImageLayout initialLayout;
+    VkImageLayout finalLayout;//Imported images are left in this layout, UNDEFINED keeps whatever the last pass used
+    VkPipelineStageFlags initialStages;//Work outside the graph that first uses must wait for, like the acquire semaphore
+};
+
+struct RenderGraphUse{
+    uint32_t resource;
+    RenderGraphUsage usage;
+};
+
+struct RenderGraphPass{
+    const char* name;
+    VkPipelineStageFlags shaderStages;//Where sampled and storage uses happen
+    bool sideEffects;//Never culled, for passes that only write resources through means the graph can't see
+    std::vector<RenderGraphUse> uses;
+    RenderGraphRecordFunction record;
+    void* userData;
+};
+
+struct RenderGraphBarrierBatch{
+    VkPipelineStageFlags srcStages;
+    VkPipelineStageFlags dstStages;
+    std::vector<VkImageMemoryBarrier> imageBarriers;
+    std::vector<VkBufferMemoryBarrier> bufferBarriers;
+};
+
+struct RenderGraph{
+    std::vector<RenderGraphResource> resources;
+    std::vector<RenderGraphPass> passes;
+    std::vector<uint32_t> order;//Pass indices in execution order, culled passes left out
+    std::vector<RenderGraphBarrierBatch> barriers;//barriers[i] goes in front of order[i]
+    RenderGraphBarrierBatch finalBarriers;
+    uint32_t barrierCount;
+};
+
+void createRenderGraph(RenderGraph *graph);
+void destroyRenderGraph(RenderGraph *graph);
+
+//Drops passes and resources so the graph can be built again
+void resetRenderGraph(RenderGraph *graph);
+
+uint32_t importGraphImage(
+    RenderGraph *graph,
+    const char* name,
+    VkImage image,
+    VkImageAspectFlags aspect,
+    VkImageLayout initialLayout,
+    VkImageLayout finalLayout,
+    VkPipelineStageFlags initialStages
+);
+
+uint32_t importGraphBuffer(RenderGraph *graph, const char* name, VkBuffer buffer);
+
+uint32_t addGraphPass(
+    RenderGraph *graph,
+    const char* name,
+    VkPipelineStageFlags shaderStages,
+    RenderGraphRecordFunction record,
+    void* userData
+);
+
+void graphPassUse(RenderGraph *graph, uint32_t pass, uint32_t resource, RenderGraphUsage usage);
+void graphPassSideEffects(RenderGraph *graph, uint32_t pass);
+
+//Orders and culls passes and works out every barrier
+void compileRenderGraph(RenderGraph *graph);
+//Each pass is timed as a region of the same name when a profiler is given
+void executeRenderGraph(const RenderGraph *graph, VkCommandBuffer commandBuffer, GpuProfiler *profiler, uint32_t profilerScope);
+
+void printRenderGraph(const RenderGraph *graph);
@@ -0,0 +1,252 @@
+#include "scene.h"
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <algorithm>
+#include <glm/gtc/matrix_transform.hpp>
+
+static void propagateRange(SceneGraph *graph, uint32_t begin, uint32_t end){
+    uint64_t update = graph->updateCount;
+    for(uint32_t i = begin; i < end; i++){
+        uint32_t parent = graph->parents[i];
+        bool parentChanged = parent != SCENE_NO_PARENT && graph->worldUpdates[parent] == update;
+        if(!graph->dirty[i] && !parentChanged){
+            continue;
+        }
+        graph->worldTransforms[i] = parent == SCENE_NO_PARENT ? graph->localTransforms[i] : graph->worldTransforms[parent]*graph->localTransforms[i];
+        graph->worldUpdates[i] = update;//Children in the next level see this and follow
+        graph->dirty[i] = 0;
+    }
+}
+
+//Worker w of n takes share w of n + 1, the calling thread takes the last one
+static void propagateShare(SceneGraph *graph, uint32_t share, uint32_t begin, uint32_t end){
+    uint32_t shares = graph->workerCount + 1;
+    uint32_t length = end - begin;
+    propagateRange(graph, begin + (uint64_t)length*share/shares, begin + (uint64_t)length*(share + 1)/shares);
+}
+
+static void sceneWorkerLoop(SceneGraph *graph, uint32_t workerIndex){
+    uint64_t seenGeneration = 0;
+    while(true){
+        uint32_t begin, end;
+        {
+            std::unique_lock<std::mutex> lock(graph->mutex);
+            graph->jobReady.wait(lock, [&]{ return graph->quit || graph->jobGeneration != seenGeneration; });
+            if(graph->quit){
+                return;
+            }
+            seenGeneration = graph->jobGeneration;
+            begin = graph->jobBegin;
+            end = graph->jobEnd;
+        }
+
+        propagateShare(graph, workerIndex, begin, end);
+
+        std::lock_guard<std::mutex> lock(graph->mutex);
+        if(--graph->busyWorkers == 0){
+            graph->jobDone.notify_one();
+        }
+    }
+}
+
+void createSceneGraph(uint32_t workerCount, SceneGraph *graph){
+    graph->firstDirtyLevel = UINT32_MAX;
+    graph->sorted = true;
+    graph->updateCount = 0;
+    graph->levelStarts.push_back(0);
+
+    graph->workerCount = workerCount;
+    graph->jobGeneration = 0;
+    graph->busyWorkers = 0;
+    graph->quit = false;
+    graph->workers = new std::thread[workerCount];
+    for(uint32_t i = 0; i < workerCount; i++){
+        graph->workers[i] = std::thread(sceneWorkerLoop, graph, i);
+    }
+}
+
+void destroySceneGraph(SceneGraph *graph){
+    {
+        std::lock_guard<std::mutex> lock(graph->mutex);
+        graph->quit = true;
+    }
+    graph->jobReady.notify_all();
+    for(uint32_t i = 0; i < graph->workerCount; i++){
+        graph->workers[i].join();
+    }
+    delete[] graph->workers;
+    graph->workers = nullptr;
+    graph->workerCount = 0;
+}
+
+uint32_t addSceneNode(SceneGraph *graph, uint32_t parentHandle, const mat4 &localTransform, uint32_t objectIndex){
+    uint32_t handle = graph->handleSlots.size();
+    uint32_t slot = graph->parents.size();
+    uint32_t parent = parentHandle == SCENE_NO_PARENT ? SCENE_NO_PARENT : graph->handleSlots[parentHandle];
+    uint32_t depth = parent == SCENE_NO_PARENT ? 0 : graph->depths[parent] + 1;
+
+    //Appended out of order, updateSceneGraph sorts by depth before the next propagation
+    graph->parents.push_back(parent);
+    graph->localTransforms.push_back(localTransform);
+    graph->worldTransforms.push_back(mat4(1.0f));
+    graph->dirty.push_back(1);
+    graph->worldUpdates.push_back(0);
+    graph->objectIndices.push_back(objectIndex);
+    graph->depths.push_back(depth);
+    graph->handles.push_back(handle);
+    graph->handleSlots.push_back(slot);
+    if(objectIndex != SCENE_NO_OBJECT){
+        if(objectIndex >= graph->objectSlots.size()){
+            graph->objectSlots.resize(objectIndex + 1, SCENE_NO_OBJECT);
+        }
+        graph->objectSlots[objectIndex] = slot;
+    }
+    graph->sorted = graph->sorted && (slot == 0 || graph->depths[slot - 1] <= depth);
+    graph->firstDirtyLevel = std::min(graph->firstDirtyLevel, depth);
+    return handle;
+}
+
+void setSceneNodeTransform(SceneGraph *graph, uint32_t handle, const mat4 &localTransform){
+    uint32_t slot = graph->handleSlots[handle];
+    graph->localTransforms[slot] = localTransform;
+    graph->dirty[slot] = 1;
+    graph->firstDirtyLevel = std::min(graph->firstDirtyLevel, graph->depths[slot]);
+}
+
+static void sortSceneGraph(SceneGraph *graph){
+    uint32_t nodeCount = graph->parents.size();
+    uint32_t levelCount = 0;
+    for(uint32_t i = 0; i < nodeCount; i++){
+        levelCount = std::max(levelCount, graph->depths[i] + 1);
+    }
+
+    //Counting sort by depth, stable so siblings keep their relative order
+    std::vector<uint32_t> levelStarts(levelCount + 1, 0);
+    for(uint32_t i = 0; i < nodeCount; i++){
+        levelStarts[graph->depths[i] + 1]++;
+    }
+    for(uint32_t level = 0; level < levelCount; level++){
+        levelStarts[level + 1] += levelStarts[level];
+    }
+    std::vector<uint32_t> newSlots(nodeCount);
+    std::vector<uint32_t> next(levelStarts.begin(), levelStarts.end() - 1);
+    for(uint32_t i = 0; i < nodeCount; i++){
+        newSlots[i] = next[graph->depths[i]]++;
+    }
+
+    std::vector<uint32_t> parents(nodeCount);
+    std::vector<mat4> localTransforms(nodeCount);
+    std::vector<mat4> worldTransforms(nodeCount);
+    std::vector<uint8_t> dirty(nodeCount);
+    std::vector<uint64_t> worldUpdates(nodeCount);
+    std::vector<uint32_t> objectIndices(nodeCount);
+    std::vector<uint32_t> depths(nodeCount);
+    std::vector<uint32_t> handles(nodeCount);
+    for(uint32_t i = 0; i < nodeCount; i++){
+        uint32_t slot = newSlots[i];
+        parents[slot] = graph->parents[i] == SCENE_NO_PARENT ? SCENE_NO_PARENT : newSlots[graph->parents[i]];
+        localTransforms[slot] = graph->localTransforms[i];
+        worldTransforms[slot] = graph->worldTransforms[i];
+        dirty[slot] = graph->dirty[i];
+        worldUpdates[slot] = graph->worldUpdates[i];
+        objectIndices[slot] = graph->objectIndices[i];
+        depths[slot] = graph->depths[i];
+        handles[slot] = graph->handles[i];
+        graph->handleSlots[graph->handles[i]] = slot;
+        if(graph->objectIndices[i] != SCENE_NO_OBJECT){
+            graph->objectSlots[graph->objectIndices[i]] = slot;
+        }
+    }
+
+    graph->parents.swap(parents);
+    graph->localTransforms.swap(localTransforms);
+    graph->worldTransforms.swap(worldTransforms);
+    graph->dirty.swap(dirty);
+    graph->worldUpdates.swap(worldUpdates);
+    graph->objectIndices.swap(objectIndices);
+    graph->depths.swap(depths);
+    graph->handles.swap(handles);
+    graph->levelStarts.swap(levelStarts);
+    graph->sorted = true;
+}
+
+uint64_t updateSceneGraph(SceneGraph *graph){
+    if(graph->firstDirtyLevel == UINT32_MAX){
+        return graph->updateCount;//Nothing moved, every world transform is still current
+    }
+    if(!graph->sorted || graph->levelStarts.back() != graph->parents.size()){
+        sortSceneGraph(graph);
+    }
+
+    graph->updateCount++;
+    uint32_t levelCount = graph->levelStarts.size() - 1;
+    for(uint32_t level = graph->firstDirtyLevel; level < levelCount; level++){
+        uint32_t begin = graph->levelStarts[level];
+        uint32_t end = graph->levelStarts[level + 1];
+        if(graph->workerCount == 0 || end - begin < SCENE_PARALLEL_MIN_NODES){
+            propagateRange(graph, begin, end);
+            continue;
+        }
+
+        //Nodes within a level only read their parents, which the previous level finished
+        {
+            std::lock_guard<std::mutex> lock(graph->mutex);
+            graph->jobBegin = begin;
+            graph->jobEnd = end;
+            graph->busyWorkers = graph->workerCount;
+            graph->jobGeneration++;
+        }
+        graph->jobReady.notify_all();
+        propagateShare(graph, graph->workerCount, begin, end);
+        std::unique_lock<std::mutex> lock(graph->mutex);
+        graph->jobDone.wait(lock, [&]{ return graph->busyWorkers == 0; });
+    }
+    graph->firstDirtyLevel = UINT32_MAX;
+    return graph->updateCount;
+}
+
+void createObjectScene(uint32_t workerCount, ObjectScene *scene){
+    createSceneGraph(workerCount, &scene->graph);
+    scene->root = addSceneNode(&scene->graph, SCENE_NO_PARENT, mat4(1.0f), SCENE_NO_OBJECT);
+    scene->objectCount = 0;
+}
+
+void destroyObjectScene(ObjectScene *scene){
+    destroySceneGraph(&scene->graph);
+}
+
+void syncObjectScene(ObjectScene *scene, uint32_t objectCount){
+    for(uint32_t i = scene->objectCount; i < objectCount; i++){
+        uint32_t parent = scene->root;
+        mat4 local(1.0f);
+        if(i > 0){
+            //Rows of SCENE_ROW_LENGTH, stacked into square layers that step away from the camera
+            uint32_t row = i / SCENE_ROW_LENGTH;
+            while(scene->rows.size() <= row){
+                uint32_t r = scene->rows.size();
+                vec3 rowPosition(-SCENE_ROW_LENGTH/2.0f, (float)(r % SCENE_ROW_LENGTH) - SCENE_ROW_LENGTH/2.0f, -(float)(r / SCENE_ROW_LENGTH));
+                scene->rows.push_back(addSceneNode(&scene->graph, scene->root, glm::translate(mat4(1.0f), rowPosition), SCENE_NO_OBJECT));
+            }
+            parent = scene->rows[row];
+            local = glm::translate(mat4(1.0f), vec3((float)(i % SCENE_ROW_LENGTH), 0.0f, 0.0f));
+        }
+
+        uint32_t handle = addSceneNode(&scene->graph, parent, local, i);
+        if(i % SCENE_SPIN_INTERVAL == 0){
+            scene->spinning.push_back({handle, local, 1.0f + (i % 7)*0.25f});
+        }
+    }
+    scene->objectCount = std::max(scene->objectCount, objectCount);
+}
+
+void animateObjectScene(ObjectScene *scene){
+    static auto startTime = std::chrono::high_resolution_clock::now();
+
+    auto currentTime = std::chrono::high_resolution_clock::now();
+    float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
+
+    for(const SpinningNode &node : scene->spinning){
+        setSceneNodeTransform(&scene->graph, node.handle, glm::rotate(node.base, time * node.speed * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f)));
+    }
+}
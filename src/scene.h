@@ -0,0 +1,80 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <glm/glm.hpp>
+
+using namespace glm;
+
+#define SCENE_NO_PARENT UINT32_MAX
+#define SCENE_NO_OBJECT UINT32_MAX
+#define SCENE_PARALLEL_MIN_NODES 4096//Levels smaller than this are propagated on the calling thread
+#define SCENE_ROW_LENGTH 64
+#define SCENE_SPIN_INTERVAL 8//Every nth object spins, the rest only move with their row
+
+//Transform hierarchy kept as parallel arrays in depth order, so a node's parent is always in an earlier level
+//and every level can be propagated in one pass with its nodes split between threads.
+//Nodes are addressed by the handle addSceneNode returns, the sorted slot of a node moves when nodes are added.
+struct SceneGraph{
+    std::vector<uint32_t> parents;//Slot of the parent, SCENE_NO_PARENT for roots
+    std::vector<mat4> localTransforms;
+    std::vector<mat4> worldTransforms;
+    std::vector<uint8_t> dirty;//Local transform changed since the last update
+    std::vector<uint64_t> worldUpdates;//Update in which the world transform last changed
+    std::vector<uint32_t> objectIndices;//Uniform ring slot the world transform feeds, SCENE_NO_OBJECT for pure groups
+    std::vector<uint32_t> depths;
+    std::vector<uint32_t> handles;//Slot to handle
+    std::vector<uint32_t> handleSlots;//Handle to slot
+    std::vector<uint32_t> objectSlots;//Object index to slot
+    std::vector<uint32_t> levelStarts;//Level d is [levelStarts[d], levelStarts[d + 1])
+    uint32_t firstDirtyLevel;//Levels above it cannot change in the next update
+    bool sorted;
+    uint64_t updateCount;
+
+    uint32_t workerCount;
+    std::thread* workers;
+    std::mutex mutex;
+    std::condition_variable jobReady;
+    std::condition_variable jobDone;
+    uint64_t jobGeneration;
+    uint32_t busyWorkers;
+    bool quit;
+    uint32_t jobBegin;
+    uint32_t jobEnd;
+};
+
+struct SpinningNode{
+    uint32_t handle;
+    mat4 base;
+    float speed;
+};
+
+//The scene drawn by default: rows of objects hang off a root, object 0 and every SCENE_SPIN_INTERVAL-th object spin in place
+struct ObjectScene{
+    SceneGraph graph;
+    uint32_t root;
+    std::vector<uint32_t> rows;//Handle per row of SCENE_ROW_LENGTH objects
+    std::vector<SpinningNode> spinning;
+    uint32_t objectCount;
+};
+
+void createSceneGraph(uint32_t workerCount, SceneGraph *graph);
+void destroySceneGraph(SceneGraph *graph);
+
+uint32_t addSceneNode(SceneGraph *graph, uint32_t parentHandle, const mat4 &localTransform, uint32_t objectIndex);
+void setSceneNodeTransform(SceneGraph *graph, uint32_t handle, const mat4 &localTransform);
+
+//Recomputes world transforms below every dirty node and returns the update number they were stamped with
+uint64_t updateSceneGraph(SceneGraph *graph);
+
+inline uint32_t sceneObjectSlot(const SceneGraph *graph, uint32_t objectIndex){
+    return objectIndex < graph->objectSlots.size() ? graph->objectSlots[objectIndex] : SCENE_NO_OBJECT;
+}
+
+void createObjectScene(uint32_t workerCount, ObjectScene *scene);
+void destroyObjectScene(ObjectScene *scene);
+
+//Adds nodes for objects registered since the last call
+void syncObjectScene(ObjectScene *scene, uint32_t objectCount);
+void animateObjectScene(ObjectScene *scene);
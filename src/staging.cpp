@@ -0,0 +1,87 @@
+#include "staging.h"
+#include <cstdio>
+#include <cstdlib>
+#include "vk.h"
+
+void createStagingRing(
+    VkDevice device,
+    DeviceAllocator *allocator,
+    VkDeviceSize size,
+    StagingRing *ring
+){
+    createBuffer(
+        device,
+        allocator,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        0,
+        size,
+        &ring->buffer,
+        &ring->allocation
+    );
+    ring->size = size;
+    ring->head = 0;
+    ring->committed = 0;
+    ring->tail = 0;
+}
+
+void destroyStagingRing(VkDevice device, DeviceAllocator *allocator, StagingRing *ring){
+    while(!ring->inFlight.empty()){
+        stagingRingRetire(device, ring, true);
+    }
+    destroyBuffer(device, allocator, ring->buffer, &ring->allocation);
+}
+
+void stagingRingRetire(VkDevice device, StagingRing *ring, bool waitOldest){
+    if(waitOldest && !ring->inFlight.empty()){
+        vkWaitForFences(device, 1, &ring->inFlight.front().fence, VK_TRUE, UINT64_MAX);
+    }
+
+    while(!ring->inFlight.empty() && vkGetFenceStatus(device, ring->inFlight.front().fence) == VK_SUCCESS){
+        ring->tail = ring->inFlight.front().end;
+        ring->inFlight.pop_front();
+    }
+
+    if(ring->inFlight.empty()){
+        ring->tail = ring->committed;
+    }
+}
+
+VkDeviceSize stagingRingAllocate(
+    VkDevice device,
+    StagingRing *ring,
+    VkDeviceSize size,
+    VkDeviceSize alignment
+){
+    if(size > ring->size){
+        printf("Staging allocation of %lu bytes does not fit in the %lu byte Staging Ring!\n", size, ring->size);
+        exit(EXIT_FAILURE);
+    }
+
+    VkDeviceSize physicalOffset = ring->head % ring->size;
+    VkDeviceSize alignedOffset = (physicalOffset + alignment - 1) & ~(alignment - 1);
+    uint64_t start = ring->head + (alignedOffset - physicalOffset);
+    physicalOffset = alignedOffset;
+    if(physicalOffset + size > ring->size){
+        start += ring->size - physicalOffset;//Skip the unusable end of this lap
+        physicalOffset = 0;
+    }
+
+    stagingRingRetire(device, ring, false);
+    while(start + size - ring->tail > ring->size){
+        if(ring->inFlight.empty()){
+            printf("Staging Ring is full of uncommitted data!\n");
+            exit(EXIT_FAILURE);
+        }
+        stagingRingRetire(device, ring, true);//Full: wait for the oldest upload instead of growing
+    }
+
+    ring->head = start + size;
+    return physicalOffset;
+}
+
+void stagingRingCommit(StagingRing *ring, VkFence fence){
+    //Everything handed out since the last commit is read by the submission that signals this fence
+    ring->inFlight.push_back({ring->head, fence});
+    ring->committed = ring->head;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <deque>
+#include "allocator.h"
+
+#define DEFAULT_STAGING_RING_SIZE (32ull*1024*1024)
+#define STAGING_COPY_ALIGNMENT 16
+
+struct StagingRegion{
+    uint64_t end;
+    VkFence fence;
+};
+
+//One persistently mapped host visible buffer shared by every host to device upload.
+//Offsets only grow; the physical offset is the position modulo the ring size.
+struct StagingRing{
+    VkBuffer buffer;
+    Allocation allocation;
+    VkDeviceSize size;
+    uint64_t head;//Next byte to hand out
+    uint64_t committed;//Everything before this belongs to a submitted region
+    uint64_t tail;//Oldest byte still read by an in-flight submission
+    std::deque<StagingRegion> inFlight;//Fences belong to whoever submitted the copies
+};
+
+void createStagingRing(
+    VkDevice device,
+    DeviceAllocator *allocator,
+    VkDeviceSize size,
+    StagingRing *ring
+);
+
+void destroyStagingRing(VkDevice device, DeviceAllocator *allocator, StagingRing *ring);
+
+VkDeviceSize stagingRingAllocate(
+    VkDevice device,
+    StagingRing *ring,
+    VkDeviceSize size,
+    VkDeviceSize alignment
+);
+
+void stagingRingCommit(StagingRing *ring, VkFence fence);
+void stagingRingRetire(VkDevice device, StagingRing *ring, bool waitOldest);
@@ -0,0 +1,413 @@
+#include "upload.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include "vk.h"
+#include "initvk.h"
+#include "defrag.h"
+
+void createUploadQueue(
+    VkDevice device,
+    DeviceAllocator *allocator,
+    const QueueFamilyIndices *queueFamilyIndices,
+    VkQueue transferQueue,
+    VkQueue graphicsQueue,
+    VkDeviceSize stagingRingSize,
+    GpuProfiler *profiler,
+    UploadQueue *uploadQueue
+){
+    uploadQueue->device = device;
+    uploadQueue->queue = transferQueue;
+    uploadQueue->graphicsQueue = graphicsQueue;
+    uploadQueue->queueFamilyIndex = queueFamilyIndices->transfer;
+    uploadQueue->graphicsQueueFamilyIndex = queueFamilyIndices->graphics;
+    uploadQueue->recordingToken = 1;
+    uploadQueue->completedToken = 0;
+    uploadQueue->profiler = profiler;
+    uploadQueue->defragmenter = nullptr;
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = uploadQueue->queueFamilyIndex;
+
+    if(vkCreateCommandPool(device, &poolInfo, nullptr, &uploadQueue->commandPool) != VK_SUCCESS){
+        printf("Failed to create Upload Command Pool!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    bool ownershipTransfer = uploadQueue->queueFamilyIndex != uploadQueue->graphicsQueueFamilyIndex;
+    uploadQueue->acquireCommandPool = VK_NULL_HANDLE;
+    if(ownershipTransfer){
+        poolInfo.queueFamilyIndex = uploadQueue->graphicsQueueFamilyIndex;
+        if(vkCreateCommandPool(device, &poolInfo, nullptr, &uploadQueue->acquireCommandPool) != VK_SUCCESS){
+            printf("Failed to create Upload Acquire Command Pool!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    for(int i = 0; i < UPLOAD_BATCH_COUNT; i++){
+        UploadBatch *batch = &uploadQueue->batches[i];
+        batch->commandBuffer = createCommandBuffer(device, uploadQueue->commandPool);
+        batch->acquireCommandBuffer = VK_NULL_HANDLE;
+        batch->transferFinishedSemaphore = VK_NULL_HANDLE;
+        batch->graphicsReadsSemaphore = VK_NULL_HANDLE;
+        batch->submitted = false;
+        if(vkCreateFence(device, &fenceInfo, nullptr, &batch->fence) != VK_SUCCESS){
+            printf("Failed to create Upload Fence!\n");
+            exit(EXIT_FAILURE);
+        }
+        if(ownershipTransfer){
+            batch->acquireCommandBuffer = createCommandBuffer(device, uploadQueue->acquireCommandPool);
+            if(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &batch->transferFinishedSemaphore) != VK_SUCCESS ||
+                vkCreateSemaphore(device, &semaphoreInfo, nullptr, &batch->graphicsReadsSemaphore) != VK_SUCCESS){
+                printf("Failed to create Upload Semaphore!\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    createStagingRing(device, allocator, stagingRingSize, &uploadQueue->stagingRing);
+}
+
+void destroyUploadQueue(UploadQueue *uploadQueue, DeviceAllocator *allocator){
+    for(int i = 0; i < UPLOAD_BATCH_COUNT; i++){
+        if(uploadQueue->batches[i].submitted){
+            vkWaitForFences(uploadQueue->device, 1, &uploadQueue->batches[i].fence, VK_TRUE, UINT64_MAX);
+        }
+    }
+    destroyStagingRing(uploadQueue->device, allocator, &uploadQueue->stagingRing);
+    for(int i = 0; i < UPLOAD_BATCH_COUNT; i++){
+        vkDestroyFence(uploadQueue->device, uploadQueue->batches[i].fence, nullptr);
+        if(uploadQueue->batches[i].transferFinishedSemaphore != VK_NULL_HANDLE){
+            vkDestroySemaphore(uploadQueue->device, uploadQueue->batches[i].transferFinishedSemaphore, nullptr);
+            vkDestroySemaphore(uploadQueue->device, uploadQueue->batches[i].graphicsReadsSemaphore, nullptr);
+        }
+    }
+    vkDestroyCommandPool(uploadQueue->device, uploadQueue->commandPool, nullptr);
+    if(uploadQueue->acquireCommandPool != VK_NULL_HANDLE){
+        vkDestroyCommandPool(uploadQueue->device, uploadQueue->acquireCommandPool, nullptr);
+    }
+}
+
+static void updateCompletedToken(UploadQueue *uploadQueue){
+    while(uploadQueue->completedToken + 1 < uploadQueue->recordingToken){
+        UploadBatch *batch = &uploadQueue->batches[(uploadQueue->completedToken + 1) % UPLOAD_BATCH_COUNT];
+        if(vkGetFenceStatus(uploadQueue->device, batch->fence) != VK_SUCCESS){
+            break;
+        }
+        uploadQueue->completedToken++;
+    }
+}
+
+UploadToken uploadQueueWrite(
+    UploadQueue *uploadQueue,
+    VkBuffer dstBuffer,
+    VkDeviceSize dstOffset,
+    const void* data,
+    VkDeviceSize size
+){
+    StagingRing *ring = &uploadQueue->stagingRing;
+    //Small enough chunks that a batch can always be flushed and the ring drained to make room for the next one
+    VkDeviceSize maxChunkSize = ring->size/4;
+
+    for(VkDeviceSize uploaded = 0; uploaded < size;){
+        VkDeviceSize chunkSize = size - uploaded < maxChunkSize ? size - uploaded : maxChunkSize;
+        if(ring->head - ring->committed + 2*chunkSize + STAGING_COPY_ALIGNMENT > ring->size){
+            uploadQueueFlush(uploadQueue);
+        }
+
+        VkDeviceSize stagingOffset = stagingRingAllocate(uploadQueue->device, ring, chunkSize, STAGING_COPY_ALIGNMENT);
+        memcpy((char*)ring->allocation.mapped + stagingOffset, (const char*)data + uploaded, chunkSize);
+        uploadQueueCopy(uploadQueue, ring->buffer, stagingOffset, dstBuffer, dstOffset + uploaded, chunkSize);
+
+        uploaded += chunkSize;
+    }
+
+    return uploadQueue->recordingToken;
+}
+
+UploadToken writeBufferData(
+    UploadQueue *uploadQueue,
+    VkBuffer dstBuffer,
+    const Allocation *dstAllocation,
+    VkDeviceSize dstOffset,
+    const void* data,
+    VkDeviceSize size,
+    bool unreferenced
+){
+    if(unreferenced && isDirectlyWritable(dstAllocation)){
+        //Host writes are made visible by the next vkQueueSubmit, so there is nothing to wait for
+        if(uploadQueue->defragmenter != nullptr){
+            defragmenterBufferWritten(uploadQueue->defragmenter, dstBuffer, uploadQueue->completedToken);
+        }
+        memcpy((char*)dstAllocation->mapped + dstOffset, data, size);
+        return uploadQueue->completedToken;
+    }
+    return uploadQueueWrite(uploadQueue, dstBuffer, dstOffset, data, size);
+}
+
+UploadToken uploadQueueCopy(
+    UploadQueue *uploadQueue,
+    VkBuffer srcBuffer,
+    VkDeviceSize srcOffset,
+    VkBuffer dstBuffer,
+    VkDeviceSize dstOffset,
+    VkDeviceSize size
+){
+    if(uploadQueue->defragmenter != nullptr){
+        defragmenterBufferWritten(uploadQueue->defragmenter, dstBuffer, uploadQueue->recordingToken);
+    }
+    PendingCopy copy{};
+    copy.srcBuffer = srcBuffer;
+    copy.dstBuffer = dstBuffer;
+    copy.region.srcOffset = srcOffset;
+    copy.region.dstOffset = dstOffset;
+    copy.region.size = size;
+    uploadQueue->pendingCopies.push_back(copy);
+
+    return uploadQueue->recordingToken;
+}
+
+UploadToken uploadQueueFlush(UploadQueue *uploadQueue){
+    if(uploadQueue->pendingCopies.empty()){
+        return uploadQueue->recordingToken - 1;
+    }
+
+    UploadToken token = uploadQueue->recordingToken;
+    uint32_t batchIndex = token % UPLOAD_BATCH_COUNT;
+    UploadBatch *batch = &uploadQueue->batches[batchIndex];
+    StagingRing *ring = &uploadQueue->stagingRing;
+
+    if(batch->submitted){
+        //Every batch is in flight, so this is the only place an upload can block
+        vkWaitForFences(uploadQueue->device, 1, &batch->fence, VK_TRUE, UINT64_MAX);
+        if(uploadQueue->completedToken < token - UPLOAD_BATCH_COUNT){
+            uploadQueue->completedToken = token - UPLOAD_BATCH_COUNT;//Its fence covers every earlier submission too
+        }
+        for(const StagingRegion &region : ring->inFlight){
+            if(region.fence == batch->fence){
+                stagingRingRetire(uploadQueue->device, ring, true);
+                break;
+            }
+        }
+        vkResetFences(uploadQueue->device, 1, &batch->fence);
+        batch->submitted = false;
+        gpuProfilerCollect(uploadQueue->profiler, batchIndex);
+    }
+
+    std::vector<PendingCopy> &copies = uploadQueue->pendingCopies;
+
+    vkResetCommandBuffer(batch->commandBuffer, 0);
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    //Geometry and uniforms feed the vertex stages, indirect draw records are read as storage by the cull shader
+    VkPipelineStageFlags consumerStages = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    VkAccessFlags consumerAccess = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+
+    vkBeginCommandBuffer(batch->commandBuffer, &beginInfo);
+    if(batch->acquireCommandBuffer == VK_NULL_HANDLE){
+        //Uploads share the graphics queue, so waiting here keeps the copies behind reads by frames submitted earlier
+        vkCmdPipelineBarrier(
+            batch->commandBuffer,
+            consumerStages,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0,
+            0, nullptr,
+            0, nullptr,
+            0, nullptr
+        );
+    }
+    gpuProfilerBeginScope(uploadQueue->profiler, batchIndex, uploadQueue->queueFamilyIndex);
+    gpuProfilerBeginRegion(uploadQueue->profiler, batchIndex, batch->commandBuffer, "upload");
+
+    //Consecutive copies between the same pair of buffers share a vkCmdCopyBuffer, copies stay in submission order.
+    //A copy whose destination overlaps one recorded earlier in the batch goes after a barrier, so the later write wins.
+    std::vector<VkBufferCopy> regions;
+    std::vector<const PendingCopy*> written;//Since the last barrier
+    for(size_t i = 0; i < copies.size(); i++){
+        bool overlaps = false;
+        for(const PendingCopy *earlier : written){
+            overlaps = overlaps || (earlier->dstBuffer == copies[i].dstBuffer &&
+                earlier->region.dstOffset < copies[i].region.dstOffset + copies[i].region.size &&
+                copies[i].region.dstOffset < earlier->region.dstOffset + earlier->region.size);
+        }
+        if(overlaps){
+            if(!regions.empty()){
+                vkCmdCopyBuffer(batch->commandBuffer, copies[i - 1].srcBuffer, copies[i - 1].dstBuffer, regions.size(), regions.data());
+                regions.clear();
+            }
+            VkMemoryBarrier barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            vkCmdPipelineBarrier(
+                batch->commandBuffer,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                0,
+                1, &barrier,
+                0, nullptr,
+                0, nullptr
+            );
+            written.clear();
+        }
+        regions.push_back(copies[i].region);
+        written.push_back(&copies[i]);
+        bool lastOfRun = i + 1 == copies.size() || copies[i + 1].srcBuffer != copies[i].srcBuffer || copies[i + 1].dstBuffer != copies[i].dstBuffer;
+        if(lastOfRun){
+            vkCmdCopyBuffer(batch->commandBuffer, copies[i].srcBuffer, copies[i].dstBuffer, regions.size(), regions.data());
+            regions.clear();
+        }
+    }
+    gpuProfilerEndRegion(uploadQueue->profiler, batchIndex, batch->commandBuffer);
+
+    if(batch->acquireCommandBuffer == VK_NULL_HANDLE){
+        //Later submissions on this queue read the data as vertices, indices, uniforms or storage buffers
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = consumerAccess;
+        vkCmdPipelineBarrier(
+            batch->commandBuffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            consumerStages,
+            0,
+            1, &barrier,
+            0, nullptr,
+            0, nullptr
+        );
+        vkEndCommandBuffer(batch->commandBuffer);
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &batch->commandBuffer;
+
+        if(vkQueueSubmit(uploadQueue->queue, 1, &submitInfo, batch->fence) != VK_SUCCESS){
+            printf("Failed to submit Upload Batch!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    else{
+        //Exclusive buffers written on the transfer family are released to the graphics family range by range,
+        //and the graphics queue acquires them in a small submission that waits on the copies.
+        std::vector<VkBufferMemoryBarrier> ownershipBarriers(copies.size());
+        for(size_t i = 0; i < copies.size(); i++){
+            VkBufferMemoryBarrier *barrier = &ownershipBarriers[i];
+            barrier->sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            barrier->srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier->dstAccessMask = 0;
+            barrier->srcQueueFamilyIndex = uploadQueue->queueFamilyIndex;
+            barrier->dstQueueFamilyIndex = uploadQueue->graphicsQueueFamilyIndex;
+            barrier->buffer = copies[i].dstBuffer;
+            barrier->offset = copies[i].region.dstOffset;
+            barrier->size = copies[i].region.size;
+        }
+        vkCmdPipelineBarrier(
+            batch->commandBuffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+            0,
+            0, nullptr,
+            ownershipBarriers.size(), ownershipBarriers.data(),
+            0, nullptr
+        );
+        vkEndCommandBuffer(batch->commandBuffer);
+
+        for(VkBufferMemoryBarrier &barrier : ownershipBarriers){
+            barrier.srcAccessMask = 0;
+            barrier.dstAccessMask = consumerAccess;
+        }
+        vkResetCommandBuffer(batch->acquireCommandBuffer, 0);
+        vkBeginCommandBuffer(batch->acquireCommandBuffer, &beginInfo);
+        vkCmdPipelineBarrier(
+            batch->acquireCommandBuffer,
+            consumerStages,
+            consumerStages,
+            0,
+            0, nullptr,
+            ownershipBarriers.size(), ownershipBarriers.data(),
+            0, nullptr
+        );
+        vkEndCommandBuffer(batch->acquireCommandBuffer);
+
+        //Frames in flight may still read ranges the copies overwrite. Nothing orders the transfer queue behind them,
+        //so an empty graphics submission signals once everything submitted there so far is done and the copies wait on it.
+        VkSubmitInfo readsSubmitInfo{};
+        readsSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        readsSubmitInfo.signalSemaphoreCount = 1;
+        readsSubmitInfo.pSignalSemaphores = &batch->graphicsReadsSemaphore;
+        if(vkQueueSubmit(uploadQueue->graphicsQueue, 1, &readsSubmitInfo, VK_NULL_HANDLE) != VK_SUCCESS){
+            printf("Failed to submit Upload Read Barrier!\n");
+            exit(EXIT_FAILURE);
+        }
+
+        VkPipelineStageFlags transferStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        VkSubmitInfo transferSubmitInfo{};
+        transferSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        transferSubmitInfo.waitSemaphoreCount = 1;
+        transferSubmitInfo.pWaitSemaphores = &batch->graphicsReadsSemaphore;
+        transferSubmitInfo.pWaitDstStageMask = &transferStage;
+        transferSubmitInfo.commandBufferCount = 1;
+        transferSubmitInfo.pCommandBuffers = &batch->commandBuffer;
+        transferSubmitInfo.signalSemaphoreCount = 1;
+        transferSubmitInfo.pSignalSemaphores = &batch->transferFinishedSemaphore;
+
+        if(vkQueueSubmit(uploadQueue->queue, 1, &transferSubmitInfo, VK_NULL_HANDLE) != VK_SUCCESS){
+            printf("Failed to submit Upload Batch!\n");
+            exit(EXIT_FAILURE);
+        }
+
+        VkSubmitInfo acquireSubmitInfo{};
+        acquireSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        acquireSubmitInfo.waitSemaphoreCount = 1;
+        acquireSubmitInfo.pWaitSemaphores = &batch->transferFinishedSemaphore;
+        acquireSubmitInfo.pWaitDstStageMask = &consumerStages;
+        acquireSubmitInfo.commandBufferCount = 1;
+        acquireSubmitInfo.pCommandBuffers = &batch->acquireCommandBuffer;
+
+        //The fence is on the acquire so it also covers the copies it waited for
+        if(vkQueueSubmit(uploadQueue->graphicsQueue, 1, &acquireSubmitInfo, batch->fence) != VK_SUCCESS){
+            printf("Failed to submit Upload Acquire Batch!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    batch->submitted = true;
+    gpuProfilerSubmitted(uploadQueue->profiler, batchIndex);
+
+    if(ring->head != ring->committed){
+        stagingRingCommit(ring, batch->fence);
+    }
+
+    copies.clear();
+    uploadQueue->recordingToken++;
+    return token;
+}
+
+bool uploadQueuePoll(UploadQueue *uploadQueue, UploadToken token){
+    if(token > uploadQueue->completedToken){
+        updateCompletedToken(uploadQueue);
+    }
+    return token <= uploadQueue->completedToken;
+}
+
+void uploadQueueWait(UploadQueue *uploadQueue, UploadToken token){
+    if(token >= uploadQueue->recordingToken){
+        uploadQueueFlush(uploadQueue);
+    }
+    if(token > uploadQueue->completedToken && token < uploadQueue->recordingToken){
+        UploadBatch *batch = &uploadQueue->batches[token % UPLOAD_BATCH_COUNT];
+        vkWaitForFences(uploadQueue->device, 1, &batch->fence, VK_TRUE, UINT64_MAX);
+        updateCompletedToken(uploadQueue);
+    }
+}
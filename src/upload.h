@@ -0,0 +1,93 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include "allocator.h"
+#include "staging.h"
+#include "gpuprofiler.h"
+
+struct QueueFamilyIndices;
+struct Defragmenter;
+
+#define UPLOAD_BATCH_COUNT 4
+
+//Identifies the batch an upload was recorded into. Tokens complete in increasing order.
+typedef uint64_t UploadToken;
+
+struct UploadBatch{
+    VkCommandBuffer commandBuffer;
+    VkCommandBuffer acquireCommandBuffer;//Graphics side of the ownership transfer, only with a separate transfer family
+    VkSemaphore transferFinishedSemaphore;
+    VkSemaphore graphicsReadsSemaphore;//Signalled behind every graphics submission so far, the copies wait on it
+    VkFence fence;
+    bool submitted;
+};
+
+struct PendingCopy{
+    VkBuffer srcBuffer;
+    VkBuffer dstBuffer;
+    VkBufferCopy region;
+};
+
+struct UploadQueue{
+    VkDevice device;
+    VkQueue queue;
+    VkQueue graphicsQueue;
+    uint32_t queueFamilyIndex;
+    uint32_t graphicsQueueFamilyIndex;
+    VkCommandPool commandPool;
+    VkCommandPool acquireCommandPool;
+    StagingRing stagingRing;
+    UploadBatch batches[UPLOAD_BATCH_COUNT];//Token t is recorded into batches[t % UPLOAD_BATCH_COUNT]
+    std::vector<PendingCopy> pendingCopies;
+    UploadToken recordingToken;//Token of the batch gathering copies right now
+    UploadToken completedToken;
+    GpuProfiler *profiler;//Batch i records into scope i, may be null
+    Defragmenter *defragmenter;//Told about every write so it never moves a buffer mid-write, may be null
+};
+
+void createUploadQueue(
+    VkDevice device,
+    DeviceAllocator *allocator,
+    const QueueFamilyIndices *queueFamilyIndices,
+    VkQueue transferQueue,
+    VkQueue graphicsQueue,
+    VkDeviceSize stagingRingSize,
+    GpuProfiler *profiler,
+    UploadQueue *uploadQueue
+);
+
+void destroyUploadQueue(UploadQueue *uploadQueue, DeviceAllocator *allocator);
+
+UploadToken uploadQueueWrite(
+    UploadQueue *uploadQueue,
+    VkBuffer dstBuffer,
+    VkDeviceSize dstOffset,
+    const void* data,
+    VkDeviceSize size
+);
+
+//Writes host visible device local memory in place, but only when unreferenced says no submitted work can still read
+//the range, because it is fresh or its readers have been waited on. Anything else goes through the upload queue,
+//which orders the copy behind those reads.
+UploadToken writeBufferData(
+    UploadQueue *uploadQueue,
+    VkBuffer dstBuffer,
+    const Allocation *dstAllocation,
+    VkDeviceSize dstOffset,
+    const void* data,
+    VkDeviceSize size,
+    bool unreferenced
+);
+
+UploadToken uploadQueueCopy(
+    UploadQueue *uploadQueue,
+    VkBuffer srcBuffer,
+    VkDeviceSize srcOffset,
+    VkBuffer dstBuffer,
+    VkDeviceSize dstOffset,
+    VkDeviceSize size
+);
+
+UploadToken uploadQueueFlush(UploadQueue *uploadQueue);
+bool uploadQueuePoll(UploadQueue *uploadQueue, UploadToken token);
+void uploadQueueWait(UploadQueue *uploadQueue, UploadToken token);
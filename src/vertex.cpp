@@ -3,131 +3,42 @@
 #include <cstring>
 #include "vk.h"
 
-VkVertexInputBindingDescription getBindingDescription(){
-    VkVertexInputBindingDescription bindingDescription{};
-    bindingDescription.binding = 0;
-    bindingDescription.stride = sizeof(Vertex);
-    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-
-    return bindingDescription;
+VkVertexInputBindingDescription* getBindingDescriptions(uint32_t *bindingDescriptionCount){
+    VkVertexInputBindingDescription* bindingDescriptions = (VkVertexInputBindingDescription*)malloc(sizeof(VkVertexInputBindingDescription)*2);
+    bindingDescriptions[0].binding = VERTEX_BINDING;
+    bindingDescriptions[0].stride = sizeof(Vertex);
+    bindingDescriptions[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+    bindingDescriptions[1].binding = INSTANCE_BINDING;
+    bindingDescriptions[1].stride = sizeof(InstanceData);
+    bindingDescriptions[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+    *bindingDescriptionCount = 2;
+    return bindingDescriptions;
 };
 
 VkVertexInputAttributeDescription* getAttributeDescriptions(uint32_t *attrDescriptionCount){
-    VkVertexInputAttributeDescription* attrDescriptions = (VkVertexInputAttributeDescription*)malloc(sizeof(VkVertexInputAttributeDescription)*2);
-    attrDescriptions[0].binding = 0;
+    //A mat4 attribute takes one location per column
+    const uint32_t count = 2 + 4 + 1;
+    VkVertexInputAttributeDescription* attrDescriptions = (VkVertexInputAttributeDescription*)malloc(sizeof(VkVertexInputAttributeDescription)*count);
+    attrDescriptions[0].binding = VERTEX_BINDING;
     attrDescriptions[0].location = 0;
     attrDescriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
     attrDescriptions[0].offset = offsetof(Vertex, pos);
-    attrDescriptions[1].binding = 0;
+    attrDescriptions[1].binding = VERTEX_BINDING;
     attrDescriptions[1].location = 1;
     attrDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
     attrDescriptions[1].offset = offsetof(Vertex, color);
-
-    *attrDescriptionCount = 2;
+    for(uint32_t column = 0; column < 4; column++){
+        attrDescriptions[2 + column].binding = INSTANCE_BINDING;
+        attrDescriptions[2 + column].location = 2 + column;
+        attrDescriptions[2 + column].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+        attrDescriptions[2 + column].offset = offsetof(InstanceData, transform) + sizeof(vec4)*column;
+    }
+    attrDescriptions[6].binding = INSTANCE_BINDING;
+    attrDescriptions[6].location = 6;
+    attrDescriptions[6].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+    attrDescriptions[6].offset = offsetof(InstanceData, color);
+
+    *attrDescriptionCount = count;
     return attrDescriptions;
 }
-
-
-void createVertexBuffer(
-    VkDevice device, 
-    VkPhysicalDevice physicalDevice,
-    VkCommandPool commandPool,
-    VkQueue transferQueue,
-    Vertex* vertices, 
-    uint32_t verticesSize,
-    VkBuffer *vertexBuffer,
-    VkDeviceMemory *vertexBufferMemory
-){
-    VkDeviceSize bufferSize = sizeof(Vertex)*verticesSize;
-
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    createBuffer(
-        device,
-        physicalDevice,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        bufferSize,
-        &stagingBuffer,
-        &stagingBufferMemory
-    );
-
-    void* data;
-    vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, vertices, bufferSize);
-    vkUnmapMemory(device, stagingBufferMemory);
-
-    createBuffer(
-        device, 
-        physicalDevice,
-        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-        bufferSize,
-        vertexBuffer,
-        vertexBufferMemory
-    );
-
-    copyBuffer(
-        device,
-        commandPool,
-        transferQueue,
-        stagingBuffer,
-        *vertexBuffer,
-        bufferSize
-    );
-
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
-}
-
-void createIndexBuffer(
-    VkDevice device, 
-    VkPhysicalDevice physicalDevice,
-    VkCommandPool transientCommandPool,
-    VkQueue transferQueue,
-    uint32_t* indices, 
-    uint32_t indicesSize,
-    VkBuffer *indexBuffer,
-    VkDeviceMemory *indexBufferMemory
-){
-    VkDeviceSize bufferSize = sizeof(uint32_t)*indicesSize;
-
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    createBuffer(
-        device,
-        physicalDevice,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        bufferSize,
-        &stagingBuffer,
-        &stagingBufferMemory
-    );
-
-    void* data;
-    vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, indices, bufferSize);
-    vkUnmapMemory(device, stagingBufferMemory);
-
-    createBuffer(
-        device, 
-        physicalDevice,
-        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-        bufferSize,
-        indexBuffer,
-        indexBufferMemory
-    );
-
-    copyBuffer(
-        device,
-        transientCommandPool,
-        transferQueue,
-        stagingBuffer,
-        *indexBuffer,
-        bufferSize
-    );
-
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
-}
\ No newline at end of file
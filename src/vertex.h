@@ -4,31 +4,19 @@
 
 using namespace glm;
 
+#define VERTEX_BINDING 0
+#define INSTANCE_BINDING 1
+
 struct Vertex{
     vec2 pos;
     vec3 color;
 };
-VkVertexInputBindingDescription getBindingDescription();
-VkVertexInputAttributeDescription* getAttributeDescriptions(uint32_t *attrDescriptionsSize);
 
-void createVertexBuffer(
-    VkDevice device, 
-    VkPhysicalDevice physicalDevice,
-    VkCommandPool commandPool,
-    VkQueue transferQueue,
-    Vertex* vertices, 
-    uint32_t verticesSize,
-    VkBuffer *vertexBuffer,
-    VkDeviceMemory *vertexBufferMemory
-);
+//Per-instance attributes, stepped once per instance from the second binding
+struct InstanceData{
+    mat4 transform;//Applied before the object's model matrix
+    vec4 color;//Multiplied into the vertex color
+};
 
-void createIndexBuffer(
-    VkDevice device, 
-    VkPhysicalDevice physicalDevice,
-    VkCommandPool transientCommandPool,
-    VkQueue transferQueue,
-    uint32_t* indices, 
-    uint32_t indicesSize,
-    VkBuffer *indexBuffer,
-    VkDeviceMemory *indexBufferMemory
-);
\ No newline at end of file
+VkVertexInputBindingDescription* getBindingDescriptions(uint32_t *bindingDescriptionsSize);
+VkVertexInputAttributeDescription* getAttributeDescriptions(uint32_t *attrDescriptionsSize);
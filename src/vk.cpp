@@ -1,67 +1,99 @@
 #include "vk.h"
 #include <cstdlib>
 #include <cstdio>
+#include "initvk.h"
 
 void VulkanObjects::cleanUp(){
-    for(int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++){
-        vkDestroyBuffer(device, uniformBuffers[i], nullptr);
-        vkFreeMemory(device, uniformBuffersMemory[i], nullptr);
+    destroyFrameStats(&frameStats);
+    destroyFrameCapture(&frameCapture);
+    destroyFrameResources(this);
+    destroyGpuProfiler(&gpuProfiler);
+    destroyDefragmenter(&defragmenter);
+    uploadQueue.defragmenter = nullptr;
+    if(gpuDriven){
+        destroyIndirectRenderer(&indirectRenderer);
+        vkDestroyRenderPass(device, graphRenderPass, nullptr);
     }
-    vkDestroyDescriptorPool(device, descriptorPool, nullptr);
-    vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
-    vkDestroyBuffer(device, vertexBuffer, nullptr);
-    vkFreeMemory(device, vertexBufferMemory, nullptr);
-    vkDestroyBuffer(device, indexBuffer, nullptr);
-    vkFreeMemory(device, indexBufferMemory, nullptr);
-    for(int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++){
-        vkDestroySemaphore(device, syncObjects[i].imageAvailableSemaphore, nullptr);
-        vkDestroySemaphore(device, syncObjects[i].renderFinishedSemaphore, nullptr);
-        vkDestroyFence(device, syncObjects[i].inFlightFence, nullptr);
+    if(cpuCulling){
+        destroyCpuCuller(&cpuCuller);
     }
+    destroyObjectScene(&objectScene);
+    vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+    destroyGeometryStore(device, &allocator, &geometryStore);
+    destroyUploadQueue(&uploadQueue, &allocator);
     vkDestroyCommandPool(device, commandPool, nullptr);
-    vkDestroyCommandPool(device, transientCommandPool, nullptr);
     for(int i = 0; i < swapchainImageCount; i++){
         vkDestroyFramebuffer(device, swapchainFramebuffers[i], nullptr);
         vkDestroyImageView(device, swapchainImageViews[i], nullptr);
     }
     free(swapchainFramebuffers);
     free(swapchainImageViews);
-    free(swapchainImages);
     vkDestroyPipeline(device, graphicsPipeline, nullptr);
+    vkDestroyPipelineCache(device, pipelineCache, nullptr);
     vkDestroyPipelineLayout(device, graphicsPipelineLayout, nullptr);
     vkDestroyRenderPass(device, renderPass, nullptr);
-    vkDestroySwapchainKHR(device, swapchain, nullptr);
+    if(headless){
+        destroyOffscreenTargets(this);
+    }
+    else{
+        vkDestroySwapchainKHR(device, swapchain, nullptr);
+    }
+    free(swapchainImages);//Offscreen targets are destroyed through it
+    destroyAllocator(&allocator);
     vkDestroyDevice(device, nullptr);
-    vkDestroySurfaceKHR(instance, surface, nullptr);
+    if(!headless){
+        vkDestroySurfaceKHR(instance, surface, nullptr);
+    }
     vkDestroyInstance(instance, nullptr);
 }
 
 uint32_t findMemoryType(
-    VkPhysicalDevice physicalDevice,
+    const VkPhysicalDeviceMemoryProperties *memProperties,
     uint32_t typeFilter, 
-    VkMemoryPropertyFlags propertyFlags
+    VkMemoryPropertyFlags requiredFlags,
+    VkMemoryPropertyFlags preferredFlags
 ){
-    VkPhysicalDeviceMemoryProperties memProperties;
-    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+    uint32_t bestType = UINT32_MAX;
+    int bestScore = -1;
 
-    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-        if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & propertyFlags) == propertyFlags) {
-            return i;
+    for (uint32_t i = 0; i < memProperties->memoryTypeCount; i++) {
+        VkMemoryPropertyFlags flags = memProperties->memoryTypes[i].propertyFlags;
+        if (!(typeFilter & (1 << i)) || (flags & requiredFlags) != requiredFlags) {
+            continue;
+        }
+        //Every preferred flag outweighs all unrequested ones, so e.g. staging memory stays out of a small BAR heap
+        int score = 64*__builtin_popcount(flags & preferredFlags) - __builtin_popcount(flags & ~(requiredFlags | preferredFlags));
+        if (score > bestScore) {
+            bestType = i;
+            bestScore = score;
         }
     } 
 
-    printf("No suitable GPU Memory Type found!\n");
-    exit(EXIT_FAILURE);
+    if(bestType == UINT32_MAX){
+        printf("No suitable GPU Memory Type found!\n");
+        exit(EXIT_FAILURE);
+    }
+    return bestType;
+}
+
+uint64_t currentSceneVersion(const VulkanObjects *vko){
+    //Each counter only grows, so the sum changes whenever anything a cached command buffer depends on does
+    return vko->sceneVersion + vko->geometryStore.version + vko->instanceScene.version + vko->cpuCuller.version + vko->defragmenter.movesApplied;
+}
+
+uint32_t frameProfilerScope(uint32_t commandBufferIndex){
+    return UPLOAD_BATCH_COUNT + commandBufferIndex;
 }
 
 void createBuffer(
     VkDevice device, 
-    VkPhysicalDevice physicalDevice,
+    DeviceAllocator *allocator,
     VkBufferUsageFlags usage, 
-    VkMemoryPropertyFlags properties,
+    VkMemoryPropertyFlags requiredProperties,
+    VkMemoryPropertyFlags preferredProperties,
     VkDeviceSize bufferSize, 
     VkBuffer *buffer, 
-    VkDeviceMemory *memory
+    Allocation *allocation
 ){
     VkBufferCreateInfo bufferInfo{};
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -77,62 +109,32 @@ void createBuffer(
     VkMemoryRequirements memRequirements;
     vkGetBufferMemoryRequirements(device, *buffer, &memRequirements);
 
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(
-        physicalDevice,
-        memRequirements.memoryTypeBits, 
-        properties
-    );
-
-    if(vkAllocateMemory(device, &allocInfo, nullptr, memory)!=VK_SUCCESS){
-        printf("Failed to allocate Buffer Memory!\n");
-        exit(EXIT_FAILURE);
+    //Buffers are filed under their most specific usage, images go through allocateMemory directly
+    MemoryCategory category = MEMORY_CATEGORY_OTHER;
+    if(usage & VK_BUFFER_USAGE_VERTEX_BUFFER_BIT){
+        category = MEMORY_CATEGORY_VERTEX;
     }
+    else if(usage & VK_BUFFER_USAGE_INDEX_BUFFER_BIT){
+        category = MEMORY_CATEGORY_INDEX;
+    }
+    else if(usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT){
+        category = MEMORY_CATEGORY_UNIFORM;
+    }
+    else if(usage == VK_BUFFER_USAGE_TRANSFER_SRC_BIT){
+        category = MEMORY_CATEGORY_STAGING;
+    }
+
+    *allocation = allocateMemory(allocator, &memRequirements, requiredProperties, preferredProperties, category);
 
-    vkBindBufferMemory(device, *buffer, *memory, 0);//If the offset is non-zero, then it is required to be divisible by memRequirements.alignment.
+    vkBindBufferMemory(device, *buffer, allocation->memory, allocation->offset);//The allocator keeps the offset divisible by memRequirements.alignment.
 }
 
-void copyBuffer(
+void destroyBuffer(
     VkDevice device,
-    VkCommandPool commandPool,
-    VkQueue transferQueue,
-    VkBuffer srcBuffer, 
-    VkBuffer dstBuffer, 
-    VkDeviceSize size
-    ){
-    
-    VkCommandBufferAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandPool = commandPool;
-    allocInfo.commandBufferCount = 1;
-
-    VkCommandBuffer commandBuffer;
-    vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
-
-    VkCommandBufferBeginInfo beginInfo{};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-
-    vkBeginCommandBuffer(commandBuffer, &beginInfo);
-
-    VkBufferCopy copyRegion{};
-    copyRegion.srcOffset = 0;
-    copyRegion.dstOffset = 0;
-    copyRegion.size = size;
-    vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
-
-    vkEndCommandBuffer(commandBuffer);
-
-    VkSubmitInfo submitInfo{};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffer;
-
-    vkQueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE);
-    vkQueueWaitIdle(transferQueue);
-
-    vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
-}
\ No newline at end of file
+    DeviceAllocator *allocator,
+    VkBuffer buffer,
+    Allocation *allocation
+){
+    vkDestroyBuffer(device, buffer, nullptr);
+    freeMemory(allocator, allocation);
+}
@@ -1,11 +1,30 @@
 #pragma once
 #include <vulkan/vulkan.h>
+#include <vector>
+#include "allocator.h"
+#include "upload.h"
+#include "geometry.h"
+#include "defrag.h"
+#include "recorder.h"
+#include "descriptor.h"
+#include "instance.h"
+#include "indirect.h"
+#include "cull.h"
+#include "scene.h"
+#include "rendergraph.h"
+#include "framestats.h"
+#include "gpuprofiler.h"
+#include "capture.h"
 
-#define MAX_FRAMES_IN_FLIGHT 2
+#define DEFAULT_FRAMES_IN_FLIGHT 2
+#define MAX_FRAMES_IN_FLIGHT 8//Upper bound for --frames, per-frame resources are sized by VulkanObjects::framesInFlight
+
+static_assert(CAPTURE_MAX_SLOTS >= MAX_FRAMES_IN_FLIGHT, "Every frame slot needs a capture slot");
 
 struct QueueFamilyIndices{
     uint32_t graphics = UINT32_MAX;
     uint32_t present = UINT32_MAX;
+    uint32_t transfer = UINT32_MAX;//Same as graphics when the device has no separate transfer family
 };
 
 struct SynchronisationObjects{
@@ -14,6 +33,17 @@ struct SynchronisationObjects{
     VkFence inFlightFence;
 };
 
+//Replaced by a recreation while frames using it may still be in flight
+struct RetiredSwapchain{
+    VkSwapchainKHR swapchain;
+    uint32_t imageCount;
+    VkImageView* imageViews;
+    VkFramebuffer* framebuffers;
+    VkSemaphore* renderFinishedSemaphores;//Only when frame resources were rebuilt with it, presents queued on it may still wait on them
+    uint32_t renderFinishedSemaphoreCount;
+    uint32_t pendingFrames;//Bit per frame slot whose fence hasn't signalled since
+};
+
 struct VulkanObjects{
     VkInstance instance;
     VkSurfaceKHR surface;
@@ -24,59 +54,87 @@ struct VulkanObjects{
     VkDevice device;
     VkQueue graphicsQueue;
     VkQueue presentQueue;
+    VkQueue transferQueue;
     VkSurfaceCapabilitiesKHR capabilities;
     VkSurfaceFormatKHR surfaceFormat;
     VkPresentModeKHR presentMode;
+    VkPresentModeKHR requestedPresentMode;//May be unsupported, presentMode is what it fell back to
     VkExtent2D swapchainExtent;
     VkSwapchainKHR swapchain;
     VkImage* swapchainImages;
     uint32_t swapchainImageCount;
     VkImageView* swapchainImageViews;
+    bool headless;//No window or swapchain, swapchainImages are offscreen targets owned by the device
+    Allocation* offscreenAllocations;//Headless only
+    VkImageLayout targetFinalLayout;//Where frames leave the swapchain image, TRANSFER_SRC when headless so they can be read back
     VkRenderPass renderPass; 
     VkDescriptorSetLayout descriptorSetLayout;
     VkDescriptorPool descriptorPool;
-    VkDescriptorSet descriptorSets[MAX_FRAMES_IN_FLIGHT];
+    uint32_t framesInFlight;
+    VkDescriptorSet* descriptorSets;
     VkPipelineLayout graphicsPipelineLayout;
     VkPipeline graphicsPipeline;
+    VkPipelineCache pipelineCache;//Shared by every pipeline
+    const char* pipelineCachePath;//Where pipelineCache is saved at exit, null when it isn't
     VkFramebuffer* swapchainFramebuffers;
+    std::vector<RetiredSwapchain> retiredSwapchains;
+    bool blockingSwapchainRecreation;//From AppOptions, fixed for the renderer's lifetime
+    uint32_t swapchainRecreations;
     VkCommandPool commandPool;
-    VkCommandPool transientCommandPool;
-    VkCommandBuffer commandBuffers[MAX_FRAMES_IN_FLIGHT];
-    SynchronisationObjects syncObjects[MAX_FRAMES_IN_FLIGHT];
+    VkCommandBuffer* commandBuffers;//One per frame slot and swapchain image, at [frame*swapchainImageCount + image]
+    uint64_t* commandBufferVersions;//sceneVersion each cached command buffer was recorded at, 0 if never
+    uint64_t sceneVersion;//Bumped on swapchain, pipeline or framebuffer changes
+    uint32_t objectCapacity;//Objects the uniform rings, indirect renderer and CPU culler are created for, rings grow past it on demand
+    ParallelRecorder recorder;
+    SynchronisationObjects* syncObjects;
 
     VkPhysicalDeviceMemoryProperties memProperties;
-    VkBuffer vertexBuffer;
-    VkDeviceMemory vertexBufferMemory;
-    VkBuffer indexBuffer;
-    VkDeviceMemory indexBufferMemory;
-    VkBuffer uniformBuffers[MAX_FRAMES_IN_FLIGHT];
-    VkDeviceMemory uniformBuffersMemory[MAX_FRAMES_IN_FLIGHT];
-    void* mappedUniformBuffers[MAX_FRAMES_IN_FLIGHT];
+    DeviceAllocator allocator;
+    UploadQueue uploadQueue;
+    Defragmenter defragmenter;
+    GeometryStore geometryStore;
+    UniformRing* uniformRings;
+    InstanceScene instanceScene;
+    InstanceStream* instanceStreams;
+    bool gpuDriven;//Culling and draw commands come from a compute pass instead of the CPU
+    IndirectRenderer indirectRenderer;
+    VkRenderPass graphRenderPass;//Same attachments as renderPass, layouts are left to the render graph
+    RenderGraph* renderGraphs;//One per frame slot, only when gpuDriven
+    bool printRenderGraph;
+    ObjectScene objectScene;
+    bool cpuCulling;//Only meshes whose bounds touch the frustum are recorded, ignored when gpuDriven
+    CpuCuller cpuCuller;
+    FrameStats frameStats;
+    GpuProfiler gpuProfiler;//Upload batches use the first UPLOAD_BATCH_COUNT scopes, then one per command buffer
+    FrameCapture frameCapture;//Disabled unless --capture was given, one slot per frame in flight
 
     void cleanUp();
 };
 
+uint64_t currentSceneVersion(const VulkanObjects *vko);
+uint32_t frameProfilerScope(uint32_t commandBufferIndex);
+
 void createBuffer(
     VkDevice device, 
-    VkPhysicalDevice physicalDevice,
+    DeviceAllocator *allocator,
     VkBufferUsageFlags usage, 
-    VkMemoryPropertyFlags properties,
+    VkMemoryPropertyFlags requiredProperties,
+    VkMemoryPropertyFlags preferredProperties,
     VkDeviceSize bufferSize, 
     VkBuffer *buffer, 
-    VkDeviceMemory *memory
+    Allocation *allocation
 );
 
-void copyBuffer(
+void destroyBuffer(
     VkDevice device,
-    VkCommandPool commandPool,
-    VkQueue transferQueue,
-    VkBuffer srcBuffer, 
-    VkBuffer dstBuffer, 
-    VkDeviceSize size
+    DeviceAllocator *allocator,
+    VkBuffer buffer,
+    Allocation *allocation
 );
 
 uint32_t findMemoryType(
-    VkPhysicalDevice physicalDevice,
+    const VkPhysicalDeviceMemoryProperties *memProperties,
     uint32_t typeFilter, 
-    VkMemoryPropertyFlags propertyFlags
+    VkMemoryPropertyFlags requiredFlags,
+    VkMemoryPropertyFlags preferredFlags
 );
\ No newline at end of file
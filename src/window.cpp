@@ -7,6 +7,13 @@ void framebufferResizeCallback(GLFWwindow *window, int width, int height){
     wo->framebufferResized = true;
 }
 
+void keyCallback(GLFWwindow *window, int key, int scancode, int action, int mods){
+    WindowObjects *wo = (WindowObjects*)glfwGetWindowUserPointer(window);
+    if(key == GLFW_KEY_P && action == GLFW_PRESS){
+        wo->presentModeCycleRequested = true;
+    }
+}
+
 void initGLFWWindow(WindowObjects *wo, int width, int height){
     if(!glfwInit()){
         printf("GLFW Init failed!\n");
@@ -23,6 +30,7 @@ void initGLFWWindow(WindowObjects *wo, int width, int height){
         exit(EXIT_FAILURE);
     }
 
-    glfwSetWindowUserPointer(wo->window, &wo);
+    glfwSetWindowUserPointer(wo->window, wo);
     glfwSetFramebufferSizeCallback(wo->window, framebufferResizeCallback);
+    glfwSetKeyCallback(wo->window, keyCallback);
 }
\ No newline at end of file
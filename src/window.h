@@ -4,6 +4,7 @@
 struct WindowObjects{
     GLFWwindow *window;
     bool framebufferResized;
+    bool presentModeCycleRequested;//P was pressed
 };
 
 